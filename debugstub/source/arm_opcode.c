@@ -11,6 +11,8 @@
 #include "logging.h"
 
 
+#if defined( DO_LOGGING) && defined( ARM9)
+/* only the ARM9 log shows the stack pointer */
 static uint32_t
 getSP( void) {
   uint32_t reg_value;
@@ -21,6 +23,7 @@ getSP( void) {
 
   return reg_value;
 }
+#endif
 
 #define ARM_B_BL_MASK 0x0e000000
 #define ARM_B_BL 0x0a000000
@@ -247,7 +250,7 @@ arm_LDM_jump( uint32_t opcode, int *thumb_flag, const uint32_t *reg_set) {
     }
   }
 
-  dest_addr = *(uint32_t *)pc_value_addr;
+  dest_addr = *(uint32_t *)(uintptr_t)pc_value_addr;
 
   /* set the thumb state of the destination */
   if ( opcode & ARM_LDM_S_BIT) {
@@ -272,7 +275,6 @@ arm_LDM_jump( uint32_t opcode, int *thumb_flag, const uint32_t *reg_set) {
  */
 static uint32_t
 arm_ADD_jump( uint32_t opcode, int *thumb_flag, const uint32_t *reg_set) {
-  uint32_t Rn_reg = (opcode & ARM_ADD_Rn_MASK) >> 16;
   uint32_t dest_addr = reg_set[PC];
 
   return dest_addr;
@@ -344,7 +346,9 @@ causeJump_arm( uint32_t op_code, int *thumb_flag, const uint32_t *reg_set, uint3
 	  !branch_flag; test_index++) {
     const struct arm_jump_check *jump_test = &jump_table[test_index];
 
+#if defined( DO_LOGGING) && defined( ARM9)
     LOG("sp = %08x - ", getSP());
+#endif
     LOG("Matching op %08x, mask %08x, val %08x res %08x\n", op_code,
 	jump_test->opcode_mask, jump_test->opcode_value,
 	op_code & jump_test->opcode_mask);
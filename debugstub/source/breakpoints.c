@@ -26,10 +26,10 @@ removeAll_breakpoint( const struct breakpoint_descr *list_head) {
     LOG( "Removing bkpt at %08x (n %08x)\n", bkpt->address, (uint32_t)bkpt->next);
     /* place the stored instruction back into memory */
     if ( bkpt->thumb) {
-      *(uint16_t *)bkpt->address = bkpt->instruction.thumb;
+      *(uint16_t *)(uintptr_t)bkpt->address = bkpt->instruction.thumb;
     }
     else {
-      *(uint32_t *)bkpt->address = bkpt->instruction.arm;
+      *(uint32_t *)(uintptr_t)bkpt->address = bkpt->instruction.arm;
     }
 
     bkpt = bkpt->next;
@@ -46,12 +46,12 @@ insertAll_breakpoint( struct breakpoint_descr *list_head) {
     LOG( "Inserting bkpt at %08x (next %08x)\n", bkpt->address, (uint32_t)bkpt->next);
     /* store the current contents of memory and replace it with the bkpt opcode */
     if ( bkpt->thumb) {
-      bkpt->instruction.thumb = *(uint16_t *)bkpt->address;
-      *(uint16_t *)bkpt->address = THUMB_BKPT_OPCODE;
+      bkpt->instruction.thumb = *(uint16_t *)(uintptr_t)bkpt->address;
+      *(uint16_t *)(uintptr_t)bkpt->address = THUMB_BKPT_OPCODE;
     }
     else {
-      bkpt->instruction.arm = *(uint32_t *)bkpt->address;
-      *(uint32_t *)bkpt->address = ARM_BKPT_OPCODE;
+      bkpt->instruction.arm = *(uint32_t *)(uintptr_t)bkpt->address;
+      *(uint32_t *)(uintptr_t)bkpt->address = ARM_BKPT_OPCODE;
     }
 
     bkpt = bkpt->next;
@@ -0,0 +1,402 @@
+/** \file
+ * \brief A core dump of the stopped application, packed as it is sent.
+ *
+ * Only the block being sent is held. A request for a later offset packs the
+ * blocks up to it, one for an earlier offset starts again from the first.
+ * On the DS the packing runs from ITCM.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef ARM9
+#include <nds/ndstypes.h>
+#else
+#define ITCM_CODE
+#endif
+
+#include "debug_stub.h"
+#include "debug_platform.h"
+#include "mem_region.h"
+#include "core_dump.h"
+
+/** The most segments in a dump, so the headers fit in the first block */
+#define MAX_SEGMENTS_CORE 16
+
+/** The ELF header and program header sizes */
+#define EHDR_SIZE 52
+#define PHDR_SIZE 32
+
+/** The size of the NT_PRSTATUS note, its header, name and ARM Linux
+ * struct elf_prstatus */
+#define PRSTATUS_SIZE 148
+#define NOTE_SIZE (12 + 8 + PRSTATUS_SIZE)
+
+/** The matches are found through a hash of the next 4 bytes */
+#define HASH_BITS_CORE 11
+
+
+/** \brief The dump being sent.
+ */
+struct core_dump {
+  /** Flag set once start_core has been called */
+  int started;
+
+  /** The registers r0 to r15 and the status */
+  uint32_t registers[17];
+
+  /** The signal the application stopped with */
+  uint32_t signal;
+
+  /** The regions dumped */
+  const struct mem_region *segments[MAX_SEGMENTS_CORE];
+  uint32_t segment_count;
+
+  /** The size of the headers and the whole file */
+  uint32_t header_size;
+  uint32_t file_size;
+
+  /** Where the block held starts, in the file and in the packed dump */
+  uint32_t file_pos;
+  uint32_t packed_pos;
+
+  /** The length of the block held, in the file and packed with its
+   * header, 0 past the end */
+  uint32_t block_length;
+  uint32_t packed_length;
+};
+
+
+static struct core_dump core;
+
+/** The part of the file being packed */
+static uint8_t raw[BLOCK_SIZE_CORE];
+
+/** The block held */
+static uint8_t packed[4 + BLOCK_SIZE_CORE];
+
+/** The last place each hash of 4 bytes was seen, plus 1 */
+static uint16_t hash_table[1 << HASH_BITS_CORE];
+
+
+/** Place a little endian halfword in a buffer. */
+static void
+putHalf( uint8_t *buffer, uint32_t value) {
+  buffer[0] = value;
+  buffer[1] = value >> 8;
+}
+
+
+/** Place a little endian word in a buffer. */
+static void
+putWord( uint8_t *buffer, uint32_t value) {
+  buffer[0] = value;
+  buffer[1] = value >> 8;
+  buffer[2] = value >> 16;
+  buffer[3] = value >> 24;
+}
+
+
+/** Return the offset in the file of a segment's memory. */
+static uint32_t
+segmentOffset( uint32_t index) {
+  uint32_t offset = core.header_size;
+  uint32_t i;
+
+  for ( i = 0; i < index; i++) {
+    offset += core.segments[i]->size;
+  }
+
+  return offset;
+}
+
+
+/** Write the ELF header, program headers and note into buffer. */
+static void
+putHeaders( uint8_t *buffer) {
+  uint8_t *phdr = buffer + EHDR_SIZE;
+  uint8_t *note = phdr + PHDR_SIZE * (1 + core.segment_count);
+  uint8_t *prstatus = note + 20;
+  uint32_t i;
+
+  memset( buffer, 0, core.header_size);
+
+  /* a 32 bit little endian ARM core file */
+  buffer[0] = 0x7f;
+  buffer[1] = 'E';
+  buffer[2] = 'L';
+  buffer[3] = 'F';
+  buffer[4] = 1;
+  buffer[5] = 1;
+  buffer[6] = 1;
+  putHalf( &buffer[16], 4);
+  putHalf( &buffer[18], 40);
+  putWord( &buffer[20], 1);
+  putWord( &buffer[28], EHDR_SIZE);
+  putHalf( &buffer[40], EHDR_SIZE);
+  putHalf( &buffer[42], PHDR_SIZE);
+  putHalf( &buffer[44], 1 + core.segment_count);
+  putHalf( &buffer[46], 40);
+
+  /* the note comes first */
+  putWord( &phdr[0], 4);
+  putWord( &phdr[4], note - buffer);
+  putWord( &phdr[16], NOTE_SIZE);
+  putWord( &phdr[28], 4);
+
+  for ( i = 0; i < core.segment_count; i++) {
+    const struct mem_region *region = core.segments[i];
+    uint8_t *load = phdr + PHDR_SIZE * (1 + i);
+
+    putWord( &load[0], 1);
+    putWord( &load[4], segmentOffset( i));
+    putWord( &load[8], region->start);
+    putWord( &load[12], region->start);
+    putWord( &load[16], region->size);
+    putWord( &load[20], region->size);
+    putWord( &load[24], (region->flags & WRITE_REGION) ? 0x7 : 0x5);
+    putWord( &load[28], 4);
+  }
+
+  putWord( &note[0], 5);
+  putWord( &note[4], PRSTATUS_SIZE);
+  putWord( &note[8], 1);
+  memcpy( &note[12], "CORE", 5);
+
+  /* si_signo, pr_cursig and pr_reg */
+  putWord( &prstatus[0], core.signal);
+  putHalf( &prstatus[12], core.signal);
+  for ( i = 0; i < 17; i++) {
+    putWord( &prstatus[72 + 4 * i], core.registers[i]);
+  }
+}
+
+
+/** Fill raw with the part of the file from pos. Returns its length. */
+static uint32_t
+readFile( uint32_t pos) {
+  uint32_t length = core.file_size - pos < BLOCK_SIZE_CORE ?
+    core.file_size - pos : BLOCK_SIZE_CORE;
+  uint32_t offset = core.header_size;
+  uint32_t i;
+
+  /* the headers all fit in the first block */
+  if ( pos == 0) {
+    putHeaders( raw);
+  }
+
+  for ( i = 0; i < core.segment_count; i++) {
+    const struct mem_region *region = core.segments[i];
+    uint32_t start = pos > offset ? pos : offset;
+    uint32_t stop = pos + length < offset + region->size ? pos + length : offset + region->size;
+
+    if ( start < stop) {
+      uint32_t done = read_region( region, &raw[start - pos], region->start + start - offset,
+				   stop - start);
+
+      memset( &raw[start - pos + done], 0, stop - start - done);
+    }
+    offset += region->size;
+  }
+
+  return length;
+}
+
+
+/** Place a length continued past 15 in bytes added on. */
+static uint32_t
+putLength( uint8_t *out, uint32_t length) {
+  uint32_t used = 0;
+
+  while ( length >= 255) {
+    out[used++] = 255;
+    length -= 255;
+  }
+  out[used++] = length;
+
+  return used;
+}
+
+
+/** Write a sequence of literal_count literals and a match, returning the
+ * bytes used, 0 if there is not room for it before limit. */
+static uint32_t
+putSequence( uint8_t *out, uint32_t limit, const uint8_t *literals, uint32_t literal_count,
+	     uint32_t distance, uint32_t match_length) {
+  uint32_t used = 1;
+  uint32_t match_extra = match_length - MIN_MATCH_CORE;
+
+  if ( literal_count + literal_count / 255 + match_length / 255 + 6 > limit) {
+    return 0;
+  }
+
+  out[0] = (literal_count < 15 ? literal_count : 15) << 4;
+  if ( literal_count >= 15) {
+    used += putLength( &out[used], literal_count - 15);
+  }
+  memcpy( &out[used], literals, literal_count);
+  used += literal_count;
+
+  if ( match_length == 0) {
+    return used;
+  }
+
+  out[0] |= match_extra < 15 ? match_extra : 15;
+  putHalf( &out[used], distance);
+  used += 2;
+  if ( match_extra >= 15) {
+    used += putLength( &out[used], match_extra - 15);
+  }
+
+  return used;
+}
+
+
+/** Pack length bytes of raw into out. Returns the packed length, 0 if it
+ * would not be shorter. The step through data that does not match grows
+ * so that it is passed over quickly. */
+static uint32_t ITCM_CODE
+packBlock( uint8_t *out, uint32_t length) {
+  uint32_t pos = 0;
+  uint32_t anchor = 0;
+  uint32_t used = 0;
+  uint32_t misses = 0;
+  uint32_t size;
+
+  memset( hash_table, 0, sizeof( hash_table));
+
+  while ( pos + MIN_MATCH_CORE <= length) {
+    uint32_t next = raw[pos] | (raw[pos + 1] << 8) | (raw[pos + 2] << 16) |
+      ((uint32_t)raw[pos + 3] << 24);
+    uint32_t hash = (next * 2654435761u) >> (32 - HASH_BITS_CORE);
+    uint32_t candidate = hash_table[hash];
+
+    hash_table[hash] = pos + 1;
+    if ( candidate != 0 && memcmp( &raw[candidate - 1], &raw[pos], MIN_MATCH_CORE) == 0) {
+      uint32_t match = candidate - 1;
+      uint32_t match_length = MIN_MATCH_CORE;
+
+      while ( pos + match_length < length && raw[match + match_length] == raw[pos + match_length]) {
+	match_length += 1;
+      }
+
+      size = putSequence( &out[used], length - used, &raw[anchor], pos - anchor,
+			  pos - match, match_length);
+      if ( size == 0) {
+	return 0;
+      }
+      used += size;
+      pos += match_length;
+      anchor = pos;
+      misses = 0;
+    }
+    else {
+      pos += 1 + (misses++ >> 5);
+    }
+  }
+
+  /* the rest are literals */
+  size = putSequence( &out[used], length - used, &raw[anchor], length - anchor, 0, 0);
+  if ( size == 0) {
+    return 0;
+  }
+  used += size;
+
+  return used < length ? used : 0;
+}
+
+
+/** Pack the block of the file at core.file_pos into packed. */
+static void
+packNext( void) {
+  uint32_t length;
+  uint32_t size;
+
+  if ( core.file_pos >= core.file_size) {
+    core.block_length = 0;
+    core.packed_length = 0;
+    return;
+  }
+
+  length = readFile( core.file_pos);
+  core.block_length = length;
+  size = packBlock( &packed[4], length);
+  if ( size == 0) {
+    memcpy( &packed[4], raw, length);
+    size = length;
+  }
+  putHalf( &packed[0], length);
+  putHalf( &packed[2], size);
+  core.packed_length = 4 + size;
+}
+
+
+/** Go back to the first block. */
+static void
+restart( void) {
+  core.file_pos = 0;
+  core.packed_pos = 0;
+  packNext();
+}
+
+
+/* the segments are the regions of the map marked for it */
+void
+start_core( const uint32_t *registers, uint32_t pc, uint32_t cpsr, uint32_t signal) {
+  uint32_t count;
+  const struct mem_region *regions = regions_platform( &count);
+  uint32_t i;
+
+  memcpy( core.registers, registers, 15 * sizeof( uint32_t));
+  core.registers[15] = pc;
+  core.registers[16] = cpsr;
+  core.signal = signal;
+
+  core.segment_count = 0;
+  for ( i = 0; i < count && core.segment_count < MAX_SEGMENTS_CORE; i++) {
+    if ( regions[i].flags & CORE_REGION) {
+      core.segments[core.segment_count++] = &regions[i];
+    }
+  }
+
+  core.header_size = EHDR_SIZE + PHDR_SIZE * (1 + core.segment_count) + NOTE_SIZE;
+  core.file_size = segmentOffset( core.segment_count);
+  core.started = 1;
+
+  restart();
+}
+
+
+/* the blocks are packed as the offsets asked for reach them, a block is
+ * passed as soon as it has all been sent */
+int
+read_core( uint32_t offset, uint8_t *buffer, uint32_t length, uint32_t *count) {
+  uint32_t done = 0;
+
+  if ( !core.started) {
+    return -1;
+  }
+  if ( offset < core.packed_pos) {
+    restart();
+  }
+
+  while ( core.packed_length > 0 && done < length) {
+    uint32_t end = core.packed_pos + core.packed_length;
+
+    if ( offset + done < end) {
+      uint32_t size = end - (offset + done) < length - done ? end - (offset + done) : length - done;
+
+      memcpy( &buffer[done], &packed[offset + done - core.packed_pos], size);
+      done += size;
+    }
+    if ( offset + done >= end) {
+      core.file_pos += core.block_length;
+      core.packed_pos = end;
+      packNext();
+    }
+  }
+
+  *count = done;
+
+  return core.packed_length == 0;
+}
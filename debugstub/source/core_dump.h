@@ -0,0 +1,49 @@
+#ifndef _CORE_DUMP_H_
+#define _CORE_DUMP_H_ 1
+/** \file
+ * \brief A core dump of the stopped application, packed as it is sent.
+ *
+ * The dump is an ELF core file: the registers in an NT_PRSTATUS note (laid
+ * out as ARM Linux does, which is what GDB and BFD read) and a PT_LOAD
+ * segment for each region of the memory map marked CORE_REGION. It is cut
+ * into blocks of BLOCK_SIZE_CORE bytes, each packed on its own, and read
+ * with qXfer:core:read:: from offset 0. A block is
+ *
+ *   the length of the block's part of the file, 2 bytes
+ *   the length of the packed data, 2 bytes, the same if it is not packed
+ *   the packed data
+ *
+ * the numbers little endian. The packed data is a series of sequences:
+ *
+ *   a token byte, the count of literals in the top 4 bits and the length
+ *   of the match less MIN_MATCH_CORE in the bottom 4 bits, 15 in either
+ *   being continued by bytes added on until one is less than 255
+ *   the literals
+ *   the distance back to the match, 2 bytes
+ *   the match length's extra bytes
+ *
+ * the last sequence of a block ending after its literals. tools/rsp_core
+ * fetches and unpacks it.
+ */
+
+/** The size of the blocks the file is packed in */
+#define BLOCK_SIZE_CORE 4096
+
+/** The shortest match packed */
+#define MIN_MATCH_CORE 4
+
+
+/** Start a dump of the application stopped with signal, taking its
+ * registers (r0 to r14), pc and status. */
+void
+start_core( const uint32_t *registers, uint32_t pc, uint32_t cpsr, uint32_t signal);
+
+
+/** Copy length bytes of the packed dump from offset into buffer. *count is
+ * set to the bytes copied. Returns 1 if they end the dump, 0 if more
+ * follows and -1 if no dump has been started. Memory that faults is dumped
+ * as zeros. */
+int
+read_core( uint32_t offset, uint8_t *buffer, uint32_t length, uint32_t *count);
+
+#endif /* End of _CORE_DUMP_H_ */
@@ -0,0 +1,61 @@
+/** \file
+ * \brief The CRC-32 GDB's compare-sections checks memory with (qCRC).
+ *
+ * On the DS the loop runs from ITCM and the table is in DTCM, so checking
+ * megabytes does not wait on main RAM for anything but the data.
+ */
+#include <stdint.h>
+
+#ifdef ARM9
+#include <nds/ndstypes.h>
+#else
+#define ITCM_CODE
+#define DTCM_BSS
+#endif
+
+#include "crc32.h"
+
+/** The CRC-32 polynomial */
+#define POLYNOMIAL_CRC 0x04c11db7
+
+
+/** The CRC of each value of the top byte */
+static uint32_t crc_table[256] DTCM_BSS;
+
+
+/* the table is small enough to build at start up */
+void
+init_crc( void) {
+  uint32_t i;
+
+  for ( i = 0; i < 256; i++) {
+    uint32_t crc = i << 24;
+    int bit;
+
+    for ( bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80000000) ? (crc << 1) ^ POLYNOMIAL_CRC : crc << 1;
+    }
+    crc_table[i] = crc;
+  }
+}
+
+
+/* a byte at a time through the table */
+ITCM_CODE uint32_t
+update_crc( uint32_t crc, const uint8_t *data, uint32_t length) {
+  while ( length >= 4) {
+    crc = (crc << 8) ^ crc_table[(crc >> 24) ^ data[0]];
+    crc = (crc << 8) ^ crc_table[(crc >> 24) ^ data[1]];
+    crc = (crc << 8) ^ crc_table[(crc >> 24) ^ data[2]];
+    crc = (crc << 8) ^ crc_table[(crc >> 24) ^ data[3]];
+    data += 4;
+    length -= 4;
+  }
+
+  while ( length > 0) {
+    crc = (crc << 8) ^ crc_table[(crc >> 24) ^ *data++];
+    length -= 1;
+  }
+
+  return crc;
+}
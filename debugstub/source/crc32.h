@@ -0,0 +1,23 @@
+#ifndef _CRC32_H_
+#define _CRC32_H_ 1
+/** \file
+ * \brief The CRC-32 GDB's compare-sections checks memory with (qCRC).
+ *
+ * It is the big endian form of the polynomial 0x04c11db7 with no final
+ * inversion, as libiberty's xcrc32. GDB starts it from 0xffffffff.
+ */
+
+/** The value GDB starts the CRC from */
+#define START_CRC 0xffffffff
+
+
+/** Build the table the CRC is worked out with, before update_crc is used. */
+void
+init_crc( void);
+
+
+/** Return crc updated with length bytes of data. */
+uint32_t
+update_crc( uint32_t crc, const uint8_t *data, uint32_t length);
+
+#endif /* End of _CRC32_H_ */
@@ -13,3 +13,195 @@
 debugHalt:
 	bkpt
 	bx	lr
+
+
+	.global irqEntry_debug
+	.global breakInArm_debug
+	.global breakInThumb_debug
+
+/*
+ * The IRQ handler the BIOS calls, it has already pushed r0-r3, r12 and the
+ * return address + 4 on the IRQ stack. Records where that is and the
+ * interrupted CPSR, lets the stub redirect the return if it wants to break
+ * in, then carries on into the application's handler with the BIOS's lr.
+ * Uses struct irq_entry_debug {frame, spsr, break_signal, app_handler}.
+ */
+irqEntry_debug:
+	ldr	r0, =irq_entry_debug
+	str	sp, [r0]
+	mrs	r1, spsr
+	str	r1, [r0, #4]
+	ldr	r1, [r0, #8]
+	cmp	r1, #0
+	beq	1f
+	stmfd	sp!, {r0, lr}
+	bl	redirectIRQ_debug
+	ldmfd	sp!, {r0, lr}
+1:
+	ldr	r0, [r0, #12]
+	bx	r0
+
+/* Where redirected ARM code enters the debugger */
+breakInArm_debug:
+	bkpt
+	b	breakInArm_debug
+
+/* Where redirected Thumb code enters the debugger */
+	.thumb
+	.align	1
+	.thumb_func
+breakInThumb_debug:
+	bkpt
+	b	breakInThumb_debug
+
+	.arm
+
+
+	.global abortGuard_debug
+	.global copyGuarded_debug
+
+/*
+ * Where the BIOS exception vector points while copyGuarded_debug runs. The
+ * BIOS calls it in abort mode with the protection unit off, as libnds's
+ * own handler finds it. It does not go back through the BIOS, whose
+ * return would depend on the address it works out from lr_abt (lr - 4
+ * carries on after an aborted load, lr - 8 retries it for ever) and on it
+ * putting sp_abt back, which the stub is running on. Instead the
+ * protection unit is turned back on and the copy carries on at the resume
+ * address it set, in the mode it runs in, with r0-r11 as they were. The
+ * BIOS's frame is left on its debug stack, jumpBack does not use it.
+ * Uses struct copy_guard_debug {mode, resume}.
+ */
+abortGuard_debug:
+	mrc	p15, 0, r12, c1, c0, 0
+	orr	r12, r12, #1
+	mcr	p15, 0, r12, c1, c0, 0
+	ldr	r12, =copy_guard_debug
+	ldr	r12, [r12]
+	msr	cpsr_c, r12
+	ldr	r12, =copy_guard_debug
+	ldr	pc, [r12, #4]
+
+/*
+ * uint32_t copyGuarded_debug( void *dest, const void *src, uint32_t length,
+ *                             uint32_t width)
+ * Copies width (1, 2 or 4) bytes at a time and returns the number of bytes
+ * copied before one aborted. Bytes are copied four words at a time when
+ * dest and src line up, halfwords two at a time; if a wide access aborts
+ * the copy resumes a unit at a time from the last one done to find the
+ * exact one. The count only goes up once a store is done. Interrupts are
+ * off, so an abort can only come from the copy. An abort overwrites lr_abt,
+ * sp_abt and SPSR_abt, which the stub is still using when a bkpt brought
+ * it in, so sp is kept in r11, lr on the stack, and the SPSR is put back.
+ */
+copyGuarded_debug:
+	stmfd	sp!, {r4-r11, lr}
+	mrs	r4, spsr
+	mrs	r12, cpsr
+	stmfd	sp!, {r4, r12}
+	mov	r11, sp
+	orr	r12, r12, #0x80
+	msr	cpsr_c, r12
+	ldr	r5, =copy_guard_debug
+	str	r12, [r5]
+	mov	r6, #0
+	cmp	r3, #2
+	beq	20f
+	bhi	4f
+	eor	r12, r0, r1
+	tst	r12, #3
+	bne	1f
+	adr	r12, 9f
+	str	r12, [r5, #4]
+10:
+	/* single bytes up to a word boundary */
+	add	r12, r1, r6
+	tst	r12, #3
+	beq	11f
+	cmp	r6, r2
+	bhs	9f
+	ldrb	r12, [r1, r6]
+	strb	r12, [r0, r6]
+	add	r6, r6, #1
+	b	10b
+11:
+	adr	r12, 13f
+	str	r12, [r5, #4]
+12:
+	/* four words a go */
+	sub	r12, r2, r6
+	cmp	r12, #16
+	blo	14f
+	add	r12, r1, r6
+	ldmia	r12, {r7-r10}
+	add	r12, r0, r6
+	stmia	r12, {r7-r10}
+	add	r6, r6, #16
+	b	12b
+14:
+	/* the words left */
+	sub	r12, r2, r6
+	cmp	r12, #4
+	blo	1f
+	ldr	r12, [r1, r6]
+	str	r12, [r0, r6]
+	add	r6, r6, #4
+	b	14b
+13:
+	/* a word access aborted, carry on a byte at a time */
+	mov	sp, r11
+1:
+	adr	r12, 9f
+	str	r12, [r5, #4]
+15:
+	cmp	r6, r2
+	bhs	9f
+	ldrb	r12, [r1, r6]
+	strb	r12, [r0, r6]
+	add	r6, r6, #1
+	b	15b
+20:
+	adr	r12, 21f
+	str	r12, [r5, #4]
+22:
+	/* two halfwords a go */
+	sub	r12, r2, r6
+	cmp	r12, #4
+	blo	2f
+	ldrh	r7, [r1, r6]
+	add	r12, r6, #2
+	ldrh	r8, [r1, r12]
+	strh	r7, [r0, r6]
+	strh	r8, [r0, r12]
+	add	r6, r6, #4
+	b	22b
+21:
+	/* a halfword access aborted, carry on one at a time */
+	mov	sp, r11
+2:
+	adr	r12, 9f
+	str	r12, [r5, #4]
+23:
+	cmp	r6, r2
+	bhs	9f
+	ldrh	r12, [r1, r6]
+	strh	r12, [r0, r6]
+	add	r6, r6, #2
+	b	23b
+4:
+	adr	r12, 9f
+	str	r12, [r5, #4]
+40:
+	cmp	r6, r2
+	bhs	9f
+	ldr	r12, [r1, r6]
+	str	r12, [r0, r6]
+	add	r6, r6, #4
+	b	40b
+9:
+	mov	sp, r11
+	ldmfd	sp!, {r4, r12}
+	msr	spsr_cxsf, r4
+	msr	cpsr_c, r12
+	mov	r0, r6
+	ldmfd	sp!, {r4-r11, pc}
@@ -0,0 +1,644 @@
+/** \file
+ * \brief The GDB packet layer built on top of the comms function interface.
+ *
+ * Bytes are taken from the comms mechanism a chunk at a time and run through
+ * a framing state machine that persists between calls, so any bytes following
+ * the end of a packet are kept for the next read.
+ *
+ * Replies are described as a list of segments that are encoded, run length
+ * compressed and checksummed in a single pass into a staging chunk, so
+ * memory is sent without first building the whole reply.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug_stub.h"
+#include "debug_comms.h"
+#include "debug_platform.h"
+#include "hex_codec.h"
+#include "rsp_trace.h"
+#include "logging.h"
+
+/** The largest number of bytes read from the comms mechanism in one go */
+#define RX_CHUNK_SIZE 256
+
+/** The size of the transmit staging area, the most data handed to the
+ * comms mechanism in one go */
+#define TX_CHUNK_SIZE 1024
+
+/** The number of bytes of memory converted at a time when encoding a packet */
+#define TX_BLOCK_SIZE 32
+
+/** The offset added to a run length to make it a printable character */
+#define RLE_COUNT_OFFSET 29
+
+/** The fewest repeats worth encoding, the '*' and count take two chars */
+#define RLE_MIN_REPEAT 3
+
+/** The most repeats one count character can describe (a count of '~') */
+#define RLE_MAX_REPEAT (126 - RLE_COUNT_OFFSET)
+
+
+
+/** Call the comms interface receive function. */
+#define getDebugChar( comms_if, byte_addr) (comms_if)->readByte_fn( byte_addr)
+
+/** Call the comms interface transmit function. */
+#define putDebugChar( comms_if, byte) (comms_if)->writeByte_fn( (byte))
+
+/** Poll the comms interface */
+#define poll_comms( comms_if) if ( (comms_if)->poll_fn != NULL) (comms_if)->poll_fn();
+
+
+/** The packet framing states.
+ */
+enum rx_frame_state {
+  /** Waiting for the '$' that starts a packet */
+  WAIT_START_RX,
+
+  /** Reading the packet data up to the '#' */
+  DATA_RX,
+
+  /** Reading the high checksum digit */
+  CHECKSUM_HIGH_RX,
+
+  /** Reading the low checksum digit */
+  CHECKSUM_LOW_RX
+};
+
+
+/** The packet receiver state.
+ */
+struct rx_descr {
+  /** The buffer packets are received into */
+  uint8_t *buffer;
+
+  /** The size of the packet buffer */
+  uint32_t buffer_size;
+
+  /** The bytes read from the comms mechanism */
+  uint8_t chunk[RX_CHUNK_SIZE];
+
+  /** The index of the next unconsumed byte in the chunk */
+  uint32_t chunk_pos;
+
+  /** The number of valid bytes in the chunk */
+  uint32_t chunk_len;
+
+  /** The current framing state */
+  enum rx_frame_state state;
+
+  /** The number of data bytes in the packet so far */
+  uint32_t count;
+
+  /** The running checksum of the packet data */
+  uint8_t checksum;
+
+  /** The checksum sent by GDB, -1 if it was not valid hex */
+  int xmitcsum;
+
+  /** Flag set once GDB and the stub have stopped acknowledging packets */
+  int no_ack_mode;
+
+  /** Flag set when a new GDB session starts, possibly from an interrupt */
+  volatile int reset_pending;
+};
+
+
+/** The instance of the packet receiver */
+static struct rx_descr rx_descr;
+
+
+/** The packet transmitter state.
+ */
+struct tx_descr {
+  /** The comms interface the packet is going to */
+  struct comms_fn_iface_debug *comms_if;
+
+  /** The encoded packet data waiting to be sent, with room for the trailer */
+  uint8_t chunk[TX_CHUNK_SIZE + 3];
+
+  /** The number of bytes in the chunk */
+  uint32_t length;
+
+  /** The number of bytes of the packet already handed to the comms mechanism */
+  uint32_t sent;
+
+  /** The running checksum of the packet data */
+  uint8_t checksum;
+
+  /** The character of the run being collected */
+  uint8_t run_char;
+
+  /** The number of repeats following the first run_char, -1 if there is no run */
+  int run_repeats;
+};
+
+
+/** The instance of the packet transmitter */
+static struct tx_descr tx_descr;
+
+
+/** The packet trace state.
+ */
+struct trace_descr {
+  /** Where the trace is written, NULL if it is not being recorded */
+  const struct trace_sink_debug *sink;
+
+  /** The time of the last record */
+  uint32_t last_time;
+
+  /** Flag set when an interrupt from GDB is waiting to be recorded */
+  volatile int break_pending;
+
+  /** The time of the interrupt */
+  volatile uint32_t break_time;
+};
+
+
+/** The instance of the packet trace */
+static struct trace_descr trace_descr;
+
+
+/** Add a varint to a trace record, returning the next free byte. */
+static uint8_t *
+putVarint( uint8_t *ptr, uint32_t value) {
+  while ( value >= 0x80) {
+    *ptr++ = (value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  *ptr++ = value;
+
+  return ptr;
+}
+
+
+/** Write a trace record, data is NULL if the record has none. An interrupt
+ * that arrived since the last record is written first. */
+static void
+traceRecord( enum record_type_trace type, const uint8_t *data, uint32_t length) {
+  const struct trace_sink_debug *sink = trace_descr.sink;
+  uint8_t header[2 * (1 + 2 * MAX_VARINT_TRACE)];
+  uint8_t *ptr = header;
+  uint32_t now;
+
+  if ( trace_descr.break_pending) {
+    trace_descr.break_pending = 0;
+    *ptr++ = BREAK_TRACE;
+    ptr = putVarint( ptr, trace_descr.break_time - trace_descr.last_time);
+    ptr = putVarint( ptr, 0);
+    trace_descr.last_time = trace_descr.break_time;
+  }
+
+  now = sink->time_fn( sink->context);
+  *ptr++ = type;
+  ptr = putVarint( ptr, now - trace_descr.last_time);
+  ptr = putVarint( ptr, length);
+  trace_descr.last_time = now;
+
+  sink->write_fn( sink->context, header, ptr - header);
+  if ( data != NULL) {
+    sink->write_fn( sink->context, data, length);
+  }
+}
+
+
+/** Refill the receive chunk from the comms mechanism, polling it if nothing
+ * is available. Transports without a block read are read a byte at a time.
+ */
+static void
+fillChunk( struct comms_fn_iface_debug *comms_if) {
+  int count;
+
+  if ( comms_if->readData_fn != NULL) {
+    count = comms_if->readData_fn( rx_descr.chunk, RX_CHUNK_SIZE);
+  }
+  else {
+    count = getDebugChar( comms_if, &rx_descr.chunk[0]);
+  }
+
+  if ( count > 0) {
+    rx_descr.chunk_pos = 0;
+    rx_descr.chunk_len = count;
+  }
+  else {
+    poll_comms( comms_if);
+  }
+}
+
+
+/** Read a single byte, blocking until one is available. */
+static uint8_t
+readBlockByte( struct comms_fn_iface_debug *comms_if) {
+  while ( rx_descr.chunk_pos == rx_descr.chunk_len) {
+    fillChunk( comms_if);
+  }
+
+  return rx_descr.chunk[rx_descr.chunk_pos++];
+}
+
+
+/** Forget everything about the previous GDB session. */
+static void
+resetSession( void) {
+  rx_descr.reset_pending = 0;
+  rx_descr.chunk_pos = 0;
+  rx_descr.chunk_len = 0;
+  rx_descr.state = WAIT_START_RX;
+  rx_descr.no_ack_mode = 0;
+}
+
+
+/* scan for the sequence $<data>#<checksum>     */
+uint8_t *
+getPacket_comms( struct comms_fn_iface_debug *comms_if, uint32_t *length) {
+  uint8_t *buffer = rx_descr.buffer;
+
+  while (1) {
+    uint8_t *data;
+    uint8_t *end;
+
+    if ( rx_descr.reset_pending) {
+      resetSession();
+    }
+
+    while ( rx_descr.chunk_pos == rx_descr.chunk_len) {
+      fillChunk( comms_if);
+    }
+    data = &rx_descr.chunk[rx_descr.chunk_pos];
+    end = &rx_descr.chunk[rx_descr.chunk_len];
+
+    switch ( rx_descr.state) {
+    case WAIT_START_RX:
+      /* ignore all characters up to the start character */
+      data = memchr( data, '$', end - data);
+      if ( data == NULL) {
+	data = end;
+      }
+      else {
+	/* the buffer may still be the source of a background copy of the
+	 * last packet's memory (startCopy_platform), which has had the reply
+	 * and the wait for this packet to finish in; it must be done before
+	 * any of this packet is taken in */
+	finishCopy_platform();
+	data += 1;
+	rx_descr.state = DATA_RX;
+	rx_descr.count = 0;
+	rx_descr.checksum = 0;
+      }
+      break;
+
+    case DATA_RX: {
+      uint32_t max_count = rx_descr.buffer_size - 1;
+      uint32_t count = rx_descr.count;
+      uint8_t checksum = rx_descr.checksum;
+
+      /* take everything up to the '#' in the chunk */
+      while ( data < end) {
+	uint8_t ch = *data++;
+
+	if ( ch == '#') {
+	  rx_descr.state = CHECKSUM_HIGH_RX;
+	  break;
+	}
+	if ( ch == '$') {
+	  /* restart the packet */
+	  count = 0;
+	  checksum = 0;
+	}
+	else if ( count < max_count) {
+	  checksum += ch;
+	  buffer[count++] = ch;
+	}
+	else {
+	  /* too big for the buffer, drop it */
+	  rx_descr.state = WAIT_START_RX;
+	  break;
+	}
+      }
+
+      rx_descr.count = count;
+      rx_descr.checksum = checksum;
+      break;
+    }
+
+    case CHECKSUM_HIGH_RX:
+      rx_descr.xmitcsum = hexValue_codec( *data++);
+      rx_descr.state = CHECKSUM_LOW_RX;
+      break;
+
+    case CHECKSUM_LOW_RX: {
+      int low = hexValue_codec( *data++);
+
+      if ( rx_descr.xmitcsum < 0 || low < 0) {
+	rx_descr.xmitcsum = -1;
+      }
+      else {
+	rx_descr.xmitcsum = (rx_descr.xmitcsum << 4) | low;
+      }
+      rx_descr.state = WAIT_START_RX;
+      rx_descr.chunk_pos = data - rx_descr.chunk;
+
+      if ( trace_descr.sink != NULL &&
+	   (rx_descr.no_ack_mode || rx_descr.checksum == rx_descr.xmitcsum)) {
+	traceRecord( IN_TRACE, buffer, rx_descr.count);
+      }
+
+      if ( rx_descr.no_ack_mode) {
+	/* the transport is reliable, GDB does not want to hear about it */
+	buffer[rx_descr.count] = 0;
+	*length = rx_descr.count;
+	return &buffer[0];
+      }
+
+      if ( rx_descr.checksum != rx_descr.xmitcsum) {
+	putDebugChar( comms_if, '-');	/* failed checksum */
+      }
+      else {
+	putDebugChar( comms_if, '+');	/* successful transfer */
+	buffer[rx_descr.count] = 0;
+
+	/* if a sequence char is present, reply the sequence ID */
+	if ( rx_descr.count >= 3 && buffer[2] == ':') {
+	  putDebugChar( comms_if, buffer[0]);
+	  putDebugChar( comms_if, buffer[1]);
+
+	  *length = rx_descr.count - 3;
+	  return &buffer[3];
+	}
+
+	*length = rx_descr.count;
+	return &buffer[0];
+      }
+      break;
+    }
+    }
+
+    rx_descr.chunk_pos = data - rx_descr.chunk;
+  }
+}
+
+
+/** Send the staged packet data to the comms mechanism. */
+static void
+sendChunk( void) {
+  if ( tx_descr.length > 0) {
+    tx_descr.comms_if->writeData_fn( tx_descr.chunk, tx_descr.length);
+    tx_descr.sent += tx_descr.length;
+    tx_descr.length = 0;
+  }
+}
+
+
+/** Stage a character of the encoded packet, adding it to the checksum. */
+static inline void
+putChunkChar( uint8_t ch) {
+  if ( tx_descr.length == TX_CHUNK_SIZE) {
+    sendChunk();
+  }
+  tx_descr.chunk[tx_descr.length++] = ch;
+  tx_descr.checksum += ch;
+}
+
+
+/*
+ * Stage the run being collected.
+ * A run is sent as the character followed by '*' and the repeat count plus 29.
+ */
+static void
+flushRun( void) {
+  int repeats = tx_descr.run_repeats;
+  uint8_t ch = tx_descr.run_char;
+
+  if ( repeats < 0) {
+    return;
+  }
+
+  putChunkChar( ch);
+
+  if ( repeats >= RLE_MIN_REPEAT) {
+    int encoded = repeats;
+
+    /* the count must not be a '#' or '$', send a shorter run and the
+     * remainder as they are */
+    if ( encoded + RLE_COUNT_OFFSET == '#' || encoded + RLE_COUNT_OFFSET == '$') {
+      encoded = '#' - RLE_COUNT_OFFSET - 1;
+    }
+
+    putChunkChar( '*');
+    putChunkChar( encoded + RLE_COUNT_OFFSET);
+    repeats -= encoded;
+  }
+
+  while ( repeats > 0) {
+    putChunkChar( ch);
+    repeats -= 1;
+  }
+
+  tx_descr.run_repeats = -1;
+}
+
+
+/** Add a character of packet data, collecting runs of the same character. */
+static inline void
+putPacketChar( uint8_t ch) {
+  if ( tx_descr.run_repeats >= 0 && ch == tx_descr.run_char &&
+       tx_descr.run_repeats < RLE_MAX_REPEAT) {
+    tx_descr.run_repeats += 1;
+  }
+  else {
+    /* most characters do not repeat the one before, stage those here
+     * rather than through flushRun */
+    if ( tx_descr.run_repeats == 0) {
+      putChunkChar( tx_descr.run_char);
+    }
+    else {
+      flushRun();
+    }
+    tx_descr.run_char = ch;
+    tx_descr.run_repeats = 0;
+  }
+}
+
+
+/** Add count characters of packet data. */
+static void
+putPacketData( const uint8_t *data, uint32_t count) {
+  uint32_t i;
+
+  for ( i = 0; i < count; i++) {
+    putPacketChar( data[i]);
+  }
+}
+
+
+/** Encode a segment into the packet, memory is converted a block at a time
+ * so it is only read once. */
+static void
+putSegment( const struct segment_comms *segment) {
+  uint8_t block[2 * TX_BLOCK_SIZE];
+  const uint8_t *data = segment->data;
+  uint32_t remaining = segment->length;
+
+  switch ( segment->encoding) {
+  case RAW_SEGMENT:
+    putPacketData( data, remaining);
+    break;
+
+  case HEX_SEGMENT:
+    while ( remaining > 0) {
+      uint32_t count = remaining < TX_BLOCK_SIZE ? remaining : TX_BLOCK_SIZE;
+
+      putPacketData( block, encodeHex_codec( block, data, count) - block);
+      data += count;
+      remaining -= count;
+    }
+    break;
+
+  case BIN_SEGMENT:
+    while ( remaining > 0) {
+      uint32_t count = remaining;
+      uint8_t *block_end = escapeBin_codec( block, &block[sizeof( block)], data, &count);
+
+      putPacketData( block, block_end - block);
+      data += count;
+      remaining -= count;
+    }
+    break;
+  }
+}
+
+
+/*
+ * send the packet made up of the segments, the checksum is built as the
+ * packet is encoded and the packet handed to the comms mechanism a chunk
+ * at a time.
+ */
+void
+putSegments_comms( struct comms_fn_iface_debug *comms_if,
+		   const struct segment_comms *segments, int count) {
+  uint8_t trailer[3];
+  int first = 1;
+
+  /*  $<packet info>#<checksum>. */
+
+  tx_descr.comms_if = comms_if;
+
+  do {
+    int i;
+    uint32_t packet_length;
+
+    tx_descr.chunk[0] = '$';
+    tx_descr.length = 1;
+    tx_descr.sent = 0;
+    tx_descr.checksum = 0;
+    tx_descr.run_repeats = -1;
+
+    for ( i = 0; i < count; i++) {
+      putSegment( &segments[i]);
+    }
+    flushRun();
+    packet_length = tx_descr.sent + tx_descr.length - 1;
+
+    trailer[0] = '#';
+    trailer[1] = hexchars[tx_descr.checksum >> 4];
+    trailer[2] = hexchars[tx_descr.checksum & 0xf];
+
+    if ( comms_if->writeVector_fn != NULL) {
+      struct iovec_debug vector[2];
+
+      vector[0].base = tx_descr.chunk;
+      vector[0].length = tx_descr.length;
+      vector[1].base = trailer;
+      vector[1].length = sizeof( trailer);
+      comms_if->writeVector_fn( vector, 2);
+      tx_descr.length = 0;
+    }
+    else {
+      /* the chunk has room for the trailer */
+      memcpy( &tx_descr.chunk[tx_descr.length], trailer, sizeof( trailer));
+      tx_descr.length += sizeof( trailer);
+      sendChunk();
+    }
+
+    /* a resend is not recorded */
+    if ( first && trace_descr.sink != NULL) {
+      traceRecord( OUT_TRACE, NULL, packet_length);
+    }
+    first = 0;
+
+    /* target memory has not changed, so a NAK is answered by encoding
+     * the segments again */
+  } while ( !rx_descr.no_ack_mode && readBlockByte( comms_if) != '+');
+}
+
+
+/* send the packet in buffer */
+void
+putPacket_comms( struct comms_fn_iface_debug *comms_if, const uint8_t *buffer, uint32_t length) {
+  struct segment_comms segment;
+
+  segment.encoding = RAW_SEGMENT;
+  segment.data = buffer;
+  segment.length = length;
+
+  putSegments_comms( comms_if, &segment, 1);
+}
+
+
+/* set the buffer packets are received into */
+void
+setBuffer_comms( uint8_t *buffer, uint32_t size) {
+  rx_descr.buffer = buffer;
+  rx_descr.buffer_size = size;
+}
+
+
+/* start a new GDB session */
+void
+resetSession_comms( void) {
+  rx_descr.reset_pending = 1;
+}
+
+
+/* start (or stop) recording the packets */
+void
+setTrace_comms( const struct trace_sink_debug *sink) {
+  trace_descr.sink = sink;
+
+  if ( sink != NULL) {
+    uint8_t header[HEADER_SIZE_TRACE];
+
+    memset( header, 0, sizeof( header));
+    memcpy( header, MAGIC_TRACE, 4);
+    header[4] = VERSION_TRACE;
+    header[8] = sink->tick_ns & 0xff;
+    header[9] = (sink->tick_ns >> 8) & 0xff;
+    header[10] = (sink->tick_ns >> 16) & 0xff;
+    header[11] = sink->tick_ns >> 24;
+
+    trace_descr.break_pending = 0;
+    trace_descr.last_time = sink->time_fn( sink->context);
+    sink->write_fn( sink->context, header, sizeof( header));
+  }
+}
+
+
+/* note the time GDB interrupted the application */
+void
+traceBreak_comms( void) {
+  const struct trace_sink_debug *sink = trace_descr.sink;
+
+  if ( sink != NULL && !trace_descr.break_pending) {
+    trace_descr.break_time = sink->time_fn( sink->context);
+    trace_descr.break_pending = 1;
+  }
+}
+
+
+/* stop (or restart) the acknowledgement of packets */
+void
+setNoAckMode_comms( int no_ack) {
+  rx_descr.no_ack_mode = no_ack;
+}
@@ -3,5 +3,96 @@
 /*
  * $Id: debug_comms.h,v 1.1.1.1 2006/09/06 10:13:19 ben Exp $
  */
+/** \file
+ * \brief The GDB packet layer built on top of the comms function interface.
+ */
+
+/** The size of the default packet buffers */
+#define BUFMAX 2048
+
+
+/** The ways the data of a reply segment is put in a packet.
+ */
+enum segment_encoding {
+  /** The data is packet text */
+  RAW_SEGMENT,
+
+  /** The data is memory sent as hex chars */
+  HEX_SEGMENT,
+
+  /** The data is memory sent as escaped binary */
+  BIN_SEGMENT
+};
+
+
+/** \brief A piece of a reply packet.
+ */
+struct segment_comms {
+  /** How the data is encoded */
+  enum segment_encoding encoding;
+
+  /** The data */
+  const uint8_t *data;
+
+  /** The number of bytes of data */
+  uint32_t length;
+};
+
+
+/** Set the buffer packets are received into. */
+void
+setBuffer_comms( uint8_t *buffer, uint32_t size);
+
+
+/** Receive the next good packet from GDB, acknowledging it.
+ * Returns a pointer to the packet data and its length. The data is
+ * also NUL terminated but may contain NULs of its own.
+ */
+uint8_t *
+getPacket_comms( struct comms_fn_iface_debug *comms_if, uint32_t *length);
+
+
+/** Send the length bytes packet in buffer, waiting for GDB to acknowledge it.
+ */
+void
+putPacket_comms( struct comms_fn_iface_debug *comms_if, const uint8_t *buffer, uint32_t length);
+
+
+/** Send a packet made up of count segments, waiting for GDB to acknowledge it.
+ * The segment data is read again if the packet has to be resent.
+ */
+void
+putSegments_comms( struct comms_fn_iface_debug *comms_if,
+		   const struct segment_comms *segments, int count);
+
+
+/** Turn off (or back on) the '+'/'-' acknowledgement of packets in both
+ * directions, as negotiated with GDB by QStartNoAckMode.
+ */
+void
+setNoAckMode_comms( int no_ack);
+
+
+
+/** Discard any partly received packet and go back to acknowledging packets,
+ * ready for a new GDB session. Can be called from an interrupt, the reset
+ * happens when the next packet is looked for.
+ */
+void
+resetSession_comms( void);
+
+
+/** Start recording the packets exchanged with GDB to sink, or stop if it
+ * is NULL. The trace header is written straight away.
+ */
+void
+setTrace_comms( const struct trace_sink_debug *sink);
+
+
+/** Note that GDB has interrupted the running application, it is recorded
+ * ahead of the packets that follow. Called from the comms interrupt.
+ */
+void
+traceBreak_comms( void);
 
 #endif /* End of _DEBUG_COMMS_H_ */
@@ -0,0 +1,91 @@
+#ifndef _DEBUG_PLATFORM_H_
+#define _DEBUG_PLATFORM_H_ 1
+/** \file
+ * \brief The interface between the protocol engine and the platform it runs on.
+ *
+ * The engine (debug_stub.c with debug_comms.c, the breakpoint lists and the
+ * opcode decoders) only knows the stopped application through these
+ * functions. ds_platform.c implements them for the DS exception and
+ * interrupt handlers, linux_stub/ for a simulated register file and memory.
+ *
+ * Target addresses are used as pointers, so a platform must make the
+ * application's memory appear at its target addresses.
+ */
+
+struct mem_region;
+
+/*
+ * The UNIX signal numbers that GDB expects
+ */
+/** Signal number for an interrupt from GDB */
+#define SIGINT_DEBUG 2
+/** Signal number for an illegal instruction */
+#define SIGILL_DEBUG 4
+/** Signal number for a trap instruction */
+#define SIGTRAP_DEBUG 5
+
+
+/*
+ * Provided by the platform
+ */
+/** Set up the platform once the comms interface is initialised, so the
+ * application's stops reach stopped_debug. */
+void
+init_platform( struct comms_fn_iface_debug *comms_if);
+
+/** Return the stopped application's registers r0 to r14, they may be changed. */
+uint32_t *
+registers_platform( void);
+
+/** Return the stopped application's CPSR. */
+uint32_t
+status_platform( void);
+
+/** Return the table of the memory GDB may access, sorted by address, and
+ * set *count to its length (see mem_region.h). */
+const struct mem_region *
+regions_platform( uint32_t *count);
+
+/** Copy length bytes from src to dest a width (1, 2 or 4) bytes at a time,
+ * stopping at the first access that faults instead of taking the fault.
+ * Both pointers and length are multiples of width. Returns the number of
+ * bytes copied. */
+uint32_t
+copyMemory_platform( void *dest, const void *src, uint32_t length, uint32_t width);
+
+/** Start copying length bytes from src to dest in the background if the
+ * platform can, returning 0 if it cannot (the caller then copies). src is
+ * left alone, and no memory is looked at, until finishCopy_platform. */
+int
+startCopy_platform( void *dest, const void *src, uint32_t length);
+
+/** Wait for the copy startCopy_platform began, if there is one. */
+void
+finishCopy_platform( void);
+
+/** Make the instructions written to memory visible to the application. */
+void
+syncCaches_platform( void);
+
+/** Stop the running application with signal as soon as possible. Called
+ * from whatever context the comms interface receives in, never while the
+ * stub is running. */
+void
+requestBreak_platform( uint32_t signal);
+
+
+/*
+ * Provided by the engine
+ */
+/** The application has stopped at ret_addr with signal. GDB is told (if it
+ * is attached) and the stub runs until GDB lets the application go.
+ * Returns the address the application continues from.
+ */
+uint32_t
+stopped_debug( uint32_t ret_addr, uint32_t signal);
+
+/** Return non-zero while the stub is running. */
+int
+inStub_debug( void);
+
+#endif /* End of _DEBUG_PLATFORM_H_ */
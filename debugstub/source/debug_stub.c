@@ -1,16 +1,24 @@
-#include <nds.h>
-
-#include <nds/arm9/exceptions.h>
-
+/** \file
+ * \brief The GDB protocol engine.
+ *
+ * Nothing here touches the hardware, the stopped application is reached
+ * through debug_platform.h.
+ */
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "debug_stub.h"
 #include "debug_comms.h"
+#include "debug_platform.h"
 
 #include "breakpoints.h"
 #include "opcode_decode.h"
-#include "debug_utilities.h"
+#include "hex_codec.h"
+#include "mem_region.h"
+#include "crc32.h"
+#include "dirty_block.h"
+#include "core_dump.h"
 #include "logging.h"
 
 /** The maximum number of concurrent breakpoints the stub can maintain.
@@ -20,19 +28,15 @@
 
 
 
-/*
- * The UNIX signal numbers that GDB expects
- */
-/** Signal number for an illegal instruction */
-#define SIGILL 4
-/** Signal number for a trap instruction */
-#define SIGTRAP 5
-
+/** The smallest packet buffer the stub can work with, big enough for the
+ * 'g' reply and the stop packet. It is also the size of the reply buffer. */
+#define MIN_BUFSIZE 512
 
-#define BUFMAX 2048
+/** The smallest write worth handing to startCopy_platform */
+#define BULK_WRITE_SIZE 512
 
-static uint8_t remcomInBuffer[BUFMAX];
-static uint8_t remcomOutBuffer[BUFMAX];
+/** The packet buffers used when the application does not supply any */
+static uint8_t default_packet_mem[2 * BUFMAX];
 
 
 
@@ -42,9 +46,6 @@ struct debug_descr {
   /** The interface to the debugger communications. */
   struct comms_fn_iface_debug *comms_if;
 
-  /** The enabled DS interrupts */
-  uint32_t enabled_irqs;
-
   /** the return address */
   uint32_t ret_addr;
 
@@ -63,17 +64,21 @@ struct debug_descr {
   /** flag set whilst inside debug stub */
   int in_stub;
 
-  /** the address of the debug stub's irq handler */
-  uint32_t debug_irq_handler;
+  /** The buffer replies are built in */
+  uint8_t *out_buffer;
+
+  /** The size of the reply buffer */
+  uint32_t out_size;
 
-  /** the address of the application's irq handler */
-  uint32_t app_irq_handler;
+  /** The largest packet GDB may send */
+  uint32_t packet_size;
 
-  /** flag indicating if the app IRQ handler has been saved */
-  int saved_irq_handler;
+  /** the signal the application last stopped with */
+  uint32_t stop_signal;
 
-  /** The saved value of the master interrupt enable register */
-  uint16_t master_irq;
+  /** flag set once GDB has been told the application stopped, the stops
+   * after that are reported with a T packet */
+  int attached;
 };
 
 
@@ -85,269 +90,297 @@ struct breakpoint_descr breakpoint_pool[MAX_BREAKPOINTS];
 struct debug_descr debug_stub_descr;
 
 
-/** Call the comms interface transmit function. */
-#define getDebugChar( comms_if, byte_addr) (comms_if)->readByte_fn( byte_addr)
-
-/** Call the comms interface receive function. */
-#define putDebugChar( comms_if, byte) (comms_if)->writeByte_fn( (byte))
-
-/** Poll the comms interface */
-#define poll_comms( comms_if) if ( (comms_if)->poll_fn != NULL) (comms_if)->poll_fn();
-
-/** reads the comms until a byte is available */
-#define read_block_comms( comms_if, byte_addr) while ( !getDebugChar( comms_if, byte_addr)) poll_comms( comms_if);
+/** Ask for the running code to be stopped, unless the stub is running.
+ */
+static void
+requestBreak( uint32_t signal) {
+  if ( !debug_stub_descr.in_stub) {
+    requestBreak_platform( signal);
+  }
+}
 
 
 /**
- * Check a memory address is good before reading/writing it.
- * If the memory is outside the good range then ignore write
- * and give zero for read.
- *
- * FIXME: setting up some better exception vectors in the ITCM would
- * be a better solution for data aborts and trying to avoid it.
+ * End the GDB session. No breakpoints are put back, the transport goes back
+ * to waiting for GDB and the next entry to the stub is treated like the
+ * first.
  */
-inline int
-memAddrCheck( uint8_t *addr) {
-  int ok_flag = 0;
+static void
+detachGDB( struct debug_descr *debug_descr) {
+  LOG("Detaching\n");
+
+  catLists_breakpoint( &debug_descr->free_breakpts, debug_descr->active_breakpts);
+  catLists_breakpoint( &debug_descr->free_breakpts, debug_descr->stepping_breakpts);
+  catLists_breakpoint( &debug_descr->free_breakpts, debug_descr->disabled_breakpts);
+  debug_descr->active_breakpts = NULL;
+  debug_descr->stepping_breakpts = NULL;
+  debug_descr->disabled_breakpts = NULL;
 
-  /* FIXME: what a lovely hardcoded address, works as long as DTCM is above this */
-  if ( (uint32_t)addr >= 0x01000000) {
-    ok_flag = 1;
+  if ( debug_descr->comms_if->disconnect_fn != NULL) {
+    debug_descr->comms_if->disconnect_fn();
   }
+  resetSession_comms();
+  clear_dirty();
 
-  return ok_flag;
+  debug_descr->attached = 0;
 }
 
 
-static const char hexchars[]="0123456789abcdef";
-
-/*
- * Convert ch from a hex digit to an int
+/** Place a string in the reply buffer, returning its length.
  */
-static int
-hex (unsigned char ch) {
-  if (ch >= 'a' && ch <= 'f')
-    return ch-'a'+10;
-  if (ch >= '0' && ch <= '9')
-    return ch-'0';
-  if (ch >= 'A' && ch <= 'F')
-    return ch-'A'+10;
-  return -1;
-}
+static uint32_t
+replyString( uint8_t *reply, const char *str) {
+  uint32_t length = strlen( str);
 
-/*
- * While we find nice hex chars, build an int.
- * Return number of chars processed.
- */
+  memcpy( reply, str, length);
 
-static int
-hexToInt( uint8_t **ptr, uint32_t *intValue)
-{
-  int numChars = 0;
-  int hexValue;
+  return length;
+}
 
-  *intValue = 0;
 
-  while (**ptr) {
-    hexValue = hex(**ptr);
-    if (hexValue < 0)
-      break;
+/**
+ * Write the memory decoded into mem (from alignedBuffer). Large writes to
+ * byte-wide memory are left copying in the background if the platform can,
+ * while the reply goes out and GDB sends the next packet. The packet buffer
+ * is not used again until that packet starts, which waits for the copy.
+ * Returns the number of bytes written.
+ */
+static uint32_t
+writeData( const struct mem_region *region, uint32_t addr, const uint8_t *mem,
+	   uint32_t length) {
+  if ( region->width == 1 && length >= BULK_WRITE_SIZE &&
+       startCopy_platform( (void *)(uintptr_t)addr, mem, length)) {
+    return length;
+  }
 
-    *intValue = (*intValue << 4) | hexValue;
-    numChars ++;
+  return write_region( region, addr, mem, length);
+}
 
-    (*ptr)++;
-  }
 
-  return (numChars);
+/**
+ * Return where in the packet just received memory at addr is placed, so it
+ * has the same word alignment as addr and is copied a word at a time. The
+ * packet is free once the request is parsed, and at most 3 bytes of it are
+ * skipped, fewer than any memory request's header takes.
+ */
+static uint8_t *
+alignedBuffer( uint8_t *packet, uint32_t addr) {
+  return packet + ((addr - (uintptr_t)packet) & 3);
 }
 
 
-/* Convert the memory pointed to by mem into hex, placing result in buf.
- * Return a pointer to the last char put in buf (null), in case of mem fault,
- * return 0.
+/**
+ * Copy the memory for a read reply into buffer (from alignedBuffer). The
+ * read stops at the end of the region holding addr and at the first byte
+ * that faults, so it may come back short: GDB asks again for the rest and
+ * gets an error for the bad byte. Returns the number of bytes read.
  */
-static unsigned char *
-mem2hex (unsigned char *mem, unsigned char *buf, int count)
-{
-  unsigned char ch;
-
-  while (count-- > 0) {
-    ch = 0;
-    if ( memAddrCheck( mem)) {
-      ch = *mem++;
-    }
-    *buf++ = hexchars[ch >> 4];
-    *buf++ = hexchars[ch & 0xf];
+static uint32_t
+readData( struct debug_descr *debug_descr, uint8_t *buffer, uint32_t addr,
+	  uint32_t length) {
+  const struct mem_region *region = find_region( addr, 1, READ_REGION);
+
+  if ( region == NULL) {
+    return 0;
   }
 
-  *buf = 0;
+  if ( length > region->size - (addr - region->start)) {
+    length = region->size - (addr - region->start);
+  }
+  if ( length > debug_descr->packet_size - 3) {
+    length = debug_descr->packet_size - 3;
+  }
 
-  return buf;
+  return read_region( region, buffer, addr, length);
 }
 
-/* convert the hex array pointed to by buf into binary to be placed in mem
- * return a pointer to the character AFTER the last byte written */
 
-static unsigned char *
-hex2mem (unsigned char *buf, unsigned char *mem, int count) {
-  int i;
-  unsigned char ch;
+/**
+ * Work out GDB's CRC of length bytes at addr, a packet buffer full at a
+ * time. Returns 0 if any of the memory cannot be read.
+ */
+static int
+crcData( struct debug_descr *debug_descr, uint8_t *packet, uint32_t addr,
+	 uint32_t length, uint32_t *crc) {
+  const struct mem_region *region = find_region( addr, length, READ_REGION);
+  uint32_t chunk = debug_descr->packet_size - 3;
+
+  if ( region == NULL) {
+    return 0;
+  }
 
-  for (i=0; i<count; i++) {
-    ch = hex(*buf++) << 4;
-    ch |= hex(*buf++);
+  *crc = START_CRC;
+  while ( length > 0) {
+    uint8_t *buffer = alignedBuffer( packet, addr);
+    uint32_t count = length < chunk ? length : chunk;
 
-    if ( memAddrCheck( mem)) {
-      *mem++ = ch;
+    if ( read_region( region, buffer, addr, count) != count) {
+      return 0;
     }
+    *crc = update_crc( *crc, buffer, count);
+    addr += count;
+    length -= count;
   }
 
-  return mem;
+  return 1;
 }
 
-/* convert the gdb binary array pointed to by buf into binary to be placed in mem
- * return a pointer to the character AFTER the last byte written */
-static unsigned char *
-bin2mem( uint8_t *buf, uint8_t *mem, int count) {
-  int i;
-  uint8_t cur_byte;
-  int escaped = 0;
 
-  for ( i = 0; i < count;) {
-    cur_byte = *buf++;
+/**
+ * Return the offset of the first copy of pattern in the count bytes at mem,
+ * count if there is none. Aligned words with no byte matching the pattern's
+ * first are skipped a word at a time.
+ */
+static uint32_t
+findPattern( const uint8_t *mem, uint32_t count, const uint8_t *pattern,
+	     uint32_t pattern_length) {
+  uint32_t first = pattern[0] * 0x01010101u;
+  uint32_t last;
+  uint32_t i = 0;
+
+  if ( pattern_length > count) {
+    return count;
+  }
+  last = count - pattern_length;
 
-    if ( escaped) {
-      cur_byte ^= 0x20;
-      escaped = 0;
-    }
-    else if ( cur_byte == 0x7d) {
-      escaped = 1;
-    }
+  while ( i <= last) {
+    if ( ((uintptr_t)&mem[i] & 3) == 0 && last - i >= 3) {
+      /* a byte of the word equals the first byte if the XOR has a zero one */
+      uint32_t word = *(const uint32_t *)&mem[i] ^ first;
 
-    if ( !escaped) {
-      i += 1;
-      if ( memAddrCheck( mem)) {
-	*mem++ = cur_byte;
+      if ( ((word - 0x01010101u) & ~word & 0x80808080u) == 0) {
+	i += 4;
+	continue;
       }
     }
+    if ( mem[i] == pattern[0] && memcmp( &mem[i], pattern, pattern_length) == 0) {
+      return i;
+    }
+    i += 1;
   }
 
-  return mem;
+  return count;
 }
 
-/* scan for the sequence $<data>#<checksum>     */
-static unsigned char *
-getpacket ( struct comms_fn_iface_debug *comms_if) {
-  unsigned char *buffer = &remcomInBuffer[0];
-  unsigned char checksum;
-  unsigned char xmitcsum;
-  int count;
-  uint8_t ch;
-
-  while (1) {
-    ch = '\0';
-    /* wait around for the start character, ignore all other characters */
-    while ( ch != '$') {
-      read_block_comms( comms_if, &ch);
+
+/**
+ * Search length bytes at addr for pattern, a packet buffer of memory at a
+ * time, the end of each looked at again with the next in case the pattern
+ * straddles them. Returns 1 and sets *found if it is there, 0 if it is not
+ * and -1 if the memory cannot be read.
+ */
+static int
+searchData( struct debug_descr *debug_descr, uint8_t *packet, uint32_t addr,
+	    uint32_t length, const uint8_t *pattern, uint32_t pattern_length,
+	    uint32_t *found) {
+  const struct mem_region *region = find_region( addr, length, READ_REGION);
+  uint32_t chunk = debug_descr->packet_size - 3;
+
+  if ( region == NULL) {
+    return -1;
+  }
+
+  while ( length >= pattern_length) {
+    uint8_t *buffer = alignedBuffer( packet, addr);
+    uint32_t count = length < chunk ? length : chunk;
+    uint32_t offset;
+
+    if ( read_region( region, buffer, addr, count) != count) {
+      return -1;
+    }
+    offset = findPattern( buffer, count, pattern, pattern_length);
+    if ( offset < count) {
+      *found = addr + offset;
+      return 1;
     }
 
-  retry:
-    checksum = 0;
-    xmitcsum = -1;
-    count = 0;
-
-    /* now, read until a # or end of buffer is found */
-    while (count < BUFMAX - 1) {
-      read_block_comms( comms_if, &ch);
-      if (ch == '$')
-	goto retry;
-      if (ch == '#')
-	break;
-      checksum = checksum + ch;
-      buffer[count] = ch;
-      count = count + 1;
+    if ( count == length) {
+      break;
     }
-    buffer[count] = 0;
+    addr += count - (pattern_length - 1);
+    length -= count - (pattern_length - 1);
+  }
 
-    if (ch == '#') {
-      read_block_comms( comms_if, &ch);
-      xmitcsum = hex (ch) << 4;
-      read_block_comms( comms_if, &ch);
-      xmitcsum += hex (ch);
+  return 0;
+}
 
-      if (checksum != xmitcsum) {
-	putDebugChar( comms_if, '-');	/* failed checksum */
-      }
-      else {
-	putDebugChar( comms_if, '+');	/* successful transfer */
 
-	/* if a sequence char is present, reply the sequence ID */
-	if (buffer[2] == ':') {
-	  putDebugChar( comms_if, buffer[0]);
-	  putDebugChar( comms_if, buffer[1]);
+/**
+ * Fill length bytes at addr with value, from a packet buffer full of it.
+ * Returns 0 if any of the memory cannot be written.
+ */
+static int
+fillData( struct debug_descr *debug_descr, uint8_t *packet, uint32_t addr,
+	  uint32_t length, uint8_t value) {
+  const struct mem_region *region = find_region( addr, length, WRITE_REGION);
+  uint8_t *buffer = alignedBuffer( packet, addr);
+  /* whole words, so each chunk lines up with the buffer as the first did */
+  uint32_t chunk = (debug_descr->packet_size - 3) & ~3;
+
+  if ( region == NULL) {
+    return 0;
+  }
 
-	  return &buffer[3];
-	}
+  memset( buffer, value, length < chunk ? length : chunk);
+  while ( length > 0) {
+    uint32_t count = length < chunk ? length : chunk;
 
-	return &buffer[0];
-      }
+    if ( write_region( region, addr, buffer, count) != count) {
+      return 0;
     }
+    addr += count;
+    length -= count;
   }
+
+  return 1;
 }
 
 
-/*
- * send the packet in buffer.
- * Requires room for an additional three trailing bytes and one prefixed byte in the buffer.
+/**
+ * Carry out a monitor command, placing the reply in reply and returning its
+ * length (0, not supported, for a command that is not known).
+ *   fill ADDR LENGTH [VALUE]  set LENGTH bytes at ADDR to VALUE (0)
+ * A missing ADDR or LENGTH, a LENGTH of 0 or a VALUE over 0xff is E01.
  */
-static void
-putpacket ( struct comms_fn_iface_debug *comms_if, unsigned char *buffer) {
-  unsigned char checksum;
-  int count;
-  unsigned char ch;
-  uint8_t read_ch;
-
-  /*  $<packet info>#<checksum>. */
-
-  /* checksum the buffer */
-  *(buffer-1) = '$';
-  count = 0;
-  checksum = 0;
-  while ( (ch = buffer[count])) {
-    checksum += ch;
-    count += 1;
-  }
-  buffer[count++] = '#';
-  buffer[count++] = hexchars[checksum >> 4];
-  buffer[count++] = hexchars[checksum & 0xf];
-
-  do {
-    comms_if->writeData_fn( buffer-1, count+1);
-
-    read_block_comms( comms_if, &read_ch);
-  } while ( read_ch != '+');
-
-#if 0
-  do {
-    putDebugChar( comms_if, '$');
-    checksum = 0;
-    count = 0;
-
-    while ( (ch = buffer[count])) {
-      putDebugChar( comms_if, ch);
-      checksum += ch;
-      count += 1;
+static uint32_t
+monitorCommand( struct debug_descr *debug_descr, uint8_t *packet,
+		char *command, uint8_t *reply) {
+  if ( strncmp( command, "fill ", 5) == 0) {
+    char *start = command + 5;
+    char *next;
+    uint32_t addr;
+    uint32_t length;
+    uint32_t value = 0;
+
+    /* ADDR and LENGTH must both be there, VALUE must fit a byte */
+    addr = strtoul( start, &next, 0);
+    if ( next == start) {
+      return replyString( reply, "E01");
+    }
+    start = next;
+    length = strtoul( start, &next, 0);
+    if ( next == start || length == 0) {
+      return replyString( reply, "E01");
+    }
+    if ( *next != '\0') {
+      start = next;
+      value = strtoul( start, &next, 0);
+      if ( next == start || value > 0xff) {
+	return replyString( reply, "E01");
+      }
+    }
+    if ( *next != '\0') {
+      return replyString( reply, "E01");
+    }
+    /* the command is in the packet, which is used to fill from */
+    if ( !fillData( debug_descr, packet, addr, length, value)) {
+      return replyString( reply, "E03");
     }
 
-    putDebugChar( comms_if, '#');
-    putDebugChar( comms_if, hexchars[checksum >> 4]);
-    putDebugChar( comms_if, hexchars[checksum & 0xf]);
-
-    read_block_comms( comms_if, &read_ch);
+    return replyString( reply, "OK");
   }
-  while ( read_ch != '+');
-#endif
+
+  return 0;
 }
 
 
@@ -360,9 +393,13 @@ debug_stub( struct debug_descr *debug_descr) {
   //uint32_t reg_mem_ptr = (uint32_t)reg_mem;
 //---------------------------------------------------------------------------------
 
-  uint32_t thumb_state = getSPSR_debug() & 0x20;
+  uint32_t *registers = registers_platform();
+  uint32_t thumb_state = status_platform() & 0x20;
 
+  uint8_t *packet;
   uint8_t *ptr;
+  uint8_t *end;
+  uint8_t *reply = debug_descr->out_buffer;
 
   //LOG("CPSR 0x%08x\n", currentMode);
 
@@ -381,8 +418,6 @@ debug_stub( struct debug_descr *debug_descr) {
    */
   removeAll_breakpoint( debug_descr->stepping_breakpts);
   removeAll_breakpoint( debug_descr->active_breakpts);
-  //IC_InvalidateAll_debug();
-  //DC_FlushAll_debug();
 
   /*
    * put the disabled breakpoints back on the active list.
@@ -404,13 +439,24 @@ debug_stub( struct debug_descr *debug_descr) {
     }
   }
 
+  /* the memory is as the application left it, see what the host's mirror
+   * is missing */
+  update_dirty();
+
 
   while ( !return_now) {
     int send_reply = 1;
-    remcomOutBuffer[1] = 0;
+    int start_no_ack = 0;
+    int detach = 0;
+    uint32_t reply_len = 0;
+    struct segment_comms segments[2];
+    int segment_count = 0;
+    uint32_t length;
 
     LOG("Getting debug packet\n");
-    ptr = getpacket( debug_descr->comms_if);
+    packet = getPacket_comms( debug_descr->comms_if, &length);
+    ptr = packet;
+    end = ptr + length;
 
     LOG("CMD:");
     LOG( (char *)ptr);
@@ -418,10 +464,10 @@ debug_stub( struct debug_descr *debug_descr) {
 
     switch (*ptr++) {
     case '?':
-      remcomOutBuffer[1] = 'S';
-      remcomOutBuffer[2] = hexchars[0x10 >> 4];
-      remcomOutBuffer[3] = hexchars[0x10l & 0xf];
-      remcomOutBuffer[4] = 0;
+      reply[0] = 'S';
+      reply[1] = hexchars[debug_descr->stop_signal >> 4];
+      reply[2] = hexchars[debug_descr->stop_signal & 0xf];
+      reply_len = 3;
       break;
 
     case 'g':		/* return the value of the CPU registers */
@@ -429,17 +475,15 @@ debug_stub( struct debug_descr *debug_descr) {
 	int i;
 	uint32_t cpsr_val;
 	uint32_t pc_value;
-	ptr = &remcomOutBuffer[1];
+	ptr = reply;
 
 	/* general purpose regs 0 to 15 */
 	for ( i = 0; i < 15; i++) {
-	  mem2hex( (uint8_t *)&exceptionRegisters[i], ptr, 4);
-	  ptr += 8;
+	  ptr = encodeHex_codec( ptr, (uint8_t *)&registers[i], 4);
 	}
 	/* set the PC to the return addres value */
 	pc_value = debug_descr->ret_addr;
-	mem2hex( (uint8_t *)&pc_value, ptr, 4);
-	ptr += 8;
+	ptr = encodeHex_codec( ptr, (uint8_t *)&pc_value, 4);
 
 	/* floating point registers (8 x 96bit) */
 	for ( i = 0; i < 8; i++) {
@@ -464,10 +508,9 @@ debug_stub( struct debug_descr *debug_descr) {
 	}
 
 	/* The CPSR */
-	cpsr_val = getSPSR_debug();
-	mem2hex( (uint8_t *)&cpsr_val, ptr, 4);
-	ptr += 8;
-	*ptr = 0;
+	cpsr_val = status_platform();
+	ptr = encodeHex_codec( ptr, (uint8_t *)&cpsr_val, 4);
+	reply_len = ptr - reply;
       }
       break;
 
@@ -475,17 +518,21 @@ debug_stub( struct debug_descr *debug_descr) {
       {
 	LOG("G command\n");
 	int i;
-	uint32_t pc_value;
+	uint32_t reg_values[16];
+
+	/* general purpose regs 0 to 15, only used if they are all good */
+	if ( end - ptr < 16 * 8 ||
+	     decodeHex_codec( (uint8_t *)reg_values, ptr, sizeof( reg_values)) == NULL) {
+	  reply_len = replyString( reply, "E01");
+	  break;
+	}
+	ptr += 16 * 8;
 
-	/* general purpose regs 0 to 15 */
 	for ( i = 0; i < 15; i++) {
-	  hex2mem( ptr, (uint8_t *)&exceptionRegisters[i], 4);
-	  ptr += 8;
+	  registers[i] = reg_values[i];
 	}
 	/* set the PC to the return addres value */
-	hex2mem( ptr, (uint8_t *)&pc_value, 4);
-	ptr += 8;
-	debug_descr->ret_addr = pc_value;
+	debug_descr->ret_addr = reg_values[15];
 
 	/* skip the floaing point registers and floating point status register */
 	ptr += 8 * (96 / 8 * 2);
@@ -495,7 +542,7 @@ debug_stub( struct debug_descr *debug_descr) {
 	/* FIXME: do something with the CPSR */
 	ptr += 8;
 
-	strcpy( (char *)&remcomOutBuffer[1], "OK");
+	reply_len = replyString( reply, "OK");
       }
       break;
 
@@ -514,7 +561,7 @@ debug_stub( struct debug_descr *debug_descr) {
       /* if the next to be executed instruction will cause a branch the step
        * address must be set to the resulting destination address.
        */
-      if ( instructionExecuted_opcode( debug_descr->ret_addr, thumb_state, getSPSR_debug())) {
+      if ( instructionExecuted_opcode( debug_descr->ret_addr, thumb_state, status_platform())) {
 	uint32_t branch_addr;
 
 	/* the register set */
@@ -523,7 +570,7 @@ debug_stub( struct debug_descr *debug_descr) {
 
         LOG("Getting exception regs\n");
 	for ( i = 0; i < 15; i++) {
-	  reg_set[i] = exceptionRegisters[i];
+	  reg_set[i] = registers[i];
 	}
         LOG("Calculate addy, thumb state is %d\n", thumb_state);
 	if ( thumb_state)
@@ -533,7 +580,7 @@ debug_stub( struct debug_descr *debug_descr) {
 	  /* the PC is expected to be current address + 8 */
 	  reg_set[15] = debug_descr->ret_addr + 8;
         LOG("GetSPSR thinger\n");
-	reg_set[16] = getSPSR_debug();
+	reg_set[16] = status_platform();
 
         LOG("CauseJump thinger\n");
 
@@ -579,11 +626,10 @@ debug_stub( struct debug_descr *debug_descr) {
 	 * debugger sits on the current instruction until the user does something.
 	 * That is about the best option available.
 	 */
-	ptr = &remcomOutBuffer[1];
-	*ptr++ = 'S';
-	*ptr++ = hexchars[SIGTRAP >> 4];
-	*ptr++ = hexchars[SIGTRAP & 0xf];
-	*ptr = 0;
+	reply[0] = 'S';
+	reply[1] = hexchars[SIGTRAP_DEBUG >> 4];
+	reply[2] = hexchars[SIGTRAP_DEBUG & 0xf];
+	reply_len = 3;
       }
       break;
     }
@@ -594,19 +640,61 @@ debug_stub( struct debug_descr *debug_descr) {
       uint32_t length;
       int error01 = 1;
 
-      if ( hexToInt( &ptr, &addr)) {
+      if ( parseHex_codec( &ptr, end, &addr)) {
 	if (*ptr++ == ',') {
-	  if ( hexToInt(&ptr, &length)) {
+	  if ( parseHex_codec(&ptr, end, &length)) {
+	    uint8_t *buffer = alignedBuffer( packet, addr);
+	    uint32_t count = readData( debug_descr, buffer, addr, length);
+
 	    //LOG("mem read from %08x (%d)\n", addr, length);
-	    if ( !mem2hex( (uint8_t *)addr, &remcomOutBuffer[1], length)) {
-	      strcpy ( (char *)&remcomOutBuffer[1], "E03");
+	    if ( count == 0 && length > 0) {
+	      reply_len = replyString( reply, "E03");
+	    }
+	    else {
+	      segments[0].encoding = HEX_SEGMENT;
+	      segments[0].data = buffer;
+	      segments[0].length = count;
+	      segment_count = 1;
+	    }
+	    error01 = 0;
+	  }
+	}
+      }
+      if ( error01)
+	reply_len = replyString( reply, "E01");
+      break;
+    }
+
+      /* xAA..AA,LLLL  Read LLLL bytes at address AA..AA as binary data */
+    case 'x': {
+      uint32_t addr;
+      uint32_t length;
+      int error01 = 1;
+
+      if ( parseHex_codec( &ptr, end, &addr)) {
+	if (*ptr++ == ',') {
+	  if ( parseHex_codec(&ptr, end, &length)) {
+	    uint8_t *buffer = alignedBuffer( packet, addr);
+	    uint32_t count = readData( debug_descr, buffer, addr, length);
+
+	    if ( count == 0 && length > 0) {
+	      reply_len = replyString( reply, "E03");
+	    }
+	    else {
+	      segments[0].encoding = RAW_SEGMENT;
+	      segments[0].data = (const uint8_t *)"b";
+	      segments[0].length = 1;
+	      segments[1].encoding = BIN_SEGMENT;
+	      segments[1].data = buffer;
+	      segments[1].length = count;
+	      segment_count = 2;
 	    }
 	    error01 = 0;
 	  }
 	}
       }
       if ( error01)
-	strcpy( (char *)&remcomOutBuffer[1],"E01");
+	reply_len = replyString( reply, "E01");
       break;
     }
 
@@ -616,24 +704,36 @@ debug_stub( struct debug_descr *debug_descr) {
       uint32_t addr;
       uint32_t length;
       int error01 = 1;
-      if ( hexToInt(&ptr, &addr)) {
+      if ( parseHex_codec(&ptr, end, &addr)) {
 	if ( *ptr++ == ',') {
-	  if ( hexToInt(&ptr, &length)) {
-	    if ( *ptr++ == ':') {
-	      if ( hex2mem( ptr, (uint8_t *)addr, length)) {
+	  if ( parseHex_codec(&ptr, end, &length)) {
+	    if ( *ptr++ == ':' && (uint32_t)(end - ptr) / 2 >= length) {
+	      const struct mem_region *region = find_region( addr, length, WRITE_REGION);
+	      uint8_t *mem = alignedBuffer( packet, addr);
+
+	      if ( region == NULL) {
+		reply_len = replyString( reply, "E03");
+		error01 = 0;
+	      }
+	      /* decoded in place (mem is never past ptr), then copied so a fault
+	       * stops the copy */
+	      else if ( decodeHex_codec( mem, ptr, length) != NULL) {
 		//LOG("mem write at %08x (%d)\n", addr, length);
-		strcpy( (char *)&remcomOutBuffer[1], "OK");
+		if ( writeData( region, addr, mem, length) == length) {
+		  reply_len = replyString( reply, "OK");
+		}
+		else {
+		  reply_len = replyString( reply, "E03");
+		}
+		error01 = 0;
 	      }
-	      else
-		strcpy( (char *)&remcomOutBuffer[1], "E03");
-	      error01 = 0;
 	    }
 	  }
 	}
       }
 
       if ( error01) {
-	strcpy( (char *)&remcomOutBuffer[1], "E02");
+	reply_len = replyString( reply, "E02");
       }
       break;
     }
@@ -647,28 +747,262 @@ debug_stub( struct debug_descr *debug_descr) {
       uint32_t length;
       
       int error01 = 1;
-      if ( hexToInt(&ptr, &addr)) {
+      if ( parseHex_codec(&ptr, end, &addr)) {
 	if ( *ptr++ == ',') {
-	  if ( hexToInt(&ptr, &length)) {
+	  if ( parseHex_codec(&ptr, end, &length)) {
 	    if ( *ptr++ == ':') {
-	      if ( bin2mem( ptr, (uint8_t *)addr, length)) {
+	      const struct mem_region *region = find_region( addr, length, WRITE_REGION);
+	      uint8_t *mem = alignedBuffer( packet, addr);
+
+	      if ( region == NULL) {
+		reply_len = replyString( reply, "E03");
+		error01 = 0;
+	      }
+	      else if ( unescapeBin_codec( mem, ptr, end, length) != NULL) {
 		//LOG("mem write at %08x (%d)\n", addr, length);
-		strcpy( (char *)&remcomOutBuffer[1], "OK");
+		if ( writeData( region, addr, mem, length) == length) {
+		  reply_len = replyString( reply, "OK");
+		}
+		else {
+		  reply_len = replyString( reply, "E03");
+		}
+		error01 = 0;
 	      }
-	      else
-		strcpy( (char *)&remcomOutBuffer[1], "E03");
-	      error01 = 0;
 	    }
 	  }
 	}
       }
 
       if ( error01) {
-	strcpy( (char *)&remcomOutBuffer[1], "E02");
+	reply_len = replyString( reply, "E02");
       }
       break;
     }
 #endif
+      /* general queries */
+    case 'q':
+      if ( strncmp( (char *)ptr, "Supported", 9) == 0) {
+	reply_len = replyString( reply, "PacketSize=");
+	reply_len += formatHex_codec( &reply[reply_len], debug_descr->packet_size);
+	reply_len += replyString( &reply[reply_len], ";QStartNoAckMode+;binary-upload+;qXfer:memory-map:read+;qXfer:dirty-blocks:read+;qXfer:core:read+");
+      }
+      /* qCRC:AA..AA,LLLL  the CRC of LLLL bytes at AA..AA, for compare-sections */
+      else if ( strncmp( (char *)ptr, "CRC:", 4) == 0) {
+	uint32_t addr;
+	uint32_t length;
+	uint32_t crc;
+
+	ptr += 4;
+	if ( !parseHex_codec( &ptr, end, &addr) || *ptr++ != ',' ||
+	     !parseHex_codec( &ptr, end, &length)) {
+	  reply_len = replyString( reply, "E01");
+	}
+	else if ( !crcData( debug_descr, packet, addr, length, &crc)) {
+	  reply_len = replyString( reply, "E03");
+	}
+	else {
+	  reply[0] = 'C';
+	  reply_len = 1 + formatHex_codec( &reply[1], crc);
+	}
+      }
+      /* qSearch:memory:AA..AA;LLLL;PP..PP  look for the binary pattern PP..PP
+       * in LLLL bytes from AA..AA */
+      else if ( strncmp( (char *)ptr, "Search:memory:", 14) == 0) {
+	uint32_t addr;
+	uint32_t length;
+	uint32_t pattern_length;
+	uint32_t found;
+	uint8_t *scan;
+	int result;
+
+	ptr += 14;
+	if ( !parseHex_codec( &ptr, end, &addr) || *ptr++ != ';' ||
+	     !parseHex_codec( &ptr, end, &length) || *ptr++ != ';') {
+	  reply_len = replyString( reply, "E01");
+	  break;
+	}
+
+	/* every '}' escapes the character after it, the pattern is kept in
+	 * the reply buffer while the memory goes through the packet's */
+	pattern_length = end - ptr;
+	for ( scan = ptr; scan < end; scan++) {
+	  if ( *scan == 0x7d) {
+	    pattern_length -= 1;
+	  }
+	}
+	/* the search goes a packet buffer of memory at a time, so the
+	 * pattern must fit in one */
+	if ( pattern_length == 0 || pattern_length > debug_descr->out_size ||
+	     pattern_length > debug_descr->packet_size - 3 ||
+	     unescapeBin_codec( reply, ptr, end, pattern_length) == NULL) {
+	  reply_len = replyString( reply, "E01");
+	  break;
+	}
+
+	result = searchData( debug_descr, packet, addr, length, reply, pattern_length, &found);
+	if ( result < 0) {
+	  reply_len = replyString( reply, "E03");
+	}
+	else if ( result == 0) {
+	  reply_len = replyString( reply, "0");
+	}
+	else {
+	  reply_len = replyString( reply, "1,");
+	  reply_len += formatHex_codec( &reply[reply_len], found);
+	}
+      }
+      /* qXfer:memory-map:read::OO..OO,LLLL  the region table as GDB's
+       * memory map */
+      else if ( strncmp( (char *)ptr, "Xfer:memory-map:read::", 22) == 0) {
+	uint32_t offset;
+	uint32_t length;
+	uint32_t count;
+	int result;
+
+	ptr += 22;
+	if ( !parseHex_codec( &ptr, end, &offset) || *ptr++ != ',' ||
+	     !parseHex_codec( &ptr, end, &length)) {
+	  reply_len = replyString( reply, "E01");
+	  break;
+	}
+	if ( length > debug_descr->packet_size - 3) {
+	  length = debug_descr->packet_size - 3;
+	}
+
+	result = map_region( offset, packet, length, &count);
+	segments[0].encoding = RAW_SEGMENT;
+	segments[0].data = (const uint8_t *)(result ? "l" : "m");
+	segments[0].length = 1;
+	segments[1].encoding = BIN_SEGMENT;
+	segments[1].data = packet;
+	segments[1].length = count;
+	segment_count = 2;
+      }
+      /* qXfer:dirty-blocks:read:GG..GG:OO..OO,LLLL  the blocks changed after
+       * generation GG..GG, see dirty_block.h */
+      else if ( strncmp( (char *)ptr, "Xfer:dirty-blocks:read:", 23) == 0) {
+	uint32_t since;
+	uint32_t offset;
+	uint32_t length;
+	uint32_t count;
+	int result;
+
+	ptr += 23;
+	if ( !parseHex_codec( &ptr, end, &since) || *ptr++ != ':' ||
+	     !parseHex_codec( &ptr, end, &offset) || *ptr++ != ',' ||
+	     !parseHex_codec( &ptr, end, &length)) {
+	  reply_len = replyString( reply, "E01");
+	  break;
+	}
+	if ( length > debug_descr->packet_size - 3) {
+	  length = debug_descr->packet_size - 3;
+	}
+
+	result = read_dirty( since, offset, packet, length, &count);
+	if ( result < 0) {
+	  reply_len = replyString( reply, "E03");
+	}
+	else {
+	  segments[0].encoding = RAW_SEGMENT;
+	  segments[0].data = (const uint8_t *)(result ? "l" : "m");
+	  segments[0].length = 1;
+	  segments[1].encoding = BIN_SEGMENT;
+	  segments[1].data = packet;
+	  segments[1].length = count;
+	  segment_count = 2;
+	}
+      }
+      /* qXfer:core:read::OO..OO,LLLL  the packed core dump, started again
+       * from offset 0, see core_dump.h */
+      else if ( strncmp( (char *)ptr, "Xfer:core:read::", 16) == 0) {
+	uint32_t offset;
+	uint32_t length;
+	uint32_t count;
+	int result;
+
+	ptr += 16;
+	if ( !parseHex_codec( &ptr, end, &offset) || *ptr++ != ',' ||
+	     !parseHex_codec( &ptr, end, &length)) {
+	  reply_len = replyString( reply, "E01");
+	  break;
+	}
+	if ( length > debug_descr->packet_size - 3) {
+	  length = debug_descr->packet_size - 3;
+	}
+
+	if ( offset == 0) {
+	  start_core( registers, debug_descr->ret_addr, status_platform(),
+		      debug_descr->stop_signal);
+	}
+	result = read_core( offset, packet, length, &count);
+	if ( result < 0) {
+	  reply_len = replyString( reply, "E01");
+	}
+	else {
+	  segments[0].encoding = RAW_SEGMENT;
+	  segments[0].data = (const uint8_t *)(result ? "l" : "m");
+	  segments[0].length = 1;
+	  segments[1].encoding = BIN_SEGMENT;
+	  segments[1].data = packet;
+	  segments[1].length = count;
+	  segment_count = 2;
+	}
+      }
+      /* qRcmd,HH..HH  a monitor command, the text in hex */
+      else if ( strncmp( (char *)ptr, "Rcmd,", 5) == 0) {
+	char *command = (char *)ptr + 5;
+	uint32_t command_length = (end - ptr - 5) / 2;
+
+	/* an odd digit count is a truncated or malformed command */
+	if ( ((end - ptr - 5) & 1) != 0 ||
+	     decodeHex_codec( (uint8_t *)command, (uint8_t *)command, command_length) == NULL) {
+	  reply_len = replyString( reply, "E01");
+	  break;
+	}
+	command[command_length] = '\0';
+	reply_len = monitorCommand( debug_descr, packet, command, reply);
+      }
+      break;
+
+      /* general sets */
+    case 'Q':
+      if ( strcmp( (char *)ptr, "StartNoAckMode") == 0) {
+	/* the OK is still acknowledged, acks stop once it is sent */
+	reply_len = replyString( reply, "OK");
+	start_no_ack = 1;
+      }
+      /* QDirty:add:AA..AA,LLLL  track LLLL bytes at AA..AA for
+       * qXfer:dirty-blocks */
+      else if ( strncmp( (char *)ptr, "Dirty:add:", 10) == 0) {
+	uint32_t addr;
+	uint32_t length;
+	int result;
+
+	ptr += 10;
+	if ( !parseHex_codec( &ptr, end, &addr) || *ptr++ != ',' ||
+	     !parseHex_codec( &ptr, end, &length)) {
+	  reply_len = replyString( reply, "E01");
+	  break;
+	}
+
+	result = add_dirty( addr, length);
+	if ( result < 0) {
+	  reply_len = replyString( reply, "E03");
+	}
+	else if ( result == 0) {
+	  reply_len = replyString( reply, "E02");
+	}
+	else {
+	  reply_len = replyString( reply, "OK");
+	}
+      }
+      /* QDirty:clear  stop tracking all the ranges */
+      else if ( strcmp( (char *)ptr, "Dirty:clear") == 0) {
+	clear_dirty();
+	reply_len = replyString( reply, "OK");
+      }
+      break;
+
     case 'c':    /* cAA..AA    Continue at address AA..AA(optional) */
       /* try to read optional parameter, pc unchanged if no parm */
       /* FIXME: always continuing from where we left off */
@@ -676,9 +1010,16 @@ debug_stub( struct debug_descr *debug_descr) {
       send_reply = 0;
       break;
 
-      /* kill the program */
-    case 'k' :		/* do nothing */
+      /* detach, leaving the program running */
+    case 'D':
+      reply_len = replyString( reply, "OK");
+      detach = 1;
+      break;
+
+      /* kill the program, it cannot be so it is left running like a detach */
+    case 'k':
       send_reply = 0;
+      detach = 1;
       break;
     }			/* switch */
 
@@ -687,7 +1028,21 @@ debug_stub( struct debug_descr *debug_descr) {
       //LOG("REPLY: ");
       //LOG( (char *)remcomOutBuffer);
       //LOG("\n");
-      putpacket( debug_descr->comms_if, &remcomOutBuffer[1]);
+      if ( segment_count > 0) {
+	putSegments_comms( debug_descr->comms_if, segments, segment_count);
+      }
+      else {
+	putPacket_comms( debug_descr->comms_if, reply, reply_len);
+      }
+    }
+
+    if ( start_no_ack) {
+      setNoAckMode_comms( 1);
+    }
+
+    if ( detach) {
+      detachGDB( debug_descr);
+      return_now = 1;
     }
   }
 
@@ -700,211 +1055,109 @@ debug_stub( struct debug_descr *debug_descr) {
   insertAll_breakpoint( debug_descr->stepping_breakpts);
 
   LOG( "Flushing caches\n");
-  IC_InvalidateAll_debug();
-  DC_FlushAll_debug();
+  syncCaches_platform();
 
   LOG( "Stub complete\n");
   debug_descr->in_stub = 0;
 }
 
 
-/** Trying to get back, setting the values for the registers
- */
-static void
-jumpBack( uint32_t ret_addr) {
-  uint32_t reg_mem[16]; /* space for r0-r14 and the PC */
-  int i;
-
-  /* NOTE: this looses stack but as the stack is reset at each exception
-   * it does not matter. */
-
-  /* r0-r12 and pc values are copied in the ldm instruction */
-  for ( i = 0; i < 13; i++) {
-    reg_mem[i] = exceptionRegisters[i];
-  }
-  reg_mem[i] = ret_addr;
-  LOG("ret_addr 0x%08x (%08x,%08x)\n", ret_addr, *(uint32_t *)reg_mem[i], *(uint32_t *)(reg_mem[i] + 4));
-  for ( i = 0; i < 16; i += 2) {
-    LOG( "r%d %08x, r%d %08x, ", i, exceptionRegisters[i], i+1, exceptionRegisters[i+1]);
-  }
-  LOG( "\n");
-
-  /* the banked registers, r13 and r14, are placed directly */
-  uint32_t broken_mode = getSPSR_debug() & 0x1f;
-
-  setBankedR13R14( exceptionRegisters[13], exceptionRegisters[14],
-	      broken_mode);
-
-  /* FIXME: switch processor mode and set the values */
-  asm volatile ( "ldmia %0, {r0-r12,pc}^   \n"
-		 : 
-		 : "r"(reg_mem)
-		 : "memory"
-		 );
-}
-
-
-/** Ask the comms interface what interrupts it need and
- * enable only those, storing the previous value beforehand.
- * Once setup, the interrupts are enabled in the CPSR register.
- */
-static void
-enableCommsIRQs( struct debug_descr *debug_descr) {
-  uint32_t irq_bits = debug_descr->comms_if->get_IRQs();
-
-  if ( irq_bits == 0) {
-    /* none needed so leave interrupts disabled */
-    debug_descr->saved_irq_handler = 0;
-  }
-  else {
-    LOG("app irq handler %08x, debug %08x\n", (uint32_t)IRQ_HANDLER,
-	debug_descr->debug_irq_handler);
-    debug_descr->saved_irq_handler = 1;
-    debug_descr->app_irq_handler = (uint32_t)IRQ_HANDLER;
-    IRQ_HANDLER = (void (*)(void))debug_descr->debug_irq_handler;
-    debug_descr->enabled_irqs = REG_IE;
-    debug_descr->master_irq = REG_IME;
-    REG_IE = irq_bits;
-    REG_IME = 1;
-    enable_IRQs_debug();
-  }
-}
-
-
-/** Restore the DS enabled interrupts to those set on entry.
+/** Tell GDB the application has stopped.
  */
 static void
-restoreIRQstate( struct debug_descr *debug_descr) {
-  if ( debug_descr->saved_irq_handler != 0) {
-    disable_IRQs_debug();
-    REG_IE = debug_descr->enabled_irqs;
-    REG_IME = debug_descr->master_irq;
-    IRQ_HANDLER = (void (*)(void))debug_descr->app_irq_handler;
-  }
-}
-
-
-/** Compute the address of the instruction to jump back
- * to.
- */
-static uint32_t
-computeReturnAddr( uint32_t *reg_set) {
-  uint32_t ret_addr;
-  uint32_t currentMode = getCPSR_debug() & 0x1f;
-  uint32_t thumb_state = getSPSR_debug() & 0x20;
-
-  /*
-   * The processor mode allows the return address to be computed.
-   * FIXME: data or prefetch abort need to be determined.
-   */
-  if ( currentMode == 0x17 ) {
-    //LOG ("data/prefetch abort!\n");
-    ret_addr = reg_set[PC] - 4;
-
-    if ( (uint32_t)debugHalt == ret_addr) {
-      /* jump over the bkpt instruction */
-      LOG("Exception caused by debugHalt call\n");
-      exceptionRegisters[PC] += 4;
-      ret_addr += 4;
-    }
-  } else {
-    //LOG("undefined instruction!\n\n");
-
-    ret_addr = reg_set[PC] - 4;
-
-    if ( thumb_state) {
-      /* the undefined instruction is just +2 on */
-      ret_addr += 2;
-    }
-  }
-
-  return ret_addr;
-}
-
-static void debugHandler() {
+sendStopPacket( struct debug_descr *debug_descr) {
+  uint8_t *reply = debug_descr->out_buffer;
+  uint32_t *registers = registers_platform();
   uint8_t *ptr;
   int i;
   uint32_t spsr_value;
 
-  LOG("Normal handler\n");
-
-  u32 currentMode = getCPSR_debug() & 0x1f;
-
-  exceptionRegisters[15] = *(u32*)0x027FFD98;
-
-  debug_stub_descr.ret_addr = computeReturnAddr( (uint32_t *)exceptionRegisters);
-
   /* send out the T packet */
-  ptr = &remcomOutBuffer[1];
+  ptr = reply;
   *ptr++ = 'T';
-  if ( currentMode == 0x17 ) {
-    *ptr++ = hexchars[SIGTRAP >> 4];
-    *ptr++ = hexchars[SIGTRAP & 0xf];
-  }
-  else {
-    *ptr++ = hexchars[SIGILL >> 4];
-    *ptr++ = hexchars[SIGILL & 0xf];
-  }
+  *ptr++ = hexchars[debug_descr->stop_signal >> 4];
+  *ptr++ = hexchars[debug_descr->stop_signal & 0xf];
 
   for ( i = 0; i < 15; i++) {
     *ptr++ = hexchars[i >> 4];
     *ptr++ = hexchars[i & 0xf];
     *ptr++ = ':';
-    mem2hex( (uint8_t *)&exceptionRegisters[i], ptr, 4);
-    ptr += 8;
+    ptr = encodeHex_codec( ptr, (uint8_t *)&registers[i], 4);
     *ptr++ = ';';
   }
   /* the PC register */
   *ptr++ = hexchars[0xf >> 4];
   *ptr++ = hexchars[0xf & 0xf];
   *ptr++ = ':';
-  mem2hex( (uint8_t *)&debug_stub_descr.ret_addr, ptr, 4);
-  ptr += 8;
+  ptr = encodeHex_codec( ptr, (uint8_t *)&debug_descr->ret_addr, 4);
   *ptr++ = ';';
 
   /* the CPSR register */
-  spsr_value = getSPSR_debug();
+  spsr_value = status_platform();
   *ptr++ = hexchars[0x19 >> 4];
   *ptr++ = hexchars[0x19 & 0xf];
   *ptr++ = ':';
-  mem2hex( (uint8_t *)&spsr_value, ptr, 4);
-  ptr += 8;
+  ptr = encodeHex_codec( ptr, (uint8_t *)&spsr_value, 4);
   *ptr++ = ';';
-  *ptr = 0;
 
-  /* Enable any interrupts needed for debug comms */
-  enableCommsIRQs( &debug_stub_descr);
+  putPacket_comms( debug_descr->comms_if, reply, ptr - reply);
+}
 
-  putpacket( debug_stub_descr.comms_if, &remcomOutBuffer[1]);
 
-  debug_stub( &debug_stub_descr);
+/* the application has stopped, the stub runs until GDB lets it go */
+uint32_t
+stopped_debug( uint32_t ret_addr, uint32_t signal) {
+  debug_stub_descr.ret_addr = ret_addr;
+  debug_stub_descr.stop_signal = signal;
 
-  /* restore the old irq state */
-  restoreIRQstate( &debug_stub_descr);
+  if ( debug_stub_descr.attached) {
+    sendStopPacket( &debug_stub_descr);
+  }
+  else {
+    /* GDB asks why the application stopped when it connects */
+    LOG("First stop\n");
+    debug_stub_descr.attached = 1;
+  }
 
-  jumpBack( debug_stub_descr.ret_addr);
-}
+  debug_stub( &debug_stub_descr);
 
+  return debug_stub_descr.ret_addr;
+}
 
-static void firstRunHandler() {
-  LOG("First time handler\n");
 
-  exceptionRegisters[15] = *(u32*)0x027FFD98;
+/* check if the stub is running */
+int
+inStub_debug( void) {
+  return debug_stub_descr.in_stub;
+}
 
-  debug_stub_descr.ret_addr = computeReturnAddr( (uint32_t *)exceptionRegisters);
 
-  /* install the normal exception handler */
-  setExceptionHandler( debugHandler);
+/** \brief GDB has connected to the comms interface, stop the application.
+ */
+void
+attachRequest_debug( void) {
+  /* a new GDB has to be acked whatever the last one asked for */
+  resetSession_comms();
+  requestBreak( SIGTRAP_DEBUG);
+}
 
-  /* Enable any interrupts needed for debug comms */
-  enableCommsIRQs( &debug_stub_descr);
 
-  debug_stub( &debug_stub_descr);
+/** \brief GDB has sent an interrupt, stop the application.
+ */
+void
+interruptRequest_debug( void) {
+  if ( !debug_stub_descr.in_stub) {
+    traceBreak_comms();
+  }
+  requestBreak( SIGINT_DEBUG);
+}
 
-  /* restore the irq state */
-  restoreIRQstate( &debug_stub_descr);
 
-  jumpBack( debug_stub_descr.ret_addr);
+/** \brief Record the packets exchanged with GDB.
+ */
+void
+setTrace_debug( const struct trace_sink_debug *sink) {
+  setTrace_comms( sink);
 }
 
 
@@ -912,16 +1165,42 @@ static void firstRunHandler() {
  */
 int
 init_debug( struct comms_fn_iface_debug *comms_if, void *comms_data) {
+  return init_debug_buffers( comms_if, comms_data,
+			     default_packet_mem, sizeof( default_packet_mem));
+}
+
+
+/** \brief Initialise the debugger stub with application supplied packet buffers.
+ */
+int
+init_debug_buffers( struct comms_fn_iface_debug *comms_if, void *comms_data,
+		    uint8_t *packet_mem, uint32_t packet_mem_size) {
   int success_flag;
   int i;
+  uint32_t in_size;
 
   LOG("Entering debug init\n");
 
+  if ( packet_mem_size < 2 * MIN_BUFSIZE) {
+    LOG("Packet buffers too small\n");
+    return 0;
+  }
+
   debug_stub_descr.comms_if = comms_if;
 
-  /* install the exception handler */
-  LOG("Setting exception handler\n");
-  setExceptionHandler( firstRunHandler);
+  /* memory replies are copied into the packet they answer and streamed
+   * from there, so the reply buffer only needs to hold the fixed size ones,
+   * the rest of the memory receives packets */
+  in_size = packet_mem_size - MIN_BUFSIZE;
+  setBuffer_comms( packet_mem, in_size);
+  debug_stub_descr.out_buffer = packet_mem + in_size;
+  debug_stub_descr.out_size = MIN_BUFSIZE;
+
+  /* GDB may send as much as the receive buffer holds (less the NUL
+   * terminator) */
+  debug_stub_descr.packet_size = in_size - 1;
+
+  init_crc();
 
   LOG("Initializing breakpoint pool\n");
   /* initialise the breakpoint descrs */
@@ -937,13 +1216,14 @@ init_debug( struct comms_fn_iface_debug *comms_if, void *comms_data) {
   debug_stub_descr.disabled_breakpts = NULL;
 
   debug_stub_descr.in_stub = 0;
+  debug_stub_descr.attached = 0;
 
   /* initialise the communications link */
   LOG("Calling comms init\n");
   success_flag = debug_stub_descr.comms_if->init_fn( comms_data);
 
-  /* save our interrupt handler pointer */
-  debug_stub_descr.debug_irq_handler = (uint32_t)IRQ_HANDLER;
+  /* the application's stops now come to the stub */
+  init_platform( comms_if);
 
   return success_flag;
 }
@@ -35,4 +35,26 @@ getCPSR_debug( void);
 void
 setBankedR13R14( uint32_t r13, uint32_t r14, uint32_t banked_mode);
 
+/** The IRQ handler installed in front of the application's (debug_asm_fns.s) */
+void
+irqEntry_debug( void);
+
+/** The bkpt an interrupted piece of ARM code is sent to (debug_asm_fns.s) */
+void
+breakInArm_debug( void);
+
+/** The bkpt an interrupted piece of Thumb code is sent to (debug_asm_fns.s) */
+void
+breakInThumb_debug( void);
+
+/** The BIOS exception vector while memory is copied, sends the copy on to
+ * the resume address in copy_guard_debug (debug_asm_fns.s) */
+void
+abortGuard_debug( void);
+
+/** Copy memory a width at a time, stopping at the first access that aborts.
+ * Returns the bytes copied (debug_asm_fns.s) */
+uint32_t
+copyGuarded_debug( void *dest, const void *src, uint32_t length, uint32_t width);
+
 #endif /* End of _DEBUG_UTILITIES_H_ */
@@ -0,0 +1,238 @@
+/** \file
+ * \brief Ranges of memory the host mirrors, sent again only where they
+ * change.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mem_region.h"
+#include "dirty_block.h"
+
+/** The sum is FNV-1a taken a word at a time */
+#define BASIS_DIRTY 2166136261u
+#define PRIME_DIRTY 16777619u
+
+
+/** \brief A range being tracked.
+ */
+struct range_dirty {
+  /** The first address */
+  uint32_t start;
+
+  /** The size in bytes */
+  uint32_t length;
+
+  /** The region holding it */
+  const struct mem_region *region;
+
+  /** The index of its first block */
+  uint32_t first_block;
+};
+
+
+/** \brief What is known of a block.
+ */
+struct block_dirty {
+  /** The sum of the contents when the application last stopped */
+  uint32_t sum;
+
+  /** The generation the contents last changed in */
+  uint32_t generation;
+};
+
+
+static struct range_dirty ranges[MAX_RANGES_DIRTY];
+static uint32_t range_count;
+
+static struct block_dirty blocks[MAX_BLOCKS_DIRTY];
+static uint32_t block_count;
+
+/** The current generation, 0 is before anything was tracked */
+static uint32_t generation;
+
+
+/** Return the sum of length bytes (up to a block) at addr. A block that
+ * faults sums what could be read and how much that was. */
+static uint32_t
+sumBlock( const struct mem_region *region, uint32_t addr, uint32_t length) {
+  uint32_t words[BLOCK_SIZE_DIRTY / 4];
+  uint32_t count;
+  uint32_t sum = BASIS_DIRTY;
+  uint32_t i;
+
+  memset( words, 0, sizeof( words));
+  count = read_region( region, (uint8_t *)words, addr, length);
+
+  for ( i = 0; i < (length + 3) / 4; i++) {
+    sum = (sum ^ words[i]) * PRIME_DIRTY;
+  }
+
+  return (sum ^ count) * PRIME_DIRTY;
+}
+
+
+/** Return the length of block index of a range. */
+static uint32_t
+blockLength( const struct range_dirty *range, uint32_t index) {
+  uint32_t offset = index * BLOCK_SIZE_DIRTY;
+
+  return range->length - offset < BLOCK_SIZE_DIRTY ? range->length - offset : BLOCK_SIZE_DIRTY;
+}
+
+
+/** Work out where the size bytes of the object at pos overlap length bytes
+ * at offset, as offsets into both. Returns the number of bytes shared. */
+static uint32_t
+overlap( uint32_t pos, uint32_t size, uint32_t offset, uint32_t length,
+	 uint32_t *from, uint32_t *to) {
+  uint32_t start = pos > offset ? pos : offset;
+  uint32_t stop = pos + size < offset + length ? pos + size : offset + length;
+
+  if ( start >= stop) {
+    return 0;
+  }
+  *from = start - pos;
+  *to = start - offset;
+
+  return stop - start;
+}
+
+
+/** Place a little endian word in a buffer. */
+static void
+putWord( uint8_t *buffer, uint32_t value) {
+  buffer[0] = value;
+  buffer[1] = value >> 8;
+  buffer[2] = value >> 16;
+  buffer[3] = value >> 24;
+}
+
+
+/* the new blocks take the next generation, so they are changed for every
+ * mirror */
+int
+add_dirty( uint32_t addr, uint32_t length) {
+  const struct mem_region *region = find_region( addr, length, READ_REGION);
+  struct range_dirty *range;
+  uint32_t count = (length + BLOCK_SIZE_DIRTY - 1) / BLOCK_SIZE_DIRTY;
+  uint32_t i;
+
+  if ( region == NULL || length == 0) {
+    return -1;
+  }
+  if ( range_count == MAX_RANGES_DIRTY || count > MAX_BLOCKS_DIRTY - block_count) {
+    return 0;
+  }
+
+  generation += 1;
+  range = &ranges[range_count++];
+  range->start = addr;
+  range->length = length;
+  range->region = region;
+  range->first_block = block_count;
+  block_count += count;
+
+  for ( i = 0; i < count; i++) {
+    struct block_dirty *block = &blocks[range->first_block + i];
+
+    block->sum = sumBlock( region, addr + i * BLOCK_SIZE_DIRTY, blockLength( range, i));
+    block->generation = generation;
+  }
+
+  return 1;
+}
+
+
+/* the generation carries on, a mirror from before is never up to date */
+void
+clear_dirty( void) {
+  range_count = 0;
+  block_count = 0;
+}
+
+
+/* a block whose sum differs changed in this generation */
+void
+update_dirty( void) {
+  uint32_t r;
+
+  if ( range_count == 0) {
+    return;
+  }
+
+  generation += 1;
+  for ( r = 0; r < range_count; r++) {
+    const struct range_dirty *range = &ranges[r];
+    uint32_t count = (range->length + BLOCK_SIZE_DIRTY - 1) / BLOCK_SIZE_DIRTY;
+    uint32_t i;
+
+    for ( i = 0; i < count; i++) {
+      struct block_dirty *block = &blocks[range->first_block + i];
+      uint32_t sum = sumBlock( range->region, range->start + i * BLOCK_SIZE_DIRTY,
+			       blockLength( range, i));
+
+      if ( sum != block->sum) {
+	block->sum = sum;
+	block->generation = generation;
+      }
+    }
+  }
+}
+
+
+/* the object is walked from the start each time, copying out the pieces
+ * that overlap the part asked for */
+int
+read_dirty( uint32_t since, uint32_t offset, uint8_t *buffer, uint32_t length,
+	    uint32_t *count) {
+  uint8_t header[8];
+  uint32_t pos = 0;
+  uint32_t from = 0;
+  uint32_t to = 0;
+  uint32_t size;
+  uint32_t r;
+
+  if ( length > 0xffffffff - offset) {
+    length = 0xffffffff - offset;
+  }
+
+  putWord( header, generation);
+  size = overlap( pos, 4, offset, length, &from, &to);
+  memcpy( &buffer[to], &header[from], size);
+  pos += 4;
+
+  /* a block ending the part asked for only ends the object if no changed
+   * block follows it */
+  for ( r = 0; r < range_count && pos <= offset + length; r++) {
+    const struct range_dirty *range = &ranges[r];
+    uint32_t block_total = (range->length + BLOCK_SIZE_DIRTY - 1) / BLOCK_SIZE_DIRTY;
+    uint32_t i;
+
+    for ( i = 0; i < block_total && pos <= offset + length; i++) {
+      uint32_t addr = range->start + i * BLOCK_SIZE_DIRTY;
+      uint32_t block_length = blockLength( range, i);
+
+      if ( blocks[range->first_block + i].generation <= since) {
+	continue;
+      }
+
+      putWord( header, addr);
+      putWord( &header[4], block_length);
+      size = overlap( pos, 8, offset, length, &from, &to);
+      memcpy( &buffer[to], &header[from], size);
+      pos += 8;
+
+      size = overlap( pos, block_length, offset, length, &from, &to);
+      if ( size > 0 &&
+	   read_region( range->region, &buffer[to], addr + from, size) != size) {
+	return -1;
+      }
+      pos += block_length;
+    }
+  }
+
+  *count = pos > offset ? (pos < offset + length ? pos : offset + length) - offset : 0;
+
+  return pos <= offset + length;
+}
@@ -0,0 +1,56 @@
+#ifndef _DIRTY_BLOCK_H_
+#define _DIRTY_BLOCK_H_ 1
+/** \file
+ * \brief Ranges of memory the host mirrors, sent again only where they
+ * change.
+ *
+ * A range is split into blocks, each with a sum of its contents and the
+ * generation it last changed in. The generation goes up every time the
+ * application stops, when the sums are worked out again. The host asks for
+ * the blocks changed since the generation its mirror is at with
+ * qXfer:dirty-blocks:read:GG..GG:, the object being
+ *
+ *   the current generation, 4 bytes
+ *   for each block changed: its address, 4 bytes, its length, 4 bytes, and
+ *   that many bytes of memory
+ *
+ * the numbers little endian. Generation 0 asks for every block.
+ */
+
+/** The size of a block, the last in a range may be shorter */
+#define BLOCK_SIZE_DIRTY 256
+
+/** The number of blocks that can be tracked, over all the ranges */
+#define MAX_BLOCKS_DIRTY 1024
+
+/** The number of ranges that can be tracked */
+#define MAX_RANGES_DIRTY 8
+
+
+/** Track length bytes at addr, which must lie in one readable region. The
+ * blocks start out changed. Returns 1 if it is tracked, 0 if there is no
+ * room left and -1 if the memory cannot be read. */
+int
+add_dirty( uint32_t addr, uint32_t length);
+
+
+/** Stop tracking every range. */
+void
+clear_dirty( void);
+
+
+/** Work out the sums again as the application stops, moving on to the next
+ * generation. */
+void
+update_dirty( void);
+
+
+/** Copy length bytes of the object from offset into buffer, for the blocks
+ * changed after generation since. *count is set to the bytes copied.
+ * Returns 1 if they end the object, 0 if more follows and -1 if the memory
+ * faults. */
+int
+read_dirty( uint32_t since, uint32_t offset, uint8_t *buffer, uint32_t length,
+	    uint32_t *count);
+
+#endif /* End of _DIRTY_BLOCK_H_ */
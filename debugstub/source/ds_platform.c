@@ -0,0 +1,541 @@
+/** \file
+ * \brief The DS platform layer of the debug stub.
+ *
+ * The application is stopped by the BIOS exception handler (a bkpt or an
+ * undefined instruction) and by irqEntry_debug sending interrupted code to
+ * a bkpt. The registers are those libnds saves in exceptionRegisters.
+ */
+#include <nds.h>
+
+#include <nds/arm9/exceptions.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#include "debug_stub.h"
+#include "debug_platform.h"
+
+#include "opcode_decode.h"
+#include "mem_region.h"
+#include "debug_utilities.h"
+#include "logging.h"
+
+
+/** The DS state of the stub.
+ */
+struct ds_platform {
+  /** The interface to the debugger communications. */
+  struct comms_fn_iface_debug *comms_if;
+
+  /** The enabled DS interrupts */
+  uint32_t enabled_irqs;
+
+  /** the address of the debug stub's irq handler */
+  uint32_t debug_irq_handler;
+
+  /** the address of the application's irq handler */
+  uint32_t app_irq_handler;
+
+  /** flag indicating if the app IRQ handler has been saved */
+  int saved_irq_handler;
+
+  /** The saved value of the master interrupt enable register */
+  uint16_t master_irq;
+
+  /** the address interrupted code was sent to the debugger from */
+  uint32_t break_pc;
+
+  /** the signal interrupted code was sent to the debugger with */
+  uint32_t break_signal;
+};
+
+
+/** \brief The state irqEntry_debug records each time the BIOS calls it.
+ * The layout is known to the assembler.
+ */
+struct irq_entry_debug {
+  /** Where the BIOS saved r0-r3, r12 and the return address + 4 */
+  uint32_t *frame;
+
+  /** The CPSR of the interrupted code */
+  uint32_t spsr;
+
+  /** The signal to stop with once the interrupt returns, 0 if none is wanted */
+  volatile uint32_t break_signal;
+
+  /** The application's interrupt handler */
+  void (*app_handler)( void);
+};
+
+
+/** The instance of the DS state */
+static struct ds_platform ds_platform;
+
+
+/** \brief Where abortGuard_debug sends a copy whose access aborted.
+ * The layout is known to the assembler.
+ */
+struct copy_guard_debug {
+  /** The CPSR control bits the copy runs with */
+  uint32_t mode;
+
+  /** The address the copy carries on from */
+  uint32_t resume;
+};
+
+
+/** The instance of the interrupt entry state */
+struct irq_entry_debug irq_entry_debug;
+
+
+/** The instance of the copy's resume state, set by copyGuarded_debug */
+struct copy_guard_debug copy_guard_debug;
+
+
+/** The DMA channel background copies use, the one libnds's dmaCopy uses */
+#define COPY_DMA_CHANNEL 3
+
+/** The main RAM the DMA copies to and from, the DS's 4MB */
+#define MAIN_RAM_START 0x02000000
+#define MAIN_RAM_END 0x02400000
+
+/** The size of a data cache line */
+#define CACHE_LINE_SIZE 32
+
+
+#ifdef COPY_TIMING
+/** The timer that times the copies. The comms interfaces use Timer 3 and
+ * cpuStartTiming takes the Timer 0 and 1 pair for TICK_TIMING, leaving
+ * Timer 2 on its own. It counts every 64 bus cycles so a copy of up to
+ * 125ms fits in its 16 bits. */
+#define COPY_TIMING_TIMER 2
+
+/** The bus cycles per count, as a shift */
+#define COPY_TIMING_SHIFT 6
+
+/** The copy timings */
+static struct copy_stats_debug copy_stats;
+#endif
+
+
+/** Called by irqEntry_debug when a break in has been asked for */
+void
+redirectIRQ_debug( void);
+
+
+/**
+ * Send the interrupted code into the debugger when the interrupt returns by
+ * changing the return address the BIOS saved to a bkpt in the same
+ * instruction set. Only application code (User or System mode) is stopped,
+ * otherwise the break waits for a later interrupt.
+ */
+void
+redirectIRQ_debug( void) {
+  uint32_t mode = irq_entry_debug.spsr & 0x1f;
+  uint32_t *frame = irq_entry_debug.frame;
+
+  if ( inStub_debug()) {
+    irq_entry_debug.break_signal = 0;
+    return;
+  }
+  if ( mode != 0x10 && mode != 0x1f) {
+    return;
+  }
+
+  /* the saved return address is 4 past the interrupted instruction */
+  ds_platform.break_pc = frame[5] - 4;
+  ds_platform.break_signal = irq_entry_debug.break_signal;
+  if ( irq_entry_debug.spsr & 0x20) {
+    frame[5] = ((uint32_t)breakInThumb_debug & ~1) + 4;
+  }
+  else {
+    frame[5] = (uint32_t)breakInArm_debug + 4;
+  }
+  irq_entry_debug.break_signal = 0;
+}
+
+
+/** Trying to get back, setting the values for the registers
+ */
+static void
+jumpBack( uint32_t ret_addr) {
+  uint32_t reg_mem[16]; /* space for r0-r14 and the PC */
+  int i;
+
+  /* NOTE: this looses stack but as the stack is reset at each exception
+   * it does not matter. */
+
+  /* r0-r12 and pc values are copied in the ldm instruction */
+  for ( i = 0; i < 13; i++) {
+    reg_mem[i] = exceptionRegisters[i];
+  }
+  reg_mem[i] = ret_addr;
+  LOG("ret_addr 0x%08x (%08x,%08x)\n", ret_addr, *(uint32_t *)reg_mem[i], *(uint32_t *)(reg_mem[i] + 4));
+  for ( i = 0; i < 16; i += 2) {
+    LOG( "r%d %08x, r%d %08x, ", i, exceptionRegisters[i], i+1, exceptionRegisters[i+1]);
+  }
+  LOG( "\n");
+
+  /* the banked registers, r13 and r14, are placed directly */
+  uint32_t broken_mode = getSPSR_debug() & 0x1f;
+
+  setBankedR13R14( exceptionRegisters[13], exceptionRegisters[14],
+	      broken_mode);
+
+  /* FIXME: switch processor mode and set the values */
+  asm volatile ( "ldmia %0, {r0-r12,pc}^   \n"
+		 :
+		 : "r"(reg_mem)
+		 : "memory"
+		 );
+}
+
+
+/** Ask the comms interface what interrupts it need and
+ * enable only those, storing the previous value beforehand.
+ * Once setup, the interrupts are enabled in the CPSR register.
+ */
+static void
+enableCommsIRQs( struct ds_platform *platform) {
+  uint32_t irq_bits = platform->comms_if->get_IRQs();
+
+  if ( irq_bits == 0) {
+    /* none needed so leave interrupts disabled */
+    platform->saved_irq_handler = 0;
+  }
+  else {
+    LOG("app irq handler %08x, debug %08x\n", (uint32_t)IRQ_HANDLER,
+	platform->debug_irq_handler);
+    platform->saved_irq_handler = 1;
+    platform->app_irq_handler = (uint32_t)IRQ_HANDLER;
+    IRQ_HANDLER = (void (*)(void))platform->debug_irq_handler;
+    platform->enabled_irqs = REG_IE;
+    platform->master_irq = REG_IME;
+    REG_IE = irq_bits;
+    REG_IME = 1;
+    enable_IRQs_debug();
+  }
+}
+
+
+/** Restore the DS enabled interrupts to those set on entry.
+ */
+static void
+restoreIRQstate( struct ds_platform *platform) {
+  if ( platform->saved_irq_handler != 0) {
+    disable_IRQs_debug();
+    REG_IE = platform->enabled_irqs;
+    REG_IME = platform->master_irq;
+    IRQ_HANDLER = (void (*)(void))platform->app_irq_handler;
+  }
+}
+
+
+/** Compute the address of the instruction to jump back
+ * to, and the signal the application stopped with.
+ */
+static uint32_t
+computeReturnAddr( uint32_t *reg_set, uint32_t *signal) {
+  uint32_t ret_addr;
+  uint32_t currentMode = getCPSR_debug() & 0x1f;
+  uint32_t thumb_state = getSPSR_debug() & 0x20;
+
+  /*
+   * The processor mode allows the return address to be computed.
+   * FIXME: data or prefetch abort need to be determined.
+   */
+  if ( currentMode == 0x17 ) {
+    //LOG ("data/prefetch abort!\n");
+    ret_addr = reg_set[PC] - 4;
+    *signal = SIGTRAP_DEBUG;
+
+    if ( (uint32_t)debugHalt == ret_addr) {
+      /* jump over the bkpt instruction */
+      LOG("Exception caused by debugHalt call\n");
+      exceptionRegisters[PC] += 4;
+      ret_addr += 4;
+    }
+    else if ( ret_addr == (uint32_t)breakInArm_debug ||
+	      ret_addr == ((uint32_t)breakInThumb_debug & ~1)) {
+      /* sent here from an interrupt, go back to where it was interrupted */
+      LOG("Exception caused by a break in\n");
+      ret_addr = ds_platform.break_pc;
+      exceptionRegisters[PC] = ret_addr + 4;
+      *signal = ds_platform.break_signal;
+    }
+  } else {
+    //LOG("undefined instruction!\n\n");
+
+    ret_addr = reg_set[PC] - 4;
+    *signal = SIGILL_DEBUG;
+
+    if ( thumb_state) {
+      /* the undefined instruction is just +2 on */
+      ret_addr += 2;
+    }
+  }
+
+  return ret_addr;
+}
+
+
+static void exceptionHandler() {
+  uint32_t ret_addr;
+  uint32_t signal;
+
+  LOG("Exception handler\n");
+
+  exceptionRegisters[15] = *(u32*)0x027FFD98;
+
+  /* whatever was waiting to break in has got here */
+  irq_entry_debug.break_signal = 0;
+
+  ret_addr = computeReturnAddr( (uint32_t *)exceptionRegisters, &signal);
+
+  /* Enable any interrupts needed for debug comms */
+  enableCommsIRQs( &ds_platform);
+
+  ret_addr = stopped_debug( ret_addr, signal);
+
+  /* restore the old irq state */
+  restoreIRQstate( &ds_platform);
+
+  jumpBack( ret_addr);
+}
+
+
+/* the registers libnds saved */
+uint32_t *
+registers_platform( void) {
+  return (uint32_t *)exceptionRegisters;
+}
+
+
+/* the CPSR of the code that raised the exception */
+uint32_t
+status_platform( void) {
+  return getSPSR_debug();
+}
+
+
+/*
+ * The ARM9's view of the DS memory map, as libnds sets up the protection
+ * unit. Anything not listed (the IPC and cartridge FIFOs among it) is
+ * refused, as a read can pop data the application is waiting for. An
+ * access that aborts anyway just ends the copy (copyMemory_platform).
+ * The mirrors of main RAM, shared WRAM and the ITCM are included as libnds
+ * uses them for uncached access. A core dump takes the memory itself, the
+ * 4MB of main RAM, the TCMs, the palette, OAM and VRAM through the LCDC
+ * window (a bank mapped elsewhere reads as zeros there).
+ *
+ * The DTCM is wherever the application's linker script put it, so it is
+ * added by placeDTCM.
+ */
+static const struct mem_region fixed_regions[] = {
+  { 0x01000000, 0x00008000, READ_REGION | WRITE_REGION | CORE_REGION, 1, "itcm" },
+  { 0x01008000, 0x00ff8000, READ_REGION | WRITE_REGION, 1, "itcm_mirror" },
+  { 0x02000000, 0x00400000, READ_REGION | WRITE_REGION | CORE_REGION, 1, "main" },
+  { 0x02400000, 0x00c00000, READ_REGION | WRITE_REGION, 1, "main_mirror" },
+  { 0x03000000, 0x01000000, READ_REGION | WRITE_REGION, 1, "wram" },
+  { 0x04000000, 0x00001070, READ_REGION | WRITE_REGION, 2, "io" },
+  { 0x05000000, 0x00000800, READ_REGION | WRITE_REGION | CORE_REGION, 2, "palette" },
+  { 0x06000000, 0x00800000, READ_REGION | WRITE_REGION, 2, "vram" },
+  { 0x06800000, 0x000a4000, READ_REGION | WRITE_REGION | CORE_REGION, 2, "vram_lcdc" },
+  { 0x07000000, 0x00000800, READ_REGION | WRITE_REGION | CORE_REGION, 2, "oam" },
+  { 0x08000000, 0x02000000, READ_REGION, 2, "gba_rom" },
+  { 0x0a000000, 0x00010000, READ_REGION | WRITE_REGION, 1, "gba_sram" },
+  { 0xffff0000, 0x00001000, READ_REGION, 1, "bios" }
+};
+
+/** The number of fixed regions */
+#define FIXED_REGION_COUNT (sizeof( fixed_regions) / sizeof( fixed_regions[0]))
+
+/** The fixed regions with the DTCM in its place */
+static struct mem_region ds_regions[FIXED_REGION_COUNT + 1];
+
+/** The number of regions in ds_regions */
+static uint32_t ds_region_count;
+
+
+/*
+ * Build ds_regions, placing the DTCM where the CP15 DTCM region register
+ * says the application has it. A DTCM that overlaps a fixed region is left
+ * out, as the regions are looked up by a binary search.
+ */
+static void
+placeDTCM( void) {
+  struct mem_region dtcm = {
+    0, 0, READ_REGION | WRITE_REGION | CORE_REGION, 1, "dtcm"
+  };
+  uint32_t dtcm_region;
+  uint32_t i;
+  int placed = 0;
+
+  asm volatile ( "mrc p15, 0, %0, c9, c1, 0\n"
+		 : "=r"(dtcm_region)
+		 :
+		 );
+  dtcm.start = dtcm_region & 0xfffff000;
+  dtcm.size = 512 << ((dtcm_region >> 1) & 0x1f);
+
+  /* an overlapping DTCM counts as placed, so it is left out */
+  for ( i = 0; i < FIXED_REGION_COUNT; i++) {
+    if ( fixed_regions[i].start < dtcm.start + dtcm.size &&
+	 dtcm.start < fixed_regions[i].start + fixed_regions[i].size) {
+      placed = 1;
+    }
+  }
+
+  ds_region_count = 0;
+  for ( i = 0; i < FIXED_REGION_COUNT; i++) {
+    if ( !placed && dtcm.start < fixed_regions[i].start) {
+      ds_regions[ds_region_count++] = dtcm;
+      placed = 1;
+    }
+    ds_regions[ds_region_count++] = fixed_regions[i];
+  }
+  if ( !placed) {
+    ds_regions[ds_region_count++] = dtcm;
+  }
+}
+
+
+/* the DS memory map */
+const struct mem_region *
+regions_platform( uint32_t *count) {
+  *count = ds_region_count;
+
+  return ds_regions;
+}
+
+
+/*
+ * Copy with the BIOS exception vector sent to abortGuard_debug, so an abort
+ * ends the copy instead of entering exceptionHandler inside the stub. The
+ * vector is in the uncached mirror of main RAM, which the BIOS reads with
+ * the protection unit off.
+ */
+uint32_t
+copyMemory_platform( void *dest, const void *src, uint32_t length, uint32_t width) {
+  VoidFn handler = EXCEPTION_VECTOR;
+  uint32_t copied;
+
+#ifdef COPY_TIMING
+  TIMER_CR( COPY_TIMING_TIMER) = 0;
+  TIMER_DATA( COPY_TIMING_TIMER) = 0;
+  TIMER_CR( COPY_TIMING_TIMER) = TIMER_ENABLE | TIMER_DIV_64;
+#endif
+
+  EXCEPTION_VECTOR = abortGuard_debug;
+  copied = copyGuarded_debug( dest, src, length, width);
+  EXCEPTION_VECTOR = handler;
+
+#ifdef COPY_TIMING
+  copy_stats.last_cycles = TIMER_DATA( COPY_TIMING_TIMER) << COPY_TIMING_SHIFT;
+  TIMER_CR( COPY_TIMING_TIMER) = 0;
+  copy_stats.last_bytes = copied;
+  copy_stats.cycles += copy_stats.last_cycles;
+  copy_stats.bytes += copied;
+#endif
+
+  return copied;
+}
+
+
+/*
+ * The whole cache lines of a copy within main RAM are handed to DMA, the
+ * CPU copies the ragged ends as they share lines with other data. The DMA
+ * works on memory not the cache, so the source is written back and the
+ * destination lines dropped first. A DMA the application left running on
+ * the channel is not disturbed, the copy is then left to the caller.
+ */
+int
+startCopy_platform( void *dest, const void *src, uint32_t length) {
+  uint32_t to = (uint32_t)dest;
+  uint32_t from = (uint32_t)src;
+  uint32_t head = (CACHE_LINE_SIZE - (to & (CACHE_LINE_SIZE - 1))) & (CACHE_LINE_SIZE - 1);
+  uint32_t middle;
+  uint32_t tail;
+
+  if ( to < MAIN_RAM_START || length > MAIN_RAM_END - to ||
+       from < MAIN_RAM_START || length > MAIN_RAM_END - from ||
+       ((to ^ from) & 3) != 0 || length < head + CACHE_LINE_SIZE ||
+       dmaBusy( COPY_DMA_CHANNEL)) {
+    return 0;
+  }
+  middle = (length - head) & ~(CACHE_LINE_SIZE - 1);
+  tail = length - head - middle;
+
+  copyMemory_platform( dest, src, head, 1);
+  copyMemory_platform( (uint8_t *)dest + head + middle,
+		       (const uint8_t *)src + head + middle, tail, 1);
+
+  DC_FlushRange( (const uint8_t *)src + head, middle);
+  DC_InvalidateRange( (uint8_t *)dest + head, middle);
+  dmaCopyWordsAsynch( COPY_DMA_CHANNEL, (const uint8_t *)src + head,
+		      (uint8_t *)dest + head, middle);
+
+#ifdef COPY_TIMING
+  copy_stats.dma_bytes += middle;
+#endif
+
+  return 1;
+}
+
+
+/* the DMA is quick, the stub only waits if the next packet beats it */
+void
+finishCopy_platform( void) {
+  while ( dmaBusy( COPY_DMA_CHANNEL));
+}
+
+
+/* read and clear the copy timings, all zero unless built with COPY_TIMING */
+void
+getCopyStats_debug( struct copy_stats_debug *stats) {
+#ifdef COPY_TIMING
+  *stats = copy_stats;
+  memset( &copy_stats, 0, sizeof( copy_stats));
+#else
+  memset( stats, 0, sizeof( *stats));
+#endif
+}
+
+
+/* write back the data cache and forget the instruction cache */
+void
+syncCaches_platform( void) {
+  IC_InvalidateAll_debug();
+  DC_FlushAll_debug();
+}
+
+
+/* called from an interrupt handler, the break happens as it returns */
+void
+requestBreak_platform( uint32_t signal) {
+  irq_entry_debug.break_signal = signal;
+  redirectIRQ_debug();
+}
+
+
+/* take over the exception handler and go in front of the interrupt handler */
+void
+init_platform( struct comms_fn_iface_debug *comms_if) {
+  ds_platform.comms_if = comms_if;
+  placeDTCM();
+
+  /* install the exception handler */
+  LOG("Setting exception handler\n");
+  setExceptionHandler( exceptionHandler);
+
+  /* go in front of the application's interrupt handler so an interrupt can
+   * break in to the running code */
+  irq_entry_debug.break_signal = 0;
+  if ( IRQ_HANDLER != irqEntry_debug) {
+    irq_entry_debug.app_handler = IRQ_HANDLER;
+    IRQ_HANDLER = irqEntry_debug;
+  }
+
+  /* save our interrupt handler pointer */
+  ds_platform.debug_irq_handler = (uint32_t)IRQ_HANDLER;
+}
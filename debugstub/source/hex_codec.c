@@ -0,0 +1,246 @@
+/** \file
+ * \brief Conversion between memory and the hex and binary encodings used in
+ * GDB packets.
+ *
+ * Encoding uses a table of the two character hex form of every byte value and
+ * decoding a table of digit values, checking a whole word of digits at once.
+ * None of these functions check the memory they are given, callers are
+ * expected to have checked the range once beforehand.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "hex_codec.h"
+
+
+const char hexchars[] = "0123456789abcdef";
+
+/** The two hex chars for each byte value */
+static const char hex_pairs[256 * 2 + 1] =
+  "000102030405060708090a0b0c0d0e0f"
+  "101112131415161718191a1b1c1d1e1f"
+  "202122232425262728292a2b2c2d2e2f"
+  "303132333435363738393a3b3c3d3e3f"
+  "404142434445464748494a4b4c4d4e4f"
+  "505152535455565758595a5b5c5d5e5f"
+  "606162636465666768696a6b6c6d6e6f"
+  "707172737475767778797a7b7c7d7e7f"
+  "808182838485868788898a8b8c8d8e8f"
+  "909192939495969798999a9b9c9d9e9f"
+  "a0a1a2a3a4a5a6a7a8a9aaabacadaeaf"
+  "b0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+  "c0c1c2c3c4c5c6c7c8c9cacbcccdcecf"
+  "d0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+  "e0e1e2e3e4e5e6e7e8e9eaebecedeeef"
+  "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+/** The value of each hex digit character, -1 if the character is not one */
+static const int8_t hex_values[256] = {
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+  -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+
+/* value of a hex digit, -1 if it is not one */
+int
+hexValue_codec( uint8_t ch) {
+  return hex_values[ch];
+}
+
+
+/* convert count bytes of memory into hex chars */
+uint8_t *
+encodeHex_codec( uint8_t *buf, const uint8_t *mem, uint32_t count) {
+  const char *pair;
+
+  /* four bytes a go whilst there are enough */
+  while ( count >= 4) {
+    pair = &hex_pairs[mem[0] * 2];
+    buf[0] = pair[0];
+    buf[1] = pair[1];
+    pair = &hex_pairs[mem[1] * 2];
+    buf[2] = pair[0];
+    buf[3] = pair[1];
+    pair = &hex_pairs[mem[2] * 2];
+    buf[4] = pair[0];
+    buf[5] = pair[1];
+    pair = &hex_pairs[mem[3] * 2];
+    buf[6] = pair[0];
+    buf[7] = pair[1];
+
+    buf += 8;
+    mem += 4;
+    count -= 4;
+  }
+
+  while ( count > 0) {
+    pair = &hex_pairs[*mem++ * 2];
+    *buf++ = pair[0];
+    *buf++ = pair[1];
+    count -= 1;
+  }
+
+  return buf;
+}
+
+
+/* convert count bytes worth of hex chars into memory */
+const uint8_t *
+decodeHex_codec( uint8_t *mem, const uint8_t *buf, uint32_t count) {
+  int high;
+  int low;
+
+  /* single bytes up to a word boundary */
+  while ( count > 0 && ((uintptr_t)mem & 0x3)) {
+    high = hex_values[buf[0]];
+    low = hex_values[buf[1]];
+    if ( (high | low) < 0) {
+      return NULL;
+    }
+    *mem++ = (high << 4) | low;
+    buf += 2;
+    count -= 1;
+  }
+
+  /* whole words, a bad digit anywhere makes the OR of the values negative.
+   * The word is built little endian, as the DS is. */
+  while ( count >= 4) {
+    int32_t d0 = hex_values[buf[0]];
+    int32_t d1 = hex_values[buf[1]];
+    int32_t d2 = hex_values[buf[2]];
+    int32_t d3 = hex_values[buf[3]];
+    int32_t d4 = hex_values[buf[4]];
+    int32_t d5 = hex_values[buf[5]];
+    int32_t d6 = hex_values[buf[6]];
+    int32_t d7 = hex_values[buf[7]];
+
+    if ( (d0 | d1 | d2 | d3 | d4 | d5 | d6 | d7) < 0) {
+      return NULL;
+    }
+
+    *(uint32_t *)mem = (uint32_t)((d0 << 4) | d1) |
+      (uint32_t)((d2 << 4) | d3) << 8 |
+      (uint32_t)((d4 << 4) | d5) << 16 |
+      (uint32_t)((d6 << 4) | d7) << 24;
+
+    mem += 4;
+    buf += 8;
+    count -= 4;
+  }
+
+  while ( count > 0) {
+    high = hex_values[buf[0]];
+    low = hex_values[buf[1]];
+    if ( (high | low) < 0) {
+      return NULL;
+    }
+    *mem++ = (high << 4) | low;
+    buf += 2;
+    count -= 1;
+  }
+
+  return buf;
+}
+
+
+/* parse a hex number */
+int
+parseHex_codec( uint8_t **ptr, const uint8_t *end, uint32_t *value) {
+  int num_chars = 0;
+  int digit;
+
+  *value = 0;
+
+  while ( *ptr < end) {
+    digit = hex_values[**ptr];
+    if ( digit < 0)
+      break;
+
+    *value = (*value << 4) | digit;
+    num_chars += 1;
+
+    (*ptr)++;
+  }
+
+  return num_chars;
+}
+
+
+/* write a hex number without leading zeros */
+int
+formatHex_codec( uint8_t *buf, uint32_t value) {
+  int num_chars = 0;
+  int shift = 28;
+
+  while ( shift > 0 && (value >> shift) == 0) {
+    shift -= 4;
+  }
+
+  for ( ; shift >= 0; shift -= 4) {
+    buf[num_chars++] = hexchars[(value >> shift) & 0xf];
+  }
+
+  return num_chars;
+}
+
+
+/* convert memory into escaped binary data */
+uint8_t *
+escapeBin_codec( uint8_t *buf, const uint8_t *buf_end, const uint8_t *mem, uint32_t *count) {
+  uint32_t done = 0;
+  uint8_t ch;
+
+  while ( done < *count && buf_end - buf >= 2) {
+    ch = mem[done++];
+
+    if ( ch == '#' || ch == '$' || ch == 0x7d || ch == '*') {
+      *buf++ = 0x7d;
+      ch ^= 0x20;
+    }
+    *buf++ = ch;
+  }
+
+  *count = done;
+
+  return buf;
+}
+
+
+/* convert escaped binary data into memory */
+const uint8_t *
+unescapeBin_codec( uint8_t *mem, const uint8_t *buf, const uint8_t *end, uint32_t count) {
+  uint8_t ch;
+
+  while ( count > 0) {
+    if ( buf >= end) {
+      return NULL;
+    }
+    ch = *buf++;
+
+    if ( ch == 0x7d) {
+      if ( buf >= end) {
+	return NULL;
+      }
+      ch = *buf++ ^ 0x20;
+    }
+
+    *mem++ = ch;
+    count -= 1;
+  }
+
+  return buf;
+}
@@ -0,0 +1,62 @@
+#ifndef _HEX_CODEC_H_
+#define _HEX_CODEC_H_ 1
+/** \file
+ * \brief Conversion between memory and the hex and binary encodings used in
+ * GDB packets.
+ */
+
+/** The hex digit characters */
+extern const char hexchars[];
+
+
+/** Return the value of a hex digit character, -1 if it is not one. */
+int
+hexValue_codec( uint8_t ch);
+
+
+/** Convert count bytes of memory into hex chars placed in buf.
+ * Returns a pointer to the char after the last one written.
+ */
+uint8_t *
+encodeHex_codec( uint8_t *buf, const uint8_t *mem, uint32_t count);
+
+
+/** Convert count bytes worth of hex chars from buf into memory.
+ * Returns a pointer to the char after the last one used, NULL if a
+ * character is not a hex digit.
+ */
+const uint8_t *
+decodeHex_codec( uint8_t *mem, const uint8_t *buf, uint32_t count);
+
+
+/** While there are hex chars before end build an int, advancing *ptr.
+ * Returns the number of chars used.
+ */
+int
+parseHex_codec( uint8_t **ptr, const uint8_t *end, uint32_t *value);
+
+
+/** Write value as hex chars without leading zeros.
+ * Returns the number of chars written.
+ */
+int
+formatHex_codec( uint8_t *buf, uint32_t value);
+
+
+/** Convert memory into gdb binary data, escaping the characters that have
+ * meaning in a packet. Stops when *count bytes are converted or buf_end is
+ * reached, *count is set to the number of bytes converted.
+ * Returns a pointer to the char after the last one written.
+ */
+uint8_t *
+escapeBin_codec( uint8_t *buf, const uint8_t *buf_end, const uint8_t *mem, uint32_t *count);
+
+
+/** Convert count bytes of gdb binary data from buf into memory.
+ * Returns a pointer to the char after the last one used, NULL if the data
+ * ends before count bytes are found.
+ */
+const uint8_t *
+unescapeBin_codec( uint8_t *mem, const uint8_t *buf, const uint8_t *end, uint32_t count);
+
+#endif /* End of _HEX_CODEC_H_ */
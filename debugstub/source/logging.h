@@ -1,7 +1,13 @@
 #ifndef _LOGGING_H_
 #define _LOGGING_H_
 
+#ifdef ARM9
 #include <nds/arm9/console.h>
+#else
+/* off the DS the log goes to stderr, stdout may be carrying the packets */
+#include <stdio.h>
+#define iprintf( fmt, ...) fprintf( stderr, fmt, ##__VA_ARGS__)
+#endif
 
 #ifdef DO_LOGGING
 
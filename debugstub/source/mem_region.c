@@ -0,0 +1,235 @@
+/** \file
+ * \brief The memory map GDB's reads and writes are checked against.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "debug_stub.h"
+#include "debug_platform.h"
+#include "mem_region.h"
+#include "hex_codec.h"
+
+
+/** \brief The part of a generated text being copied out.
+ */
+struct window_region {
+  /** Where the part starts in the text */
+  uint32_t offset;
+
+  /** The length of the part */
+  uint32_t length;
+
+  /** How far into the text it has got */
+  uint32_t pos;
+
+  /** Where the part is copied */
+  uint8_t *buffer;
+};
+
+
+/* binary search of the sorted table */
+const struct mem_region *
+find_region( uint32_t addr, uint32_t length, uint32_t flags) {
+  uint32_t count;
+  const struct mem_region *regions = regions_platform( &count);
+  const struct mem_region *region;
+  uint32_t low = 0;
+  uint32_t high = count;
+
+  /* find the last region starting at or below addr */
+  while ( high - low > 1) {
+    uint32_t mid = (low + high) / 2;
+
+    if ( regions[mid].start <= addr) {
+      low = mid;
+    }
+    else {
+      high = mid;
+    }
+  }
+  if ( count == 0 || regions[low].start > addr) {
+    return NULL;
+  }
+  region = &regions[low];
+
+  if ( length > region->size || addr - region->start > region->size - length ||
+       (region->flags & flags) != flags) {
+    return NULL;
+  }
+
+  return region;
+}
+
+
+/** Read the halfword or word at addr into the low bytes of *value.
+ * Returns 0 if it faults. */
+static int
+loadUnit( uint32_t addr, uint32_t width, uint32_t *value) {
+  *value = 0;
+
+  return copyMemory_platform( value, (const void *)(uintptr_t)addr, width, width) == width;
+}
+
+
+/** Write the halfword or word at addr. Returns 0 if it faults. */
+static int
+storeUnit( uint32_t addr, uint32_t width, uint32_t value) {
+  return copyMemory_platform( (void *)(uintptr_t)addr, &value, width, width) == width;
+}
+
+
+/* copy out a unit at a time, the bytes are picked out little endian. Whole
+ * units go across together when mem is aligned as addr is. */
+uint32_t
+read_region( const struct mem_region *region, uint8_t *mem, uint32_t addr, uint32_t length) {
+  uint32_t width = region->width;
+  uint32_t done = 0;
+
+  if ( width == 1) {
+    return copyMemory_platform( mem, (const void *)(uintptr_t)addr, length, 1);
+  }
+
+  while ( done < length) {
+    uint32_t offset = (addr + done) & (width - 1);
+    uint32_t count = width - offset < length - done ? width - offset : length - done;
+    uint32_t value;
+
+    if ( offset == 0 && count == width && ((uintptr_t)mem & (width - 1)) == 0) {
+      /* the whole units in one go when mem lines up with them */
+      uint32_t whole = (length - done) & ~(width - 1);
+
+      count = copyMemory_platform( mem, (const void *)(uintptr_t)(addr + done), whole, width);
+      mem += count;
+      done += count;
+      if ( count < whole) {
+	break;
+      }
+      continue;
+    }
+
+    if ( !loadUnit( addr + done - offset, width, &value)) {
+      break;
+    }
+    value >>= 8 * offset;
+
+    done += count;
+    while ( count-- > 0) {
+      *mem++ = value;
+      value >>= 8;
+    }
+  }
+
+  return done;
+}
+
+
+/* copy in a unit at a time, partial units are read first. Whole units go
+ * across together when mem is aligned as addr is. */
+uint32_t
+write_region( const struct mem_region *region, uint32_t addr, const uint8_t *mem,
+	      uint32_t length) {
+  uint32_t width = region->width;
+  uint32_t done = 0;
+
+  if ( width == 1) {
+    return copyMemory_platform( (void *)(uintptr_t)addr, mem, length, 1);
+  }
+
+  while ( done < length) {
+    uint32_t offset = (addr + done) & (width - 1);
+    uint32_t count = width - offset < length - done ? width - offset : length - done;
+    uint32_t value = 0;
+    uint32_t i;
+
+    if ( offset == 0 && count == width && ((uintptr_t)mem & (width - 1)) == 0) {
+      uint32_t whole = (length - done) & ~(width - 1);
+
+      count = copyMemory_platform( (void *)(uintptr_t)(addr + done), mem, whole, width);
+      mem += count;
+      done += count;
+      if ( count < whole) {
+	break;
+      }
+      continue;
+    }
+
+    if ( count < width && !loadUnit( addr + done - offset, width, &value)) {
+      break;
+    }
+    for ( i = 0; i < count; i++) {
+      uint32_t shift = 8 * (offset + i);
+
+      value = (value & ~(0xffu << shift)) | ((uint32_t)*mem++ << shift);
+    }
+    if ( !storeUnit( addr + done - offset, width, value)) {
+      break;
+    }
+
+    done += count;
+  }
+
+  return done;
+}
+
+
+/** Add length chars to the text, copying those inside the window. */
+static void
+emitText( struct window_region *window, const char *text, uint32_t length) {
+  uint32_t i;
+
+  for ( i = 0; i < length; i++, window->pos++) {
+    if ( window->pos >= window->offset && window->pos - window->offset < window->length) {
+      window->buffer[window->pos - window->offset] = text[i];
+    }
+  }
+}
+
+
+/** Add a string to the text. */
+static void
+emitString( struct window_region *window, const char *text) {
+  emitText( window, text, strlen( text));
+}
+
+
+/** Add a number to the text as 0x and hex chars. */
+static void
+emitHex( struct window_region *window, uint32_t value) {
+  uint8_t hex[10] = "0x";
+
+  emitText( window, (const char *)hex, 2 + formatHex_codec( &hex[2], value));
+}
+
+
+/* the XML is generated again for each part asked for, it is small */
+int
+map_region( uint32_t offset, uint8_t *buffer, uint32_t length, uint32_t *count) {
+  uint32_t region_count;
+  const struct mem_region *regions = regions_platform( &region_count);
+  struct window_region window = { offset, length, 0, buffer };
+  uint32_t i;
+
+  emitString( &window, "<?xml version=\"1.0\"?>\n"
+	      "<!DOCTYPE memory-map PUBLIC \"+//IDN gnu.org//DTD GDB Memory Map V1.0//EN\""
+	      " \"http://sourceware.org/gdb/gdb-memory-map.dtd\">\n"
+	      "<memory-map>\n");
+  for ( i = 0; i < region_count; i++) {
+    emitString( &window, (regions[i].flags & WRITE_REGION) ?
+		"<memory type=\"ram\" start=\"" : "<memory type=\"rom\" start=\"");
+    emitHex( &window, regions[i].start);
+    emitString( &window, "\" length=\"");
+    emitHex( &window, regions[i].size);
+    emitString( &window, "\"/>\n");
+  }
+  emitString( &window, "</memory-map>\n");
+
+  if ( window.pos <= offset) {
+    *count = 0;
+  }
+  else {
+    *count = window.pos - offset < length ? window.pos - offset : length;
+  }
+
+  return window.pos <= offset + length;
+}
@@ -0,0 +1,73 @@
+#ifndef _MEM_REGION_H_
+#define _MEM_REGION_H_ 1
+/** \file
+ * \brief The memory map GDB's reads and writes are checked against.
+ *
+ * The platform describes its memory as a table of regions sorted by
+ * address (regions_platform). A request is looked up once and the region
+ * found decides how the memory is copied: VRAM, the palette and OAM ignore
+ * byte writes, and the I/O registers are safest a halfword at a time.
+ *
+ * The copies go through copyMemory_platform, so an address inside a region
+ * that still faults (a hole the table does not know about) ends the copy
+ * rather than stopping the stub. They are quickest when mem has the same
+ * alignment as addr, then only the first and last units are split up.
+ */
+
+/** The region can be read */
+#define READ_REGION 0x1
+
+/** The region can be written */
+#define WRITE_REGION 0x2
+
+/** The region is memory that goes in a core dump, not a mirror of it or
+ * registers that reading would disturb */
+#define CORE_REGION 0x4
+
+
+/** \brief A region of target memory.
+ */
+struct mem_region {
+  /** The first address */
+  uint32_t start;
+
+  /** The size in bytes */
+  uint32_t size;
+
+  /** READ_REGION, WRITE_REGION and CORE_REGION */
+  uint8_t flags;
+
+  /** The narrowest access the memory handles, 1, 2 or 4 bytes */
+  uint8_t width;
+
+  /** A short name for the region */
+  const char *name;
+};
+
+
+/** Find the region holding all of length bytes at addr that allows the
+ * access in flags. Returns NULL if there is none. */
+const struct mem_region *
+find_region( uint32_t addr, uint32_t length, uint32_t flags);
+
+
+/** Copy length bytes at addr in a region into mem, using accesses the
+ * region handles. Returns the number of bytes copied before one faulted. */
+uint32_t
+read_region( const struct mem_region *region, uint8_t *mem, uint32_t addr, uint32_t length);
+
+
+/** Copy length bytes from mem to addr in a region, using accesses the
+ * region handles. Bytes next to the range may be read and written back.
+ * Returns the number of bytes copied before one faulted. */
+uint32_t
+write_region( const struct mem_region *region, uint32_t addr, const uint8_t *mem,
+	      uint32_t length);
+
+/** Copy length bytes from offset of GDB's memory map XML for the regions
+ * into buffer, the writable regions as ram and the rest as rom. *count is
+ * set to the bytes copied. Returns 1 if they end the map. */
+int
+map_region( uint32_t offset, uint8_t *buffer, uint32_t length, uint32_t *count);
+
+#endif /* End of _MEM_REGION_H_ */
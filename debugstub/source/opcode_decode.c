@@ -117,7 +117,7 @@ instructionExecuted_opcode( uint32_t instr_addr, int thumb_flag, uint32_t cpsr)
     executed_flag = 1;
   }
   else {
-    uint32_t instr_cond = ((*(uint32_t *)instr_addr) & ARM_CONDITION_MASK) >> 28;
+    uint32_t instr_cond = ((*(uint32_t *)(uintptr_t)instr_addr) & ARM_CONDITION_MASK) >> 28;
 
     LOG("Check executed flag\n");
     executed_flag = conditionCheck_opcode( instr_cond, cpsr);
@@ -138,12 +138,12 @@ causeJump_opcode( uint32_t instr_addr, int *thumb_flag, const uint32_t *reg_set,
   *dest_addr = instr_addr;
 
   if ( *thumb_flag) {
-    uint16_t op_code = *(uint16_t *)instr_addr;
+    uint16_t op_code = *(uint16_t *)(uintptr_t)instr_addr;
     branch_flag = causeJump_thumb( op_code, thumb_flag, reg_set, dest_addr);
   }
   else {
     /* The arm conditions are assumed to have been checked else where */
-    uint32_t op_code = *(uint32_t *)instr_addr;
+    uint32_t op_code = *(uint32_t *)(uintptr_t)instr_addr;
     branch_flag = causeJump_arm( op_code, thumb_flag, reg_set, dest_addr);
   }
 
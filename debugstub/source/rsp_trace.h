@@ -0,0 +1,58 @@
+#ifndef _RSP_TRACE_H_
+#define _RSP_TRACE_H_ 1
+/** \file
+ * \brief The format of a trace of the packets exchanged with GDB.
+ *
+ * Written by the stub through a struct trace_sink_debug and read by the host
+ * tools. All values are little endian.
+ *
+ * The header (HEADER_SIZE_TRACE bytes):
+ *  - bytes 0-3: MAGIC_TRACE
+ *  - byte 4: VERSION_TRACE
+ *  - bytes 5-7: zero
+ *  - bytes 8-11: the length of a tick in nanoseconds
+ *
+ * Then one record per event:
+ *  - byte 0: the record type (IN_TRACE, OUT_TRACE or BREAK_TRACE)
+ *  - varint: the ticks since the previous record (since the header for the
+ *    first)
+ *  - varint: a length
+ *  - IN_TRACE only: length bytes, the packet as received between '$' and '#'
+ *
+ * An OUT_TRACE length is the number of bytes sent between '$' and '#', the
+ * contents are not kept as they are rebuilt from the target. A varint holds
+ * seven bits in each byte, least significant first, the top bit set in all
+ * but the last.
+ *
+ * A packet is recorded when it has been received, a reply once it has been
+ * handed to the comms interface and an interrupt character when it stops
+ * the running application (ahead of the stop reply it causes).
+ */
+
+/** The first four bytes of a trace */
+#define MAGIC_TRACE "RSPT"
+
+/** The version of the format */
+#define VERSION_TRACE 1
+
+/** The size of the trace header */
+#define HEADER_SIZE_TRACE 12
+
+/** The most bytes a varint takes */
+#define MAX_VARINT_TRACE 5
+
+
+/** The record types.
+ */
+enum record_type_trace {
+  /** A packet from GDB */
+  IN_TRACE = 1,
+
+  /** A packet to GDB */
+  OUT_TRACE = 2,
+
+  /** GDB's interrupt character */
+  BREAK_TRACE = 3
+};
+
+#endif /* End of _RSP_TRACE_H_ */
@@ -134,7 +134,7 @@ thumb_POP_jump( uint16_t opcode, int *thumb_flag, const uint32_t *reg_set) {
   }
 
   pc_value_addr += 4 * (reg_count);
-  dest_addr = *(uint32_t *)pc_value_addr;
+  dest_addr = *(uint32_t *)(uintptr_t)pc_value_addr;
 
   *thumb_flag = (dest_addr & 0x1);
 
@@ -7,6 +7,17 @@
  * \brief The DS Debugger stub.
  */
 
+/** \brief A block of data for a gathered write.
+ */
+struct iovec_debug {
+  /** The start of the data */
+  const uint8_t *base;
+
+  /** The number of bytes */
+  uint32_t length;
+};
+
+
 /** \brief The funcion interface for a communication mechanism to the host PC.
  */
 struct comms_fn_iface_debug {
@@ -27,6 +38,57 @@ struct comms_fn_iface_debug {
 
   /** Return the bit mask of the DS Interrupts (REG_IE) needed for comms */
   uint32_t (*get_IRQs)( void);
+
+  /** Read up to max bytes from the comms mechanism into buffer. Returns the
+   * number of bytes read, 0 if none are available.
+   * (NULL if not supported, readByte_fn is then used) */
+  int (*readData_fn)( uint8_t *buffer, uint32_t max);
+
+  /** Write the count blocks of data in vector as one, in order.
+   * (NULL if not supported, writeData_fn is then used) */
+  void (*writeVector_fn)( const struct iovec_debug *vector, int count);
+
+  /** Drop the connection to GDB, once anything written has been delivered,
+   * and wait for another. (NULL if not supported) */
+  void (*disconnect_fn)( void);
+};
+
+/** \brief Where a trace of the packets exchanged with GDB is written.
+ * The format is described in debugstub/source/rsp_trace.h.
+ */
+struct trace_sink_debug {
+  /** Write length bytes of the trace */
+  void (*write_fn)( void *context, const uint8_t *data, uint32_t length);
+
+  /** Return a free running count of ticks, this is also called from the
+   * comms interrupt when GDB interrupts the application */
+  uint32_t (*time_fn)( void *context);
+
+  /** The length of a tick in nanoseconds */
+  uint32_t tick_ns;
+
+  /** Passed to write_fn and time_fn */
+  void *context;
+};
+
+/** \brief The time the stub has spent copying memory for GDB, measured
+ * on the DS when the stub is built with COPY_TIMING.
+ */
+struct copy_stats_debug {
+  /** The bytes copied */
+  uint32_t bytes;
+
+  /** The bus cycles (33MHz) the copies took, to the 64 the timer counts */
+  uint32_t cycles;
+
+  /** The bytes in the last copy */
+  uint32_t last_bytes;
+
+  /** The bus cycles the last copy took */
+  uint32_t last_cycles;
+
+  /** The bytes of large writes handed to DMA, not counted in bytes */
+  uint32_t dma_bytes;
 };
 
 #ifdef __cplusplus
@@ -39,12 +101,56 @@ void
 debugHalt( void);
 
 
+/** \brief Called by a comms interface from its interrupt handler when GDB
+ * connects, the application is stopped as soon as the interrupt returns.
+ * The comms interface need not wait for GDB in its init_fn.
+ * This needs the interrupt handler init_debug puts in front of the
+ * application's, so IRQ_HANDLER must not be replaced after init_debug.
+ */
+void
+attachRequest_debug( void);
+
+
+/** \brief Called by a comms interface from its interrupt handler when GDB's
+ * interrupt character (0x03) arrives while the application is running. The
+ * application is stopped with SIGINT as soon as the interrupt returns, or
+ * at a later interrupt if this one did not come from application code.
+ */
+void
+interruptRequest_debug( void);
+
+
 /** \brief Initialises the debugger stub and the supplied comms interface.
  */
 int
 init_debug( struct comms_fn_iface_debug *comms_if, void *comms_data);
 
 
+/** \brief Initialises the debugger stub and the supplied comms interface,
+ * using packet_mem for the packet buffers.
+ * 512 bytes hold the small replies and the rest receives packets, the
+ * larger it is the more memory GDB can write with each packet.
+ * init_debug uses 4KB of static buffers. Returns 0 if less than 1KB is given.
+ */
+int
+init_debug_buffers( struct comms_fn_iface_debug *comms_if, void *comms_data,
+		    uint8_t *packet_mem, uint32_t packet_mem_size);
+
+
+/** \brief Start recording the packets exchanged with GDB to sink, or stop
+ * if it is NULL. The sink is written to from the stub, while the
+ * application is stopped, and must stay valid while recording.
+ */
+void
+setTrace_debug( const struct trace_sink_debug *sink);
+
+
+/** \brief Read the memory copy timings (DS only) and start them again from
+ * zero, so a read GDB is asked for can be timed on its own.
+ */
+void
+getCopyStats_debug( struct copy_stats_debug *stats);
+
 #ifdef __cplusplus
 };
 #endif
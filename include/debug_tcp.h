@@ -12,11 +12,49 @@
 struct tcp_debug_comms_init_data {
   /** the port number on which to listen for connections */
   uint16_t port;
+
+  /** the period in milliseconds the application runs Timer 3 at, which is
+   * passed to Wifi_Timer (0 for 50) */
+  uint32_t timer_ms;
+
+  /** the application's own Timer 3 work, called from the stub's handler
+   * after Wifi_Timer (NULL if there is none) */
+  void (*timer_fn)( void);
 };
 
 
-/**
+/** \brief Statistics of the receive ring.
+ */
+struct tcp_debug_comms_stats {
+  /** The most bytes that have been waiting in the ring */
+  uint32_t high_water;
+
+  /** The number of times the ring filled, leaving data in the socket */
+  uint32_t overruns;
+
+  /** The bus cycles (33MHz) the last timer interrupt took on top of
+   * Wifi_Timer, only measured when built with TICK_TIMING */
+  uint32_t tick_cycles;
+
+  /** The most bus cycles a timer interrupt has taken on top of Wifi_Timer */
+  uint32_t tick_cycles_max;
+};
+
+
+/** The comms interface. The stub owns the Timer 3 interrupt: init_fn
+ * installs a handler which calls Wifi_Timer( timer_ms) and the
+ * application's timer_fn before accepting GDB or reading the socket, so
+ * the application must not set its own handler afterwards. The
+ * application still starts Timer 3 at its chosen period. init_fn returns
+ * straight away, the application is stopped when GDB connects.
  */
 extern struct comms_fn_iface_debug tcpCommsIf_debug;
 
+
+/** Read the receive ring statistics, used to size the ring for the traffic
+ * and to budget the timer interrupt against the frame time.
+ */
+void
+getStats_tcp( struct tcp_debug_comms_stats *stats);
+
 #endif /* End of _DEBUG_TCP_H_ */
@@ -0,0 +1,67 @@
+#ifndef _DEBUG_UDP_H_
+#define _DEBUG_UDP_H_ 1
+/** \file
+ * \brief The debug stub UDP network comms.
+ *
+ * GDB connects to the udp_bridge tool on the host which carries the
+ * packets to the DS in UDP datagrams, avoiding the latency the DS TCP stack
+ * adds to each small exchange.
+ */
+
+
+/** \brief The UDP comms initialisation data.
+ */
+struct udp_debug_comms_init_data {
+  /** the port number on which to listen for the bridge */
+  uint16_t port;
+
+  /** the period in milliseconds the application runs Timer 3 at, which is
+   * passed to Wifi_Timer and times the resends (0 for 50) */
+  uint32_t timer_ms;
+
+  /** the application's own Timer 3 work, called from the stub's handler
+   * after Wifi_Timer (NULL if there is none) */
+  void (*timer_fn)( void);
+};
+
+
+/** \brief Statistics of the UDP link.
+ */
+struct udp_debug_comms_stats {
+  /** The datagrams resent after a timeout */
+  uint32_t timeout_resends;
+
+  /** The datagrams resent because a later one was acked */
+  uint32_t fast_resends;
+
+  /** The datagrams received more than once */
+  uint32_t duplicates;
+
+  /** The datagrams dropped because the receive buffer was full */
+  uint32_t ring_drops;
+
+  /** The bus cycles (33MHz) the last timer interrupt took on top of
+   * Wifi_Timer, only measured when built with TICK_TIMING */
+  uint32_t tick_cycles;
+
+  /** The most bus cycles a timer interrupt has taken on top of Wifi_Timer */
+  uint32_t tick_cycles_max;
+};
+
+
+/** The comms interface. The stub owns the Timer 3 interrupt: init_fn
+ * installs a handler which calls Wifi_Timer( timer_ms) and the
+ * application's timer_fn before reading the socket, so the application
+ * must not set its own handler afterwards. The application still starts
+ * Timer 3 at its chosen period. init_fn returns straight away, the
+ * application is stopped when the bridge says hello.
+ */
+extern struct comms_fn_iface_debug udpCommsIf_debug;
+
+
+/** Read the link statistics.
+ */
+void
+getStats_udp( struct udp_debug_comms_stats *stats);
+
+#endif /* End of _DEBUG_UDP_H_ */
@@ -0,0 +1,101 @@
+/** \file
+ * \brief Timing of the memory copy kernels behind GDB's memory packets.
+ *
+ * Each kernel copies 64KB of simulated main RAM, as a 64KB 'm' read or 'M'
+ * write would, to or from a buffer aligned as the stub aligns its packet
+ * buffer. The same copy from a buffer one byte out shows the unit at a time
+ * path the kernels fall back to.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <debug_stub.h>
+#include "debug_platform.h"
+#include "mem_region.h"
+#include "hex_codec.h"
+#include "linux_platform.h"
+#include "copy_bench.h"
+
+/** The bytes each kernel copies */
+#define BENCH_SIZE (64 * 1024)
+
+/** The times each kernel is run */
+#define BENCH_ROUNDS 500
+
+
+/** The kernels timed */
+enum kernel_bench {
+  READ_BENCH,
+  WRITE_BENCH,
+  ENCODE_BENCH,
+  DECODE_BENCH
+};
+
+
+/** Run a kernel BENCH_ROUNDS times and print its rate. */
+static void
+timeKernel( const char *name, enum kernel_bench kernel,
+	    const struct mem_region *region, uint8_t *buffer) {
+  uint8_t *hex = malloc( 2 * BENCH_SIZE);
+  uint64_t start;
+  double seconds;
+  int i;
+
+  encodeHex_codec( hex, buffer, BENCH_SIZE);
+
+  start = nowNs_linux();
+  for ( i = 0; i < BENCH_ROUNDS; i++) {
+    switch ( kernel) {
+    case READ_BENCH:
+      read_region( region, buffer, RAM_BASE_LINUX, BENCH_SIZE);
+      break;
+
+    case WRITE_BENCH:
+      write_region( region, RAM_BASE_LINUX, buffer, BENCH_SIZE);
+      break;
+
+    case ENCODE_BENCH:
+      encodeHex_codec( hex, buffer, BENCH_SIZE);
+      break;
+
+    case DECODE_BENCH:
+      decodeHex_codec( buffer, hex, BENCH_SIZE);
+      break;
+    }
+  }
+  seconds = (nowNs_linux() - start) / 1e9;
+
+  printf( "%-24s %8.1f MB/s  %7.1f us per 64KB\n", name,
+	  (double)BENCH_SIZE * BENCH_ROUNDS / seconds / (1024 * 1024),
+	  seconds * 1e6 / BENCH_ROUNDS);
+  free( hex);
+}
+
+
+/* time the kernels */
+void
+benchmark_linux( void) {
+  static const struct mem_region halfwords = {
+    RAM_BASE_LINUX, RAM_SIZE_LINUX, READ_REGION | WRITE_REGION, 2, "halfwords"
+  };
+  const struct mem_region *bytes = find_region( RAM_BASE_LINUX, BENCH_SIZE, READ_REGION);
+  /* word aligned, as RAM_BASE_LINUX is */
+  uint32_t *memory = malloc( BENCH_SIZE + 4);
+  uint8_t *aligned = (uint8_t *)memory;
+  uint8_t *unaligned = aligned + 1;
+
+  timeKernel( "read bytes, aligned", READ_BENCH, bytes, aligned);
+  timeKernel( "read bytes, unaligned", READ_BENCH, bytes, unaligned);
+  timeKernel( "read halfwords, aligned", READ_BENCH, &halfwords, aligned);
+  timeKernel( "read halfwords, unaligned", READ_BENCH, &halfwords, unaligned);
+  timeKernel( "write bytes, aligned", WRITE_BENCH, bytes, aligned);
+  timeKernel( "write bytes, unaligned", WRITE_BENCH, bytes, unaligned);
+  timeKernel( "write halfwords, aligned", WRITE_BENCH, &halfwords, aligned);
+  timeKernel( "write halfwords, unaligned", WRITE_BENCH, &halfwords, unaligned);
+  timeKernel( "hex encode", ENCODE_BENCH, NULL, aligned);
+  timeKernel( "hex decode, aligned", DECODE_BENCH, NULL, aligned);
+  timeKernel( "hex decode, unaligned", DECODE_BENCH, NULL, unaligned);
+
+  free( memory);
+}
@@ -0,0 +1,12 @@
+#ifndef _COPY_BENCH_H_
+#define _COPY_BENCH_H_ 1
+/** \file
+ * \brief Timing of the memory copy kernels behind GDB's memory packets.
+ */
+
+/** Time the copies a 64KB read or write makes through the region code and
+ * the hex codec, printing the rates on stdout. Main RAM must be mapped. */
+void
+benchmark_linux( void);
+
+#endif /* End of _COPY_BENCH_H_ */
@@ -0,0 +1,240 @@
+/** \file
+ * \brief A comms interface over a pair of file descriptors.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/uio.h>
+
+#include <debug_stub.h>
+#include "fd_comms.h"
+
+/** The size of the buffer for bytes that arrive while the application runs,
+ * must be a power of two */
+#define RX_RING_SIZE 4096
+
+/** GDB's interrupt character */
+#define INTERRUPT_CHAR 0x03
+
+/** How long a read waits for GDB before giving the stub a chance to poll */
+#define READ_WAIT_MS 100
+
+
+/** \brief The state of the comms interface.
+ */
+struct fd_comms {
+  /** The initialisation data */
+  struct fd_comms_init_data fds;
+
+  /** The bytes read by poll_fn and not yet taken */
+  uint8_t ring[RX_RING_SIZE];
+
+  /** The count of bytes put in the ring */
+  uint32_t head;
+
+  /** The count of bytes taken from the ring */
+  uint32_t tail;
+
+  /** The traffic counts */
+  struct fd_comms_stats stats;
+};
+
+
+/** The instance of the comms interface state */
+static struct fd_comms fd_comms;
+
+
+/*
+ * Read what is waiting on the descriptor into buffer, waiting up to
+ * wait_ms for something to arrive. The end of a stdio session ends the
+ * program, a pty is waited on until GDB opens it again.
+ */
+static int
+readFd( uint8_t *buffer, uint32_t max, int wait_ms) {
+  struct pollfd pfd = { fd_comms.fds.read_fd, POLLIN, 0 };
+  ssize_t read_len;
+  uint32_t i;
+
+  if ( poll( &pfd, 1, wait_ms) <= 0) {
+    return 0;
+  }
+  read_len = read( fd_comms.fds.read_fd, buffer, max);
+
+  if ( read_len < 0 && (errno == EAGAIN || errno == EINTR)) {
+    return 0;
+  }
+  if ( read_len <= 0) {
+    if ( !fd_comms.fds.reopen) {
+      exit( 0);
+    }
+    /* nobody has the pty open, do not spin on it */
+    usleep( READ_WAIT_MS * 1000);
+    return 0;
+  }
+
+  fd_comms.stats.bytes_in += read_len;
+  for ( i = 0; i < (uint32_t)read_len; i++) {
+    if ( buffer[i] == '$') {
+      fd_comms.stats.packets_in += 1;
+    }
+  }
+
+  return read_len;
+}
+
+
+/* write everything, GDB is expected to keep reading */
+static void
+writeFd( const uint8_t *buffer, uint32_t count) {
+  while ( count > 0) {
+    ssize_t written = write( fd_comms.fds.write_fd, buffer, count);
+
+    if ( written < 0) {
+      if ( errno == EINTR || errno == EAGAIN) {
+	continue;
+      }
+      exit( 0);
+    }
+    buffer += written;
+    count -= written;
+  }
+}
+
+
+static int
+init_fn( void *data) {
+  if ( data == NULL) {
+    return 0;
+  }
+
+  fd_comms.fds = *(struct fd_comms_init_data *)data;
+
+  return 1;
+}
+
+
+static int
+readData_fn( uint8_t *buffer, uint32_t max) {
+  uint32_t available = fd_comms.head - fd_comms.tail;
+
+  if ( available == 0) {
+    /* nothing was buffered, the stub is waiting for GDB */
+    return readFd( buffer, max, READ_WAIT_MS);
+  }
+
+  if ( max > available) {
+    max = available;
+  }
+  {
+    uint32_t offset = fd_comms.tail & (RX_RING_SIZE - 1);
+    uint32_t first = RX_RING_SIZE - offset;
+
+    if ( first > max) {
+      first = max;
+    }
+    memcpy( buffer, &fd_comms.ring[offset], first);
+    memcpy( &buffer[first], &fd_comms.ring[0], max - first);
+  }
+  fd_comms.tail += max;
+
+  return max;
+}
+
+
+static int
+readByte_fn( uint8_t *read_byte) {
+  return readData_fn( read_byte, 1);
+}
+
+
+/* buffer anything waiting, stopping the application if GDB interrupts */
+static void
+poll_fn( void) {
+  uint32_t offset = fd_comms.head & (RX_RING_SIZE - 1);
+  uint32_t space = RX_RING_SIZE - (fd_comms.head - fd_comms.tail);
+  int read_len;
+
+  if ( space > RX_RING_SIZE - offset) {
+    space = RX_RING_SIZE - offset;
+  }
+  if ( space == 0) {
+    return;
+  }
+
+  read_len = readFd( &fd_comms.ring[offset], space, 0);
+  if ( read_len > 0) {
+    fd_comms.head += read_len;
+
+    if ( memchr( &fd_comms.ring[offset], INTERRUPT_CHAR, read_len) != NULL) {
+      /* ignored while the stub is running */
+      interruptRequest_debug();
+    }
+  }
+}
+
+
+static void
+writeVector_fn( const struct iovec_debug *vector, int count) {
+  int i;
+
+  if ( count > 0 && vector[0].length > 0 && vector[0].base[0] == '$') {
+    fd_comms.stats.packets_out += 1;
+  }
+  for ( i = 0; i < count; i++) {
+    writeFd( vector[i].base, vector[i].length);
+    fd_comms.stats.bytes_out += vector[i].length;
+  }
+}
+
+
+static void
+writeData_fn( uint8_t *buffer, uint32_t count) {
+  struct iovec_debug vector;
+
+  vector.base = buffer;
+  vector.length = count;
+  writeVector_fn( &vector, 1);
+}
+
+
+static void
+writeByte_fn( uint8_t byte) {
+  writeData_fn( &byte, 1);
+}
+
+
+static uint32_t
+irqs_fn( void) {
+  /* there are no DS interrupts */
+  return 0;
+}
+
+
+/* read the traffic counts */
+void
+getStats_fd( struct fd_comms_stats *stats) {
+  *stats = fd_comms.stats;
+}
+
+
+/** The instance of the comms function interface */
+struct comms_fn_iface_debug fdCommsIf_linux = {
+  .init_fn = init_fn,
+
+  .readByte_fn = readByte_fn,
+
+  .writeByte_fn = writeByte_fn,
+
+  .writeData_fn = writeData_fn,
+
+  .poll_fn = poll_fn,
+
+  .get_IRQs = irqs_fn,
+
+  .readData_fn = readData_fn,
+
+  .writeVector_fn = writeVector_fn
+};
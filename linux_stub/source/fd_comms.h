@@ -0,0 +1,53 @@
+#ifndef _FD_COMMS_H_
+#define _FD_COMMS_H_ 1
+/** \file
+ * \brief A comms interface over a pair of file descriptors.
+ *
+ * Used with stdin/stdout (the socketpair GDB makes for 'target remote |')
+ * or a pty. Bytes arriving while the application runs are buffered, and
+ * GDB's interrupt character stops the application.
+ */
+
+
+/** \brief The file descriptor comms initialisation data.
+ */
+struct fd_comms_init_data {
+  /** The descriptor GDB's packets are read from */
+  int read_fd;
+
+  /** The descriptor replies are written to */
+  int write_fd;
+
+  /** Flag set if the end of read_fd is not the end of the session, a pty
+   * GDB may open again */
+  int reopen;
+};
+
+
+/** \brief The traffic counts.
+ */
+struct fd_comms_stats {
+  /** The packets started by GDB */
+  uint32_t packets_in;
+
+  /** The packets started by the stub */
+  uint32_t packets_out;
+
+  /** The bytes read */
+  uint64_t bytes_in;
+
+  /** The bytes written */
+  uint64_t bytes_out;
+};
+
+
+/** The comms interface */
+extern struct comms_fn_iface_debug fdCommsIf_linux;
+
+
+/** Read the traffic counts.
+ */
+void
+getStats_fd( struct fd_comms_stats *stats);
+
+#endif /* End of _FD_COMMS_H_ */
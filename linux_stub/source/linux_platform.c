@@ -0,0 +1,395 @@
+/** \file
+ * \brief The Linux platform layer of the debug stub, a simulated DS.
+ */
+#include <setjmp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <debug_stub.h>
+#include "debug_platform.h"
+#include "opcode_decode.h"
+#include "mem_region.h"
+#include "linux_platform.h"
+
+/** The instructions simulated between polls of the comms interface */
+#define POLL_INTERVAL 1024
+
+/** Signal number for an access outside the simulated memory */
+#define SIGSEGV_LINUX 11
+
+/** The ARM BKPT instruction, the immediate bits masked out */
+#define ARM_BKPT_MASK 0xfff000f0
+#define ARM_BKPT 0xe1200070
+
+/** The ARM permanently undefined instruction space, GDB's breakpoints */
+#define ARM_UNDEF_MASK 0x0ff000f0
+#define ARM_UNDEF 0x07f000f0
+
+/** The Thumb BKPT instruction */
+#define THUMB_BKPT_MASK 0xff00
+#define THUMB_BKPT 0xbe00
+
+/** The undefined Thumb conditional branch, GDB's Thumb breakpoints */
+#define THUMB_UNDEF_MASK 0xff00
+#define THUMB_UNDEF 0xde00
+
+/** The CPSR Thumb state bit */
+#define CPSR_T_FLAG 0x20
+
+/** The CPSR of the simulated application, System mode */
+#define START_CPSR 0x1f
+
+
+/** \brief The simulated DS.
+ */
+struct sim_linux {
+  /** r0 to r14, laid out like exceptionRegisters */
+  uint32_t registers[16];
+
+  /** The address of the next instruction */
+  uint32_t pc;
+
+  /** The status register */
+  uint32_t cpsr;
+
+  /** The interface to the debugger communications */
+  struct comms_fn_iface_debug *comms_if;
+
+  /** The signal to stop with, 0 if none is wanted */
+  uint32_t break_signal;
+
+  /** When the stop was asked for */
+  uint64_t break_time;
+
+  /** The stop statistics */
+  struct stop_stats_linux stats;
+
+  /** Flag set while copyMemory_platform is copying */
+  volatile sig_atomic_t copying;
+
+  /** Where a fault during a copy goes back to */
+  sigjmp_buf fault_jump;
+
+  /** The background copy waiting to be made */
+  void *copy_dest;
+  const void *copy_src;
+  uint32_t copy_length;
+};
+
+
+/** The instance of the simulated DS */
+static struct sim_linux sim;
+
+
+/* the time for latency measurements */
+uint64_t
+nowNs_linux( void) {
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/* place main RAM where the DS has it */
+int
+initMemory_linux( void) {
+  void *ram = mmap( (void *)(uintptr_t)RAM_BASE_LINUX, RAM_SIZE_LINUX,
+		    PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+  return ram == (void *)(uintptr_t)RAM_BASE_LINUX;
+}
+
+
+/** Stop the application, returning once GDB lets it run again. */
+static void
+stop( uint32_t signal) {
+  sim.pc = stopped_debug( sim.pc, signal);
+}
+
+
+/**
+ * Simulate the instruction at the PC. Returns the signal if it stops the
+ * application, 0 otherwise.
+ */
+static uint32_t
+step( void) {
+  int thumb_flag = (sim.cpsr & CPSR_T_FLAG) != 0;
+  uint32_t size = thumb_flag ? 2 : 4;
+
+  if ( find_region( sim.pc, size, READ_REGION) == NULL) {
+    return SIGSEGV_LINUX;
+  }
+
+  if ( thumb_flag) {
+    uint16_t op_code = *(uint16_t *)(uintptr_t)sim.pc;
+
+    if ( (op_code & THUMB_BKPT_MASK) == THUMB_BKPT) {
+      return SIGTRAP_DEBUG;
+    }
+    if ( (op_code & THUMB_UNDEF_MASK) == THUMB_UNDEF) {
+      return SIGILL_DEBUG;
+    }
+  }
+  else {
+    uint32_t op_code = *(uint32_t *)(uintptr_t)sim.pc;
+
+    if ( (op_code & ARM_BKPT_MASK) == ARM_BKPT) {
+      return SIGTRAP_DEBUG;
+    }
+    if ( (op_code & ARM_UNDEF_MASK) == ARM_UNDEF) {
+      return SIGILL_DEBUG;
+    }
+  }
+
+  if ( instructionExecuted_opcode( sim.pc, thumb_flag, sim.cpsr)) {
+    uint32_t reg_set[17];
+    uint32_t dest_addr;
+
+    memcpy( reg_set, sim.registers, 15 * sizeof( uint32_t));
+    /* the PC reads as the current address + 8 (+ 4 in Thumb state) */
+    reg_set[PC] = sim.pc + 2 * size;
+    reg_set[CPSR] = sim.cpsr;
+
+    if ( causeJump_opcode( sim.pc, &thumb_flag, reg_set, &dest_addr)) {
+      sim.pc = dest_addr;
+      sim.cpsr = thumb_flag ? (sim.cpsr | CPSR_T_FLAG) : (sim.cpsr & ~CPSR_T_FLAG);
+      return 0;
+    }
+  }
+
+  sim.pc += size;
+
+  return 0;
+}
+
+
+/* run the application under the stub */
+void
+run_linux( uint32_t entry) {
+  uint32_t count = 0;
+
+  sim.pc = entry;
+  sim.cpsr = START_CPSR;
+  sim.registers[SP] = RAM_BASE_LINUX + RAM_SIZE_LINUX;
+
+  stop( SIGTRAP_DEBUG);
+
+  while ( 1) {
+    uint32_t signal;
+
+    /* the comms interface is looked at as an interrupt handler would */
+    if ( ++count == POLL_INTERVAL) {
+      count = 0;
+      if ( sim.comms_if->poll_fn != NULL) {
+	sim.comms_if->poll_fn();
+      }
+    }
+
+    if ( sim.break_signal != 0) {
+      uint64_t latency = nowNs_linux() - sim.break_time;
+
+      sim.stats.requested_stops += 1;
+      sim.stats.latency_total_ns += latency;
+      if ( sim.stats.requested_stops == 1 || latency < sim.stats.latency_min_ns) {
+	sim.stats.latency_min_ns = latency;
+      }
+      if ( latency > sim.stats.latency_max_ns) {
+	sim.stats.latency_max_ns = latency;
+      }
+
+      signal = sim.break_signal;
+      sim.break_signal = 0;
+      stop( signal);
+    }
+    else if ( (signal = step()) != 0) {
+      stop( signal);
+    }
+    else {
+      sim.stats.instructions += 1;
+    }
+  }
+}
+
+
+/* read the stop statistics */
+void
+getStopStats_linux( struct stop_stats_linux *stats) {
+  *stats = sim.stats;
+}
+
+
+/** A SIGSEGV or SIGBUS, which ends a copy or is taken as usual. */
+static void
+faultHandler( int number) {
+  if ( !sim.copying) {
+    /* the access faults again once this returns */
+    signal( number, SIG_DFL);
+    return;
+  }
+
+  siglongjmp( sim.fault_jump, 1);
+}
+
+
+/*
+ * The platform functions
+ */
+void
+init_platform( struct comms_fn_iface_debug *comms_if) {
+  struct sigaction action;
+
+  sim.comms_if = comms_if;
+
+  /* the handler jumps out, so the signal is left unblocked while it runs
+   * and the copy need not save the signal mask */
+  memset( &action, 0, sizeof( action));
+  action.sa_handler = faultHandler;
+  action.sa_flags = SA_NODEFER;
+  sigaction( SIGSEGV, &action, NULL);
+  sigaction( SIGBUS, &action, NULL);
+}
+
+
+uint32_t *
+registers_platform( void) {
+  return sim.registers;
+}
+
+
+uint32_t
+status_platform( void) {
+  return sim.cpsr;
+}
+
+
+/* only main RAM is simulated */
+const struct mem_region *
+regions_platform( uint32_t *count) {
+  static const struct mem_region ram = {
+    RAM_BASE_LINUX, RAM_SIZE_LINUX, READ_REGION | WRITE_REGION | CORE_REGION, 1, "main"
+  };
+
+  *count = 1;
+
+  return &ram;
+}
+
+
+/*
+ * Bytes are copied a word at a time when dest and src line up, as on the
+ * DS. A fault jumps back out of the copy loop, a fault in a word goes
+ * round again a byte at a time to find the byte.
+ */
+uint32_t
+copyMemory_platform( void *dest, const void *src, uint32_t length, uint32_t width) {
+  volatile uint32_t done = 0;
+  volatile int words = width == 1 && (((uintptr_t)dest ^ (uintptr_t)src) & 3) == 0;
+  uint8_t *to = dest;
+  const uint8_t *from = src;
+
+  if ( sigsetjmp( sim.fault_jump, 0) != 0) {
+    if ( !words) {
+      sim.copying = 0;
+      return done;
+    }
+    words = 0;
+  }
+  sim.copying = 1;
+
+  if ( words) {
+    while ( done < length && ((uintptr_t)&from[done] & 3)) {
+      *(volatile uint8_t *)&to[done] = *(const volatile uint8_t *)&from[done];
+      done += 1;
+    }
+    while ( length - done >= 16) {
+      const volatile uint32_t *in = (const volatile uint32_t *)&from[done];
+      volatile uint32_t *out = (volatile uint32_t *)&to[done];
+      uint32_t w0 = in[0], w1 = in[1], w2 = in[2], w3 = in[3];
+
+      out[0] = w0;
+      out[1] = w1;
+      out[2] = w2;
+      out[3] = w3;
+      done += 16;
+    }
+    while ( length - done >= 4) {
+      *(volatile uint32_t *)&to[done] = *(const volatile uint32_t *)&from[done];
+      done += 4;
+    }
+  }
+
+  while ( done < length) {
+    if ( width == 1) {
+      *(volatile uint8_t *)&to[done] = *(const volatile uint8_t *)&from[done];
+    }
+    else if ( width == 2) {
+      *(volatile uint16_t *)&to[done] = *(const volatile uint16_t *)&from[done];
+    }
+    else {
+      *(volatile uint32_t *)&to[done] = *(const volatile uint32_t *)&from[done];
+    }
+    done += width;
+  }
+  sim.copying = 0;
+
+  return done;
+}
+
+
+/* the copy is only made when it is waited for, so a stub that looks at the
+ * memory or reuses the source too soon gets it wrong here too. A fault
+ * then could not be reported, so a byte of each page written is first
+ * copied onto itself, and a write that would fault is left to the caller. */
+int
+startCopy_platform( void *dest, const void *src, uint32_t length) {
+  uintptr_t page_size = sysconf( _SC_PAGESIZE);
+  uintptr_t page = (uintptr_t)dest & ~(page_size - 1);
+
+  finishCopy_platform();
+  for ( ; page < (uintptr_t)dest + length; page += page_size) {
+    uint8_t *probe = page < (uintptr_t)dest ? dest : (uint8_t *)page;
+
+    if ( copyMemory_platform( probe, probe, 1, 1) != 1) {
+      return 0;
+    }
+  }
+
+  sim.copy_dest = dest;
+  sim.copy_src = src;
+  sim.copy_length = length;
+
+  return 1;
+}
+
+
+void
+finishCopy_platform( void) {
+  if ( sim.copy_length > 0) {
+    copyMemory_platform( sim.copy_dest, sim.copy_src, sim.copy_length, 1);
+    sim.copy_length = 0;
+  }
+}
+
+
+/* there are no caches */
+void
+syncCaches_platform( void) {
+}
+
+
+/* the application stops at the next instruction */
+void
+requestBreak_platform( uint32_t signal) {
+  if ( sim.break_signal == 0) {
+    sim.break_time = nowNs_linux();
+  }
+  sim.break_signal = signal;
+}
@@ -0,0 +1,61 @@
+#ifndef _LINUX_PLATFORM_H_
+#define _LINUX_PLATFORM_H_ 1
+/** \file
+ * \brief The simulated DS the protocol engine runs against on Linux.
+ *
+ * Main RAM is mapped at its DS address. Only the control flow of the
+ * application is simulated: branches are followed using the stub's own
+ * opcode decoders, every other instruction leaves the registers alone. That
+ * is enough for breakpoints, stepping and interrupts to behave as they do on
+ * the DS.
+ */
+
+/** The DS address of main RAM */
+#define RAM_BASE_LINUX 0x02000000
+
+/** The size of main RAM */
+#define RAM_SIZE_LINUX (4 * 1024 * 1024)
+
+
+/** \brief How quickly the application was stopped.
+ */
+struct stop_stats_linux {
+  /** The instructions simulated */
+  uint64_t instructions;
+
+  /** The stops asked for by the comms interface */
+  uint32_t requested_stops;
+
+  /** The total time from a stop being asked for to the stub running */
+  uint64_t latency_total_ns;
+
+  /** The shortest time to stop */
+  uint64_t latency_min_ns;
+
+  /** The longest time to stop */
+  uint64_t latency_max_ns;
+};
+
+
+/** Map the simulated main RAM. Returns 0 if it cannot be placed at
+ * RAM_BASE_LINUX. */
+int
+initMemory_linux( void);
+
+
+/** Return the current time in nanoseconds. */
+uint64_t
+nowNs_linux( void);
+
+
+/** Run the application from entry, stopping in the stub first as if it
+ * had called debugHalt. Does not return. */
+void
+run_linux( uint32_t entry);
+
+
+/** Read the stop statistics. */
+void
+getStopStats_linux( struct stop_stats_linux *stats);
+
+#endif /* End of _LINUX_PLATFORM_H_ */
@@ -0,0 +1,263 @@
+/** \file
+ * \brief The debug stub protocol engine running on Linux against a simulated DS.
+ *
+ * GDB talks to it over stdin/stdout:
+ *   target remote | linux_stub [image]
+ * or over a pty (-t), whose name is printed:
+ *   target remote /dev/pts/N
+ *
+ * The image is loaded at the start of main RAM (or -a load_addr) and run
+ * from there (or -e entry). Without one a small loop is run. The packet
+ * rate and the time taken to stop for GDB are printed on stderr at exit.
+ * With -r the packets are recorded to a trace for tools/rsp_replay. With -b
+ * the memory copy kernels are timed instead of running anything.
+ *
+ * usage: linux_stub [-t] [-b] [-r trace] [-a load_addr] [-e entry] [image]
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <termios.h>
+
+#include <debug_stub.h>
+#include "fd_comms.h"
+#include "linux_platform.h"
+#include "copy_bench.h"
+
+/** The ARM no-op, mov r0, r0 */
+#define ARM_NOP 0xe1a00000
+
+/** The ARM branch always opcode, the offset in the low 24 bits */
+#define ARM_B 0xea000000
+
+/** The length of the default loop in instructions */
+#define LOOP_LENGTH 16
+
+
+/** When the stub started */
+static uint64_t start_ns;
+
+
+/** Write to the trace file. */
+static void
+traceWrite( void *context, const uint8_t *data, uint32_t length) {
+  fwrite( data, 1, length, context);
+}
+
+
+/** The trace clock, in microseconds. */
+static uint32_t
+traceTime( void *context __attribute__((unused))) {
+  return nowNs_linux() / 1000;
+}
+
+
+/** The trace sink, the context is the open trace file */
+static struct trace_sink_debug trace_sink = {
+  .write_fn = traceWrite,
+
+  .time_fn = traceTime,
+
+  .tick_ns = 1000
+};
+
+
+/** Print the statistics. */
+static void
+printStats( void) {
+  struct fd_comms_stats comms;
+  struct stop_stats_linux stops;
+  double seconds = (nowNs_linux() - start_ns) / 1e9;
+
+  getStats_fd( &comms);
+  getStopStats_linux( &stops);
+
+  fprintf( stderr, "%u packets in, %u out in %.3fs (%.0f packets/s), %llu bytes in, %llu out\n",
+	   comms.packets_in, comms.packets_out, seconds, comms.packets_in / seconds,
+	   (unsigned long long)comms.bytes_in, (unsigned long long)comms.bytes_out);
+  fprintf( stderr, "%llu instructions simulated, %u stops asked for",
+	   (unsigned long long)stops.instructions, stops.requested_stops);
+  if ( stops.requested_stops > 0) {
+    fprintf( stderr, ", stop latency min %.1fus avg %.1fus max %.1fus",
+	     stops.latency_min_ns / 1e3,
+	     stops.latency_total_ns / 1e3 / stops.requested_stops,
+	     stops.latency_max_ns / 1e3);
+  }
+  fprintf( stderr, "\n");
+}
+
+
+static void
+stopHandler( int sig __attribute__((unused))) {
+  exit( 0);
+}
+
+
+/** Write a loop of no-ops ending in a branch back to the start. */
+static void
+writeLoop( uint32_t addr) {
+  uint32_t *code = (uint32_t *)(uintptr_t)addr;
+  int i;
+
+  for ( i = 0; i < LOOP_LENGTH - 1; i++) {
+    code[i] = ARM_NOP;
+  }
+  /* the offset is from the branch + 8, in words */
+  code[i] = ARM_B | ((uint32_t)(-(LOOP_LENGTH + 1)) & 0x00ffffff);
+}
+
+
+/** Load an image into the simulated memory. Returns 0 on failure. */
+static int
+loadImage( const char *name, uint32_t addr) {
+  FILE *image = fopen( name, "rb");
+  size_t space = RAM_BASE_LINUX + RAM_SIZE_LINUX - addr;
+
+  if ( image == NULL) {
+    perror( name);
+    return 0;
+  }
+  if ( addr < RAM_BASE_LINUX || addr >= RAM_BASE_LINUX + RAM_SIZE_LINUX) {
+    fprintf( stderr, "Load address %08x is not in main RAM\n", addr);
+    fclose( image);
+    return 0;
+  }
+
+  fread( (void *)(uintptr_t)addr, 1, space, image);
+  fclose( image);
+
+  return 1;
+}
+
+
+/** Open a pty for GDB, returning the master descriptor or -1. */
+static int
+openPty( void) {
+  int master = posix_openpt( O_RDWR | O_NOCTTY);
+  struct termios raw;
+  int slave;
+
+  if ( master < 0 || grantpt( master) < 0 || unlockpt( master) < 0) {
+    perror( "pty");
+    return -1;
+  }
+
+  /* the slave stays open so GDB closing it is not seen as an error */
+  slave = open( ptsname( master), O_RDWR | O_NOCTTY);
+  if ( slave < 0) {
+    perror( ptsname( master));
+    return -1;
+  }
+  tcgetattr( slave, &raw);
+  cfmakeraw( &raw);
+  tcsetattr( slave, TCSANOW, &raw);
+
+  fprintf( stderr, "GDB: target remote %s\n", ptsname( master));
+
+  return master;
+}
+
+
+static void
+usage( const char *name) {
+  fprintf( stderr, "usage: %s [-t] [-b] [-r trace] [-a load_addr] [-e entry] [image]\n", name);
+  exit( 1);
+}
+
+
+int
+main( int argc, char **argv) {
+  struct fd_comms_init_data comms_data;
+  uint32_t load_addr = RAM_BASE_LINUX;
+  uint32_t entry = 0;
+  int use_pty = 0;
+  int bench = 0;
+  int opt;
+
+  while ( (opt = getopt( argc, argv, "tbr:a:e:")) != -1) {
+    switch ( opt) {
+    case 't':
+      use_pty = 1;
+      break;
+    case 'b':
+      bench = 1;
+      break;
+    case 'r':
+      trace_sink.context = fopen( optarg, "wb");
+      if ( trace_sink.context == NULL) {
+	perror( optarg);
+	return 1;
+      }
+      break;
+    case 'a':
+      load_addr = strtoul( optarg, NULL, 0);
+      break;
+    case 'e':
+      entry = strtoul( optarg, NULL, 0);
+      break;
+    default:
+      usage( argv[0]);
+    }
+  }
+  if ( argc - optind > 1) {
+    usage( argv[0]);
+  }
+  if ( entry == 0) {
+    entry = load_addr;
+  }
+
+  if ( !initMemory_linux()) {
+    fprintf( stderr, "Cannot map main RAM at %08x\n", RAM_BASE_LINUX);
+    return 1;
+  }
+  if ( bench) {
+    benchmark_linux();
+    return 0;
+  }
+  if ( argc - optind == 1) {
+    if ( !loadImage( argv[optind], load_addr)) {
+      return 1;
+    }
+  }
+  else {
+    writeLoop( load_addr);
+  }
+
+  if ( use_pty) {
+    comms_data.read_fd = openPty();
+    comms_data.write_fd = comms_data.read_fd;
+    comms_data.reopen = 1;
+    if ( comms_data.read_fd < 0) {
+      return 1;
+    }
+  }
+  else {
+    comms_data.read_fd = STDIN_FILENO;
+    comms_data.write_fd = STDOUT_FILENO;
+    comms_data.reopen = 0;
+  }
+
+  signal( SIGINT, stopHandler);
+  signal( SIGTERM, stopHandler);
+  signal( SIGPIPE, SIG_IGN);
+  start_ns = nowNs_linux();
+  atexit( printStats);
+
+  if ( !init_debug( &fdCommsIf_linux, &comms_data)) {
+    fprintf( stderr, "Stub initialisation failed\n");
+    return 1;
+  }
+  if ( trace_sink.context != NULL) {
+    /* the file is flushed by exit() */
+    setTrace_debug( &trace_sink);
+  }
+
+  run_linux( entry);
+
+  return 0;
+}
@@ -3,11 +3,19 @@
  */
 /** \file
  * \brief The debug stub TCP network comms.
+ *
+ * Received data is moved from the socket into a ring buffer by the Timer 3
+ * interrupt that dswifi already needs, so the stub reads it from memory.
+ * The same interrupt accepts GDB's connection, so the application runs
+ * until GDB attaches. The socket never blocks, sends go round until dswifi
+ * has taken every byte.
  */
 #include <nds.h>
 
+#include <errno.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <dswifi9.h>
 #include <sys/socket.h>
@@ -22,11 +30,167 @@
 #define LOG( fmt, ...)
 #endif
 
+/** The size of the receive ring, must be a power of two */
+#define RX_RING_SIZE 2048
+
+/** The period of the Timer 3 interrupt dswifi is driven from, if the
+ * application does not give one */
+#define WIFI_TIMER_MS 50
+
+/** GDB's interrupt character */
+#define INTERRUPT_CHAR 0x03
+
+#ifdef TICK_TIMING
+/** The timer pair cpuStartTiming uses to measure the interrupt */
+#define TICK_TIMING_TIMER 0
+#endif
+
+
+/** \brief The receive ring, filled from the timer interrupt and emptied
+ * by the stub.
+ */
+struct rx_ring_tcp {
+  /** The received bytes */
+  uint8_t data[RX_RING_SIZE];
+
+  /** The count of bytes put in the ring, only changed by the filler */
+  volatile uint32_t head;
+
+  /** The count of bytes taken from the ring, only changed by the reader */
+  volatile uint32_t tail;
+
+  /** The ring statistics */
+  struct tcp_debug_comms_stats stats;
+};
+
+
 /** The Listening socket */
 static int listen_sock;
 
 /** The socket connected to GDB */
-static int gdb_socket;
+static int gdb_socket = -1;
+
+/** The instance of the receive ring */
+static struct rx_ring_tcp rx_ring;
+
+/** The period Timer 3 runs at */
+static uint32_t timer_ms = WIFI_TIMER_MS;
+
+/** The application's Timer 3 work, NULL if none */
+static void (*app_timer_fn)( void);
+
+
+/*
+ * Move whatever the socket has into the free space in the ring, asking the
+ * stub to stop the application if GDB's interrupt character is among it.
+ * Must not be interrupted by the timer interrupt.
+ */
+static void
+fillRing( void) {
+  uint32_t used;
+  int interrupt = 0;
+
+  if ( gdb_socket == -1) {
+    return;
+  }
+
+  used = rx_ring.head - rx_ring.tail;
+
+  while ( used < RX_RING_SIZE) {
+    uint32_t offset = rx_ring.head & (RX_RING_SIZE - 1);
+    uint32_t space = RX_RING_SIZE - used;
+    int read_len;
+
+    /* only up to the end of the ring in one go */
+    if ( space > RX_RING_SIZE - offset) {
+      space = RX_RING_SIZE - offset;
+    }
+
+    read_len = recv( gdb_socket, &rx_ring.data[offset], space, 0);
+    if ( read_len <= 0) {
+      break;
+    }
+
+    /* only the new bytes are looked at */
+    if ( memchr( &rx_ring.data[offset], INTERRUPT_CHAR, read_len) != NULL) {
+      interrupt = 1;
+    }
+
+    rx_ring.head += read_len;
+    used += read_len;
+  }
+
+  if ( interrupt) {
+    /* ignored while the stub is running */
+    interruptRequest_debug();
+  }
+
+  if ( used > rx_ring.stats.high_water) {
+    rx_ring.stats.high_water = used;
+  }
+  if ( used == RX_RING_SIZE) {
+    /* anything else stays in the socket until there is room */
+    rx_ring.stats.overruns += 1;
+  }
+}
+
+
+/*
+ * See if GDB has connected, if so the stub is asked to stop the application.
+ * Must not be interrupted by the timer interrupt.
+ */
+static void
+acceptGDB( void) {
+  struct sockaddr_in sain;
+  int addr_size = sizeof( sain);
+  int new_socket = accept( listen_sock, (struct sockaddr *)&sain, &addr_size);
+
+  if ( new_socket != -1) {
+    int temp_flag = 1;
+
+    /* reads happen in the interrupt, they must never wait */
+    ioctl( new_socket, FIONBIO, &temp_flag);
+
+    rx_ring.head = 0;
+    rx_ring.tail = 0;
+    gdb_socket = new_socket;
+
+    LOG( "GDB connected\n");
+    attachRequest_debug();
+  }
+}
+
+
+/*
+ * The Timer 3 interrupt, keeps dswifi going and does the application's
+ * work as its handler would, then looks for GDB or empties the socket into
+ * the ring.
+ */
+static void
+timerIRQ( void) {
+  Wifi_Timer( timer_ms);
+  if ( app_timer_fn != NULL) {
+    app_timer_fn();
+  }
+
+#ifdef TICK_TIMING
+  cpuStartTiming( TICK_TIMING_TIMER);
+#endif
+
+  if ( gdb_socket == -1) {
+    acceptGDB();
+  }
+  else {
+    fillRing();
+  }
+
+#ifdef TICK_TIMING
+  rx_ring.stats.tick_cycles = cpuEndTiming();
+  if ( rx_ring.stats.tick_cycles > rx_ring.stats.tick_cycles_max) {
+    rx_ring.stats.tick_cycles_max = rx_ring.stats.tick_cycles;
+  }
+#endif
+}
 
 /*
  * The initialisation function
@@ -35,14 +199,13 @@ static int
 init_fn( void *data __attribute__((unused))) {
   struct tcp_debug_comms_init_data *init_data =
     (struct tcp_debug_comms_init_data *)data;
-  int success_flag = 0;
 
   if ( init_data == NULL) {
     LOG("Have not been given initialisation data.\n");
     return 0;
   }
 
-  /* create the listening socket and wait for a connection */
+  /* create the listening socket, GDB is accepted by the timer interrupt */
   struct sockaddr_in sain;
 
   sain.sin_addr.s_addr = 0;
@@ -55,41 +218,64 @@ init_fn( void *data __attribute__((unused))) {
   ioctl( listen_sock, FIONBIO, &temp_flag);
   listen( listen_sock, 2);
 
-  LOG( "Waiting for GDB to connect\n");
-  do {
-    int addr_size = sizeof( sain);
-    gdb_socket = accept( listen_sock, (struct sockaddr *)&sain, &addr_size);
-  } while ( gdb_socket == -1);
+  LOG( "Listening for GDB\n");
+  gdb_socket = -1;
 
-  LOG( "GDB connected\n");
-  success_flag = 1;
+  /* the handler takes the place of the application's */
+  timer_ms = init_data->timer_ms != 0 ? init_data->timer_ms : WIFI_TIMER_MS;
+  app_timer_fn = init_data->timer_fn;
+  irqSet( IRQ_TIMER3, timerIRQ);
 
-  return success_flag;
+  return 1;
 }
 
 
 
+/*
+ * Send all count bytes. The socket does not block, so while dswifi has no
+ * room for more the wifi is kept going until the acks make some.
+ */
+static void
+sendAll( const uint8_t *buffer, uint32_t count) {
+  while ( count > 0 && gdb_socket != -1) {
+    int sent = send( gdb_socket, buffer, count, 0);
+
+    if ( sent > 0) {
+      buffer += sent;
+      count -= sent;
+    }
+    else if ( sent < 0 && errno == EWOULDBLOCK) {
+      Wifi_Update();
+    }
+    else {
+      LOG( "Send failed\n");
+      break;
+    }
+  }
+}
+
+
 static void
 writeByte_fn( uint8_t byte) {
   //LOG("Sending byte %02x %c\n", byte, byte);
-  send( gdb_socket, &byte, 1, 0);
+  sendAll( &byte, 1);
 }
 
 
 static void
 writeData_fn( uint8_t *buffer, uint32_t count) {
   //LOG("Sending byte %02x %c\n", byte, byte);
-  send( gdb_socket, buffer, count, 0);
+  sendAll( buffer, count);
 }
 
 static int
 readByte_fn( uint8_t *read_byte) {
   int read_good = 0;
-  int read_len;
+  uint32_t tail = rx_ring.tail;
 
-  read_len = recv( gdb_socket, read_byte, 1, 0);
-
-  if ( read_len == 1) {
+  if ( rx_ring.head != tail) {
+    *read_byte = rx_ring.data[tail & (RX_RING_SIZE - 1)];
+    rx_ring.tail = tail + 1;
     //LOG("TCP DEBUG read byte %02x %c\n", *read_byte, *read_byte);
     read_good = 1;
   }
@@ -97,10 +283,65 @@ readByte_fn( uint8_t *read_byte) {
   return read_good;
 }
 
+static int
+readData_fn( uint8_t *buffer, uint32_t max) {
+  uint32_t tail = rx_ring.tail;
+  uint32_t available = rx_ring.head - tail;
+  uint32_t offset = tail & (RX_RING_SIZE - 1);
+  uint32_t read_len;
+
+  if ( max > available) {
+    max = available;
+  }
+
+  /* copy up to the end of the ring then from the start */
+  read_len = RX_RING_SIZE - offset;
+  if ( read_len > max) {
+    read_len = max;
+  }
+  memcpy( buffer, &rx_ring.data[offset], read_len);
+  memcpy( &buffer[read_len], &rx_ring.data[0], max - read_len);
+
+  rx_ring.tail = tail + max;
+
+  return max;
+}
+
 
 static void
 poll_fn( void) {
-  /* The TCP socket is interrupt driven */
+  /* The ring is filled by the timer interrupt. If it has run dry fill it
+   * here as well in case interrupts are not getting through. */
+  if ( rx_ring.head == rx_ring.tail) {
+    uint16_t master_irq = REG_IME;
+
+    REG_IME = 0;
+    if ( gdb_socket == -1) {
+      acceptGDB();
+    }
+    else {
+      fillRing();
+    }
+    REG_IME = master_irq;
+  }
+}
+
+
+/* hang up on GDB, the timer interrupt goes back to accepting */
+static void
+disconnect_fn( void) {
+  uint16_t master_irq = REG_IME;
+
+  REG_IME = 0;
+  if ( gdb_socket != -1) {
+    closesocket( gdb_socket);
+    gdb_socket = -1;
+  }
+  rx_ring.head = 0;
+  rx_ring.tail = 0;
+  REG_IME = master_irq;
+
+  LOG( "GDB disconnected\n");
 }
 
 
@@ -111,6 +352,17 @@ irqs_fn( void) {
 }
 
 
+/* read the receive ring statistics */
+void
+getStats_tcp( struct tcp_debug_comms_stats *stats) {
+  uint16_t master_irq = REG_IME;
+
+  REG_IME = 0;
+  *stats = rx_ring.stats;
+  REG_IME = master_irq;
+}
+
+
 /** The instance of the comms function interface */
 struct comms_fn_iface_debug tcpCommsIf_debug = {
   .init_fn = init_fn,
@@ -123,6 +375,10 @@ struct comms_fn_iface_debug tcpCommsIf_debug = {
 
   .poll_fn = poll_fn,
 
-  .get_IRQs = irqs_fn
+  .get_IRQs = irqs_fn,
+
+  .readData_fn = readData_fn,
+
+  .disconnect_fn = disconnect_fn
 };
 
@@ -0,0 +1,517 @@
+/** \file
+ * \brief Time the stub's packet layer on the host.
+ *
+ * debug_comms.c is built with the host compiler and given a comms interface
+ * on one end of a socketpair. A child process on the other end stands in
+ * for GDB, sending packets as fast as the socket takes them. The packets are
+ * read a block at a time (readData_fn), then a byte per call as every read
+ * was before readData_fn (a tenth as many), for:
+ *  - 'load' sized packets, M writes of 1000 bytes
+ *  - small requests, m reads of 256 bytes
+ * The stub's acks are thrown away.
+ *
+ * Replies go the other way: 256KB of random memory is read back the way
+ * the stub answers GDB's 'm' (hex) and 'x' (binary) reads, each reply about
+ * 2KB on the wire, encoded by putSegments_comms as it is sent to a comms
+ * interface that counts the bytes and drops them, so that the rate is the
+ * stub's own cost. The fastest of ten rounds and the bytes on the wire per
+ * byte of memory are reported for each.
+ *
+ * Last, the codec is timed converting 64KB each way against the loops the
+ * stub used before it (hex(), mem2hex, hex2mem, mem2bin and bin2mem, with
+ * their per-byte address check).
+ *
+ * usage: comms_bench [-n packets]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "debug_stub.h"
+#include "debug_comms.h"
+#include "hex_codec.h"
+#include "debug_platform.h"
+
+/** The default number of packets received a block at a time */
+#define DEFAULT_COUNT 20000
+
+/** The bytes an M packet writes */
+#define WRITE_LENGTH 1000
+
+/** The memory read back by the reply benchmark */
+#define READ_SIZE (256 * 1024)
+
+/** The times the memory is read back, the fastest is reported */
+#define REPLY_ROUNDS 10
+
+/** The size of the stub's reply buffer */
+#define REPLY_SIZE 2048
+
+/** The memory converted by the codec benchmark */
+#define CODEC_SIZE (64 * 1024)
+
+/** The times the codec benchmark converts it */
+#define CODEC_ROUNDS 200
+
+
+/** The stub's end of the socketpair */
+static int stub_sock;
+
+/** The packet buffer handed to the packet layer */
+static uint8_t in_buffer[4096];
+
+/** The bytes written to the comms interface */
+static uint64_t wire_bytes;
+
+
+/** Return the time in nanoseconds. */
+static uint64_t
+nowNs( void) {
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/*
+ * The comms interface, reading the socketpair
+ */
+static int
+readByte( uint8_t *byte) {
+  return recv( stub_sock, byte, 1, 0) == 1;
+}
+
+static int
+readData( uint8_t *buffer, uint32_t max) {
+  int count = recv( stub_sock, buffer, max, 0);
+
+  return count > 0 ? count : 0;
+}
+
+static void
+writeByte( uint8_t byte __attribute__((unused))) {
+}
+
+/* acks and replies are counted and thrown away */
+static void
+writeData( uint8_t *buffer __attribute__((unused)), uint32_t count) {
+  wire_bytes += count;
+}
+
+static struct comms_fn_iface_debug bench_comms = {
+  NULL, readByte, writeByte, writeData, NULL, NULL, readData
+};
+
+
+/** The packet layer waits here for a background write, there are none. */
+void
+finishCopy_platform( void) {
+}
+
+
+/** Make a packet of text, returning its length. */
+static uint32_t
+makePacket( char *packet, const char *text) {
+  uint8_t checksum = 0;
+  uint32_t i;
+
+  for ( i = 0; text[i] != '\0'; i++) {
+    checksum += text[i];
+  }
+
+  return sprintf( packet, "$%s#%02x", text, checksum);
+}
+
+
+/** Start a child sending count copies of packet to the stub's end. */
+static pid_t
+startSender( int sock, const char *packet, uint32_t length, uint32_t count) {
+  pid_t pid = fork();
+
+  if ( pid == 0) {
+    uint32_t i;
+
+    for ( i = 0; i < count; i++) {
+      uint32_t done = 0;
+
+      while ( done < length) {
+	ssize_t sent = send( sock, packet + done, length - done, 0);
+
+	if ( sent <= 0) {
+	  _exit( 1);
+	}
+	done += sent;
+      }
+    }
+    _exit( 0);
+  }
+
+  return pid;
+}
+
+
+/** Receive count copies of the packet, returning the packets per second. */
+static double
+receiveRate( const char *text, uint32_t count) {
+  static char packet[2 * WRITE_LENGTH + 64];
+  uint32_t length = makePacket( packet, text);
+  int pair[2];
+  pid_t sender;
+  uint64_t start;
+  uint64_t took;
+  uint32_t i;
+
+  socketpair( AF_UNIX, SOCK_STREAM, 0, pair);
+  stub_sock = pair[0];
+  sender = startSender( pair[1], packet, length, count);
+  close( pair[1]);
+
+  start = nowNs();
+  for ( i = 0; i < count; i++) {
+    uint32_t data_length;
+    uint8_t *data = getPacket_comms( &bench_comms, &data_length);
+
+    if ( data_length != strlen( text) || data[0] != text[0]) {
+      fprintf( stderr, "Packet %u came out wrong\n", i);
+      exit( 1);
+    }
+  }
+  took = nowNs() - start;
+
+  waitpid( sender, NULL, 0);
+  close( stub_sock);
+
+  return count * 1e9 / took;
+}
+
+
+/** Time receiving the packet a block and a byte at a time. */
+static void
+benchReceive( const char *what, const char *text, uint32_t count) {
+  double block_rate;
+  double byte_rate;
+
+  bench_comms.readData_fn = readData;
+  block_rate = receiveRate( text, count);
+  bench_comms.readData_fn = NULL;
+  byte_rate = receiveRate( text, count / 10);
+
+  printf( "%-18s block %8.0f packets/s, byte %8.0f packets/s, %.1fx\n", what,
+	  block_rate, byte_rate, block_rate / byte_rate);
+}
+
+
+/** Read the memory back as 'm' (binary 0) or 'x' (binary 1) replies,
+ * returning the bytes of memory per second. */
+static double
+replyOnce( const uint8_t *memory, int binary) {
+  struct segment_comms segments[2];
+  uint32_t done = 0;
+  uint64_t start;
+  uint64_t took;
+
+  wire_bytes = 0;
+
+  start = nowNs();
+  while ( done < READ_SIZE) {
+    /* the memory GDB asks for at a time, so that a reply fills the buffer */
+    uint32_t length = binary ? REPLY_SIZE - 5 : (REPLY_SIZE - 4) / 2;
+
+    if ( length > READ_SIZE - done) {
+      length = READ_SIZE - done;
+    }
+    if ( binary) {
+      segments[0].encoding = RAW_SEGMENT;
+      segments[0].data = (const uint8_t *)"b";
+      segments[0].length = 1;
+      segments[1].encoding = BIN_SEGMENT;
+      segments[1].data = &memory[done];
+      segments[1].length = length;
+      putSegments_comms( &bench_comms, segments, 2);
+    }
+    else {
+      segments[0].encoding = HEX_SEGMENT;
+      segments[0].data = &memory[done];
+      segments[0].length = length;
+      putSegments_comms( &bench_comms, segments, 1);
+    }
+    done += length;
+  }
+  took = nowNs() - start;
+
+  return READ_SIZE * 1e9 / took;
+}
+
+
+/** Return the fastest of REPLY_ROUNDS reads of the memory. */
+static double
+replyRate( const uint8_t *memory, int binary) {
+  double best = 0.0;
+  int i;
+
+  for ( i = 0; i < REPLY_ROUNDS; i++) {
+    double rate = replyOnce( memory, binary);
+
+    if ( rate > best) {
+      best = rate;
+    }
+  }
+
+  return best;
+}
+
+
+/** Time reading memory back with 'm' and with 'x'. */
+static void
+benchReplies( void) {
+  static uint8_t memory[READ_SIZE];
+  double hex_rate;
+  double binary_rate;
+  uint64_t hex_wire;
+  uint32_t i;
+
+  srand( 1);
+  for ( i = 0; i < READ_SIZE; i++) {
+    memory[i] = rand();
+  }
+
+  setNoAckMode_comms( 1);
+  hex_rate = replyRate( memory, 0);
+  hex_wire = wire_bytes;
+  binary_rate = replyRate( memory, 1);
+
+  printf( "m reads of 256KB   %8.0f KB/s, %.2f bytes sent per byte\n",
+	  hex_rate / 1024, (double)hex_wire / READ_SIZE);
+  printf( "x reads of 256KB   %8.0f KB/s, %.2f bytes sent per byte, %.1fx m\n",
+	  binary_rate / 1024, (double)wire_bytes / READ_SIZE, binary_rate / hex_rate);
+}
+
+
+/*
+ * The conversions as the stub did them before hex_codec.c
+ */
+static inline int
+memAddrCheck( const uint8_t *addr) {
+  return (uintptr_t)addr >= 0x01000000;
+}
+
+static int
+hex( unsigned char ch) {
+  if ( ch >= 'a' && ch <= 'f')
+    return ch - 'a' + 10;
+  if ( ch >= '0' && ch <= '9')
+    return ch - '0';
+  if ( ch >= 'A' && ch <= 'F')
+    return ch - 'A' + 10;
+  return -1;
+}
+
+static uint8_t *
+mem2hex( const uint8_t *mem, uint8_t *buf, int count) {
+  while ( count-- > 0) {
+    uint8_t ch = 0;
+
+    if ( memAddrCheck( mem)) {
+      ch = *mem++;
+    }
+    *buf++ = hexchars[ch >> 4];
+    *buf++ = hexchars[ch & 0xf];
+  }
+
+  return buf;
+}
+
+static uint8_t *
+hex2mem( const uint8_t *buf, uint8_t *mem, int count) {
+  int i;
+
+  for ( i = 0; i < count; i++) {
+    uint8_t ch = hex( *buf++) << 4;
+
+    ch |= hex( *buf++);
+    if ( memAddrCheck( mem)) {
+      *mem++ = ch;
+    }
+  }
+
+  return mem;
+}
+
+static uint8_t *
+mem2bin( const uint8_t *mem, uint8_t *buf, const uint8_t *buf_end, int count) {
+  while ( count-- > 0 && buf_end - buf >= 2) {
+    uint8_t ch = 0;
+
+    if ( memAddrCheck( mem)) {
+      ch = *mem++;
+    }
+    if ( ch == '#' || ch == '$' || ch == 0x7d || ch == '*') {
+      *buf++ = 0x7d;
+      ch ^= 0x20;
+    }
+    *buf++ = ch;
+  }
+
+  return buf;
+}
+
+static uint8_t *
+bin2mem( const uint8_t *buf, const uint8_t *end, uint8_t *mem, int count) {
+  int escaped = 0;
+  int i;
+
+  for ( i = 0; i < count;) {
+    uint8_t cur_byte;
+
+    if ( buf >= end) {
+      return NULL;
+    }
+    cur_byte = *buf++;
+    if ( escaped) {
+      cur_byte ^= 0x20;
+      escaped = 0;
+    }
+    else if ( cur_byte == 0x7d) {
+      escaped = 1;
+    }
+    if ( !escaped) {
+      i += 1;
+      if ( memAddrCheck( mem)) {
+	*mem++ = cur_byte;
+      }
+    }
+  }
+
+  return mem;
+}
+
+
+/** Report the MB/s of the old loop and the codec over took_old and took_new. */
+static void
+reportCodec( const char *what, uint64_t took_old, uint64_t took_new) {
+  double bytes = (double)CODEC_SIZE * CODEC_ROUNDS;
+
+  printf( "%-18s old %8.0f MB/s, codec %8.0f MB/s, %.1fx\n", what,
+	  bytes * 1e3 / took_old, bytes * 1e3 / took_new, (double)took_old / took_new);
+}
+
+
+/** Time the codec against the old loops, checking they agree. */
+static void
+benchCodec( void) {
+  static uint8_t memory[CODEC_SIZE];
+  static uint8_t copy[CODEC_SIZE];
+  static uint8_t hex_text[2 * CODEC_SIZE];
+  static uint8_t bin_text[2 * CODEC_SIZE + 2];
+  uint8_t *bin_end = NULL;
+  uint64_t start;
+  uint64_t took_old;
+  uint64_t took_new;
+  uint32_t count;
+  int i;
+
+  for ( i = 0; i < CODEC_SIZE; i++) {
+    memory[i] = rand();
+  }
+
+  start = nowNs();
+  for ( i = 0; i < CODEC_ROUNDS; i++) {
+    mem2hex( memory, hex_text, CODEC_SIZE);
+  }
+  took_old = nowNs() - start;
+  start = nowNs();
+  for ( i = 0; i < CODEC_ROUNDS; i++) {
+    encodeHex_codec( hex_text, memory, CODEC_SIZE);
+  }
+  took_new = nowNs() - start;
+  reportCodec( "encode hex", took_old, took_new);
+
+  start = nowNs();
+  for ( i = 0; i < CODEC_ROUNDS; i++) {
+    hex2mem( hex_text, copy, CODEC_SIZE);
+  }
+  took_old = nowNs() - start;
+  start = nowNs();
+  for ( i = 0; i < CODEC_ROUNDS; i++) {
+    decodeHex_codec( copy, hex_text, CODEC_SIZE);
+  }
+  took_new = nowNs() - start;
+  reportCodec( "decode hex", took_old, took_new);
+  if ( memcmp( copy, memory, CODEC_SIZE) != 0) {
+    fprintf( stderr, "The hex came back wrong\n");
+    exit( 1);
+  }
+
+  start = nowNs();
+  for ( i = 0; i < CODEC_ROUNDS; i++) {
+    bin_end = mem2bin( memory, bin_text, &bin_text[sizeof( bin_text)], CODEC_SIZE);
+  }
+  took_old = nowNs() - start;
+  start = nowNs();
+  for ( i = 0; i < CODEC_ROUNDS; i++) {
+    count = CODEC_SIZE;
+    bin_end = escapeBin_codec( bin_text, &bin_text[sizeof( bin_text)], memory, &count);
+  }
+  took_new = nowNs() - start;
+  reportCodec( "escape binary", took_old, took_new);
+
+  start = nowNs();
+  for ( i = 0; i < CODEC_ROUNDS; i++) {
+    bin2mem( bin_text, bin_end, copy, CODEC_SIZE);
+  }
+  took_old = nowNs() - start;
+  start = nowNs();
+  for ( i = 0; i < CODEC_ROUNDS; i++) {
+    unescapeBin_codec( copy, bin_text, bin_end, CODEC_SIZE);
+  }
+  took_new = nowNs() - start;
+  reportCodec( "unescape binary", took_old, took_new);
+  if ( memcmp( copy, memory, CODEC_SIZE) != 0) {
+    fprintf( stderr, "The binary came back wrong\n");
+    exit( 1);
+  }
+}
+
+
+int
+main( int argc, char **argv) {
+  static char text[2 * WRITE_LENGTH + 32];
+  uint32_t count = DEFAULT_COUNT;
+  int opt;
+  int header;
+  int i;
+
+  while ( (opt = getopt( argc, argv, "n:")) != -1) {
+    switch ( opt) {
+    case 'n':
+      count = atoi( optarg);
+      break;
+    default:
+      fprintf( stderr, "usage: %s [-n packets]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  signal( SIGPIPE, SIG_IGN);
+  setBuffer_comms( in_buffer, sizeof( in_buffer));
+
+  header = sprintf( text, "M2000000,%x:", WRITE_LENGTH);
+  for ( i = header; i < header + 2 * WRITE_LENGTH; i++) {
+    text[i] = "0123456789abcdef"[rand() & 0xf];
+  }
+  text[i] = '\0';
+  benchReceive( "M writes of 1000", text, count);
+  benchReceive( "m reads of 256", "m2000000,100", count);
+  benchReplies();
+  benchCodec();
+
+  return 0;
+}
@@ -0,0 +1,132 @@
+/** \file
+ * \brief Check the stub's qCRC CRC-32 against the one GDB works out.
+ *
+ * GDB's compare-sections takes the CRC of the ELF sections with
+ * libiberty's xcrc32, starting from 0xffffffff with no final inversion,
+ * and compares it with the stub's reply. The known values below are
+ * xcrc32's. Data of every length and alignment up to a few hundred bytes is
+ * also checked against the CRC worked out a bit at a time, whole and split
+ * in two.
+ *
+ * usage: crc_check
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crc32.h"
+
+/** The longest data checked bit by bit */
+#define MAX_LENGTH 300
+
+
+/** \brief A CRC xcrc32 gives.
+ */
+struct known_crc {
+  /** The data */
+  const char *data;
+
+  /** Its length, which may include NULs */
+  uint32_t length;
+
+  /** The value started from */
+  uint32_t start;
+
+  /** xcrc32's CRC */
+  uint32_t crc;
+};
+
+
+static const struct known_crc known[] = {
+  { "", 0, START_CRC, 0xffffffff },
+  { "123456789", 9, START_CRC, 0x0376e6e7 },
+  { "a", 1, START_CRC, 0xe66c6494 },
+  { "The quick brown fox jumps over the lazy dog", 43, START_CRC, 0xba62119e },
+  { "123456789", 9, 0, 0x89a1897f }
+};
+
+
+/** The CRC worked out from its definition, a bit at a time. */
+static uint32_t
+bitCrc( uint32_t crc, const uint8_t *data, uint32_t length) {
+  uint32_t i;
+
+  for ( i = 0; i < length; i++) {
+    int bit;
+
+    crc ^= (uint32_t)data[i] << 24;
+    for ( bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+    }
+  }
+
+  return crc;
+}
+
+
+/** Check one CRC, printing it if it is wrong. Returns 1 if it is right. */
+static int
+check( const char *what, uint32_t length, uint32_t got, uint32_t expected) {
+  if ( got != expected) {
+    printf( "%s of %u bytes: %08x, expected %08x\n", what, length, got, expected);
+    return 0;
+  }
+
+  return 1;
+}
+
+
+int
+main( void) {
+  uint8_t data[MAX_LENGTH + 4];
+  uint8_t block[256];
+  uint32_t checked = 0;
+  uint32_t failed = 0;
+  uint32_t i;
+
+  init_crc();
+
+  for ( i = 0; i < sizeof( known) / sizeof( known[0]); i++) {
+    checked += 1;
+    failed += !check( "known", known[i].length,
+		      update_crc( known[i].start, (const uint8_t *)known[i].data, known[i].length),
+		      known[i].crc);
+  }
+
+  /* 64 zeros, 64 0xff and every byte value */
+  memset( block, 0, 64);
+  failed += !check( "zeros", 64, update_crc( START_CRC, block, 64), 0x93394e51);
+  memset( block, 0xff, 64);
+  failed += !check( "ones", 64, update_crc( START_CRC, block, 64), 0xa21e790f);
+  for ( i = 0; i < 256; i++) {
+    block[i] = i;
+  }
+  failed += !check( "bytes", 256, update_crc( START_CRC, block, 256), 0x494a116a);
+  checked += 3;
+
+  srand( 1);
+  for ( i = 0; i < sizeof( data); i++) {
+    data[i] = rand();
+  }
+
+  for ( i = 0; i <= MAX_LENGTH; i++) {
+    uint32_t align;
+
+    for ( align = 0; align < 4; align++) {
+      const uint8_t *start = &data[align];
+      uint32_t expected = bitCrc( START_CRC, start, i);
+      uint32_t split = i / 3;
+
+      failed += !check( "whole", i, update_crc( START_CRC, start, i), expected);
+      failed += !check( "split", i,
+			update_crc( update_crc( START_CRC, start, split), start + split, i - split),
+			expected);
+      checked += 2;
+    }
+  }
+
+  printf( "%u of %u CRCs match xcrc32\n", checked - failed, checked);
+
+  return failed != 0;
+}
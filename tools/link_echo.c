@@ -0,0 +1,310 @@
+/** \file
+ * \brief Compare the round trips of the UDP link and a TCP connection.
+ *
+ * A stand-in for the DS end of the comms that echoes the stream back, and a
+ * client that times exchanges through it the way GDB steps: one packet the
+ * size of a stop reply out, wait for it all to come back, repeat.
+ *
+ *  -u port  run the DS end of a udp_link on a UDP port, as udp_comms does,
+ *           for udp_bridge (with its loss and delay options) to connect to
+ *  -t port  echo on a loopback TCP port instead, as tcp_comms carries the
+ *           stream
+ *  -c host:port  connect to the bridge or the TCP echo and time count
+ *           (-n, default 2000) exchanges
+ *
+ * For example:
+ *   link_echo -u 7777 &
+ *   udp_bridge -p 2331 127.0.0.1 7777 &
+ *   link_echo -c 127.0.0.1:2331
+ *   link_echo -t 2332 &
+ *   link_echo -c 127.0.0.1:2332
+ *
+ * usage: link_echo -u udp_port | -t tcp_port | [-n count] -c host:port
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "udp_link.h"
+#include "rsp_host.h"
+
+/** The interval the link is ticked at, as the bridge does */
+#define TICK_MS 5
+
+/** The default number of exchanges timed */
+#define DEFAULT_COUNT 2000
+
+/** The exchanges made before the timing starts */
+#define WARM_UP 50
+
+/** A stop reply for a step, the size of what the stub sends */
+static const char step_packet[] =
+  "$T050d:f8ff7f02;0e:2c010002;0f:30010002;thread:1;#9c";
+
+
+/** Return the time in milliseconds. */
+static uint32_t
+nowMs( void) {
+  return nowNs_host() / 1000000;
+}
+
+
+/** \brief The DS end of the UDP link.
+ */
+struct udp_echo {
+  /** The UDP socket */
+  int sock;
+
+  /** The bridge's address */
+  struct sockaddr_in peer;
+
+  /** Flag set once the bridge has said hello */
+  int have_peer;
+
+  /** The link */
+  struct udp_link link;
+};
+
+
+/** The link send function. */
+static void
+sendDatagram( void *context, const uint8_t *data, uint32_t length) {
+  struct udp_echo *echo = context;
+
+  sendto( echo->sock, data, length, 0,
+	  (struct sockaddr *)&echo->peer, sizeof( echo->peer));
+}
+
+
+/** Hand the link the datagrams waiting, as the DS timer interrupt does. */
+static void
+serviceLink( struct udp_echo *echo) {
+  uint8_t datagram[LINK_HEADER_SIZE + LINK_MAX_PAYLOAD];
+
+  while ( 1) {
+    struct sockaddr_in from;
+    socklen_t from_size = sizeof( from);
+    ssize_t length = recvfrom( echo->sock, datagram, sizeof( datagram), MSG_DONTWAIT,
+			       (struct sockaddr *)&from, &from_size);
+
+    if ( length <= 0) {
+      break;
+    }
+    if ( datagram[0] == HELLO_LINK) {
+      echo->peer = from;
+      echo->have_peer = 1;
+    }
+    else if ( !echo->have_peer) {
+      continue;
+    }
+    receive_link( &echo->link, datagram, length, nowMs());
+  }
+
+  if ( echo->have_peer) {
+    tick_link( &echo->link, nowMs());
+  }
+}
+
+
+/** Echo what the bridge sends for ever. */
+static int
+runUdp( int port) {
+  static struct udp_echo echo;
+  struct sockaddr_in sain;
+
+  echo.sock = socket( AF_INET, SOCK_DGRAM, 0);
+  memset( &sain, 0, sizeof( sain));
+  sain.sin_family = AF_INET;
+  sain.sin_port = htons( port);
+  sain.sin_addr.s_addr = htonl( INADDR_LOOPBACK);
+  if ( bind( echo.sock, (struct sockaddr *)&sain, sizeof( sain)) < 0) {
+    perror( "bind");
+    return 1;
+  }
+  init_link( &echo.link, sendDatagram, &echo);
+
+  while ( 1) {
+    struct pollfd pfd = { echo.sock, POLLIN, 0 };
+    uint8_t buffer[LINK_RING_SIZE];
+    uint32_t length;
+
+    poll( &pfd, 1, TICK_MS);
+    serviceLink( &echo);
+
+    while ( (length = readData_link( &echo.link, buffer, sizeof( buffer))) > 0) {
+      uint32_t done = 0;
+
+      while ( done < length) {
+	done += writeData_link( &echo.link, &buffer[done], length - done, nowMs());
+	if ( done < length) {
+	  /* the window is full, wait for acks */
+	  poll( &pfd, 1, TICK_MS);
+	  serviceLink( &echo);
+	}
+      }
+      flush_link( &echo.link, nowMs());
+    }
+  }
+
+  return 0;
+}
+
+
+/** Echo each TCP connection until it closes. */
+static int
+runTcp( int port) {
+  int listen_sock = listen_host( port);
+  int one = 1;
+
+  if ( listen_sock < 0) {
+    return 1;
+  }
+
+  while ( 1) {
+    int sock = accept( listen_sock, NULL, NULL);
+    uint8_t buffer[4096];
+    ssize_t length;
+
+    if ( sock < 0) {
+      perror( "accept");
+      return 1;
+    }
+    setsockopt( sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one));
+
+    while ( (length = recv( sock, buffer, sizeof( buffer), 0)) > 0) {
+      if ( !sendAll_host( sock, buffer, length)) {
+	break;
+      }
+    }
+    close( sock);
+  }
+
+  return 0;
+}
+
+
+/** Make one exchange. Returns 0 if the connection has closed. */
+static int
+exchange( int sock) {
+  uint8_t buffer[sizeof( step_packet)];
+  uint32_t length = sizeof( step_packet) - 1;
+  uint32_t got = 0;
+
+  if ( !sendAll_host( sock, (const uint8_t *)step_packet, length)) {
+    return 0;
+  }
+  while ( got < length) {
+    ssize_t read_len = recv( sock, &buffer[got], length - got, 0);
+
+    if ( read_len <= 0) {
+      return 0;
+    }
+    got += read_len;
+  }
+
+  return memcmp( buffer, step_packet, length) == 0;
+}
+
+
+/** Time count exchanges and report them. */
+static int
+runClient( const char *address, uint32_t count) {
+  int sock = connect_host( address);
+  uint64_t start;
+  uint64_t slowest = 0;
+  uint64_t total;
+  uint32_t i;
+
+  if ( sock < 0) {
+    return 1;
+  }
+
+  for ( i = 0; i < WARM_UP; i++) {
+    if ( !exchange( sock)) {
+      fprintf( stderr, "The echo failed\n");
+      return 1;
+    }
+  }
+
+  start = nowNs_host();
+  for ( i = 0; i < count; i++) {
+    uint64_t sent = nowNs_host();
+    uint64_t took;
+
+    if ( !exchange( sock)) {
+      fprintf( stderr, "The echo failed\n");
+      return 1;
+    }
+    took = nowNs_host() - sent;
+    if ( took > slowest) {
+      slowest = took;
+    }
+  }
+  total = nowNs_host() - start;
+  close( sock);
+
+  printf( "%u exchanges of %u bytes: %.0f/s, average %.1fus, slowest %.1fus\n",
+	  count, (uint32_t)sizeof( step_packet) - 1, count * 1e9 / total,
+	  total / 1e3 / count, slowest / 1e3);
+
+  return 0;
+}
+
+
+static void
+usage( const char *name) {
+  fprintf( stderr, "usage: %s -u udp_port | -t tcp_port | [-n count] -c host:port\n", name);
+  exit( 1);
+}
+
+
+int
+main( int argc, char **argv) {
+  uint32_t count = DEFAULT_COUNT;
+  int udp_port = 0;
+  int tcp_port = 0;
+  const char *address = NULL;
+  int opt;
+
+  while ( (opt = getopt( argc, argv, "u:t:c:n:")) != -1) {
+    switch ( opt) {
+    case 'u':
+      udp_port = atoi( optarg);
+      break;
+    case 't':
+      tcp_port = atoi( optarg);
+      break;
+    case 'c':
+      address = optarg;
+      break;
+    case 'n':
+      count = atoi( optarg);
+      break;
+    default:
+      usage( argv[0]);
+    }
+  }
+
+  signal( SIGPIPE, SIG_IGN);
+
+  if ( udp_port != 0) {
+    return runUdp( udp_port);
+  }
+  if ( tcp_port != 0) {
+    return runTcp( tcp_port);
+  }
+  if ( address != NULL) {
+    return runClient( address, count);
+  }
+  usage( argv[0]);
+
+  return 1;
+}
@@ -0,0 +1,125 @@
+/** \file
+ * \brief A cache of target memory and registers, valid while the
+ * application is stopped.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "rsp_cache.h"
+
+
+/** Return the line an address would be held in. */
+static struct line_cache *
+lineOf( struct rsp_cache *cache, uint32_t addr) {
+  return &cache->lines[(addr / LINE_SIZE_CACHE) % LINE_COUNT_CACHE];
+}
+
+
+/* forget everything */
+void
+clear_cache( struct rsp_cache *cache) {
+  int i;
+
+  for ( i = 0; i < LINE_COUNT_CACHE; i++) {
+    cache->lines[i].valid = 0;
+  }
+  cache->register_length = 0;
+}
+
+
+/* copy out memory if all of it is held */
+int
+read_cache( struct rsp_cache *cache, uint32_t addr, uint32_t length, uint8_t *data) {
+  uint32_t done = 0;
+
+  /* check first so nothing is copied for a miss */
+  while ( done < length) {
+    uint32_t line_addr = (addr + done) & ~(LINE_SIZE_CACHE - 1);
+    struct line_cache *line = lineOf( cache, line_addr);
+
+    if ( !line->valid || line->addr != line_addr) {
+      return 0;
+    }
+    done += LINE_SIZE_CACHE - ((addr + done) & (LINE_SIZE_CACHE - 1));
+  }
+
+  done = 0;
+  while ( done < length) {
+    uint32_t offset = (addr + done) & (LINE_SIZE_CACHE - 1);
+    uint32_t count = LINE_SIZE_CACHE - offset;
+    struct line_cache *line = lineOf( cache, addr + done);
+
+    if ( count > length - done) {
+      count = length - done;
+    }
+    memcpy( &data[done], &line->data[offset], count);
+    done += count;
+  }
+
+  return 1;
+}
+
+
+/* hold the whole lines of a read */
+void
+fill_cache( struct rsp_cache *cache, uint32_t addr, const uint8_t *data, uint32_t length) {
+  uint32_t skip = (LINE_SIZE_CACHE - (addr & (LINE_SIZE_CACHE - 1))) & (LINE_SIZE_CACHE - 1);
+
+  if ( skip >= length) {
+    return;
+  }
+  addr += skip;
+  data += skip;
+  length -= skip;
+
+  while ( length >= LINE_SIZE_CACHE) {
+    struct line_cache *line = lineOf( cache, addr);
+
+    line->addr = addr;
+    line->valid = 1;
+    memcpy( line->data, data, LINE_SIZE_CACHE);
+    addr += LINE_SIZE_CACHE;
+    data += LINE_SIZE_CACHE;
+    length -= LINE_SIZE_CACHE;
+  }
+}
+
+
+/* keep the lines held up to date with a write */
+void
+write_cache( struct rsp_cache *cache, uint32_t addr, const uint8_t *data, uint32_t length) {
+  uint32_t done = 0;
+
+  while ( done < length) {
+    uint32_t offset = (addr + done) & (LINE_SIZE_CACHE - 1);
+    uint32_t count = LINE_SIZE_CACHE - offset;
+    struct line_cache *line = lineOf( cache, addr + done);
+
+    if ( count > length - done) {
+      count = length - done;
+    }
+    if ( line->valid && line->addr == addr + done - offset) {
+      memcpy( &line->data[offset], &data[done], count);
+    }
+    done += count;
+  }
+}
+
+
+/* forget the lines overlapping a range */
+void
+invalidate_cache( struct rsp_cache *cache, uint32_t addr, uint32_t length) {
+  uint32_t line_addr = addr & ~(LINE_SIZE_CACHE - 1);
+
+  while ( length > 0 && line_addr < addr + length) {
+    struct line_cache *line = lineOf( cache, line_addr);
+
+    if ( line->addr == line_addr) {
+      line->valid = 0;
+    }
+    line_addr += LINE_SIZE_CACHE;
+    if ( line_addr == 0) {
+      break;
+    }
+  }
+}
@@ -0,0 +1,74 @@
+#ifndef _RSP_CACHE_H_
+#define _RSP_CACHE_H_ 1
+/** \file
+ * \brief A cache of target memory and registers, valid while the
+ * application is stopped.
+ *
+ * Memory is held in aligned lines in a direct mapped table, a line is only
+ * ever held whole. The registers are held as GDB's 'g' reply.
+ */
+#include <stdint.h>
+
+/** The size of a line, fills are made of whole lines */
+#define LINE_SIZE_CACHE 64
+
+/** The number of lines held */
+#define LINE_COUNT_CACHE 4096
+
+/** The longest 'g' reply held */
+#define MAX_REGISTERS_CACHE 1024
+
+
+/** \brief A line of target memory.
+ */
+struct line_cache {
+  /** The address of the line */
+  uint32_t addr;
+
+  /** Flag set if the line holds memory */
+  int valid;
+
+  /** The memory */
+  uint8_t data[LINE_SIZE_CACHE];
+};
+
+
+/** \brief The cache.
+ */
+struct rsp_cache {
+  /** The memory lines */
+  struct line_cache lines[LINE_COUNT_CACHE];
+
+  /** The 'g' reply */
+  uint8_t registers[MAX_REGISTERS_CACHE];
+
+  /** The length of the 'g' reply, 0 if it is not held */
+  uint32_t register_length;
+};
+
+
+/** Forget everything, the application has run. */
+void
+clear_cache( struct rsp_cache *cache);
+
+
+/** Copy memory out of the cache. Returns 0 unless all of it is held. */
+int
+read_cache( struct rsp_cache *cache, uint32_t addr, uint32_t length, uint8_t *data);
+
+
+/** Hold memory read from the target. Only the whole lines in it are kept. */
+void
+fill_cache( struct rsp_cache *cache, uint32_t addr, const uint8_t *data, uint32_t length);
+
+
+/** Update the lines held with memory written to the target. */
+void
+write_cache( struct rsp_cache *cache, uint32_t addr, const uint8_t *data, uint32_t length);
+
+
+/** Forget the lines overlapping a range. */
+void
+invalidate_cache( struct rsp_cache *cache, uint32_t addr, uint32_t length);
+
+#endif /* End of _RSP_CACHE_H_ */
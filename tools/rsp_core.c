@@ -0,0 +1,375 @@
+/** \file
+ * \brief Fetch a core dump from a stub and unpack it for 'gdb -c'.
+ *
+ * The dump is read with qXfer:core:read:: and unpacked as it arrives (the
+ * format is in debugstub/source/core_dump.h), then the stub is detached.
+ * The core file has the ARM Linux register note, so GDB needs the ARM
+ * GNU/Linux ABI to find the registers ('set osabi GNU/Linux' before
+ * 'core-file' in gdb-multiarch).
+ *
+ * usage: rsp_core [-c command | -t host:port] core
+ *  -c runs the command with its stdin/stdout on a socketpair, as GDB's
+ *     'target remote |' does (e.g. linux_stub/linux_stub)
+ *  -t connects to a stub (or udp_bridge) over TCP
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "core_dump.h"
+#include "rsp_host.h"
+
+/** The most asked for in one read, the stub sends less if its packets
+ * are smaller */
+#define READ_SIZE 0x4000
+
+
+/** \brief The connection to the stub.
+ */
+struct target {
+  /** The socket */
+  int sock;
+
+  /** Bytes received and not yet used */
+  uint8_t buffer[65536];
+
+  /** The number of bytes in the buffer */
+  uint32_t length;
+
+  /** The bytes received */
+  uint64_t bytes_in;
+};
+
+
+/** \brief The dump as it is unpacked.
+ */
+struct unpacker {
+  /** The packed bytes not yet unpacked, less than a whole block */
+  uint8_t pending[4 + BLOCK_SIZE_CORE];
+
+  /** The number of bytes pending */
+  uint32_t length;
+
+  /** The core file */
+  FILE *core;
+
+  /** The bytes of packed dump and core file */
+  uint64_t packed_bytes;
+  uint64_t core_bytes;
+};
+
+
+/** Send a packet to the stub. */
+static int
+sendPacket( struct target *target, const char *data) {
+  uint8_t trailer[4];
+  uint8_t checksum = 0;
+  uint32_t length = strlen( data);
+  uint32_t i;
+
+  for ( i = 0; i < length; i++) {
+    checksum += data[i];
+  }
+  snprintf( (char *)trailer, sizeof( trailer), "#%02x", checksum);
+
+  return sendAll_host( target->sock, (const uint8_t *)"$", 1) &&
+    sendAll_host( target->sock, (const uint8_t *)data, length) &&
+    sendAll_host( target->sock, trailer, 3);
+}
+
+
+/** Wait for the next packet from the stub and acknowledge it, expanding
+ * the runs and escapes into data. Returns the length, -1 if the stub has
+ * gone. */
+static int
+receivePacket( struct target *target, uint8_t *data) {
+  while ( 1) {
+    uint8_t *start = memchr( target->buffer, '$', target->length);
+    uint8_t *end = start ? memchr( start, '#', target->length - (start - target->buffer)) : NULL;
+
+    if ( end != NULL && end + 3 <= target->buffer + target->length) {
+      uint32_t used = end + 3 - target->buffer;
+      uint8_t *ptr = start + 1;
+      int length = 0;
+
+      while ( ptr < end) {
+	if ( *ptr == '*' && length > 0 && ptr + 1 < end) {
+	  int repeats = ptr[1] - 29;
+
+	  while ( repeats-- > 0) {
+	    data[length] = data[length - 1];
+	    length++;
+	  }
+	  ptr += 2;
+	}
+	else if ( *ptr == '}' && ptr + 1 < end) {
+	  data[length++] = ptr[1] ^ 0x20;
+	  ptr += 2;
+	}
+	else {
+	  data[length++] = *ptr++;
+	}
+      }
+
+      memmove( target->buffer, target->buffer + used, target->length - used);
+      target->length -= used;
+
+      if ( !sendAll_host( target->sock, (const uint8_t *)"+", 1)) {
+	return -1;
+      }
+      return length;
+    }
+
+    if ( target->length == sizeof( target->buffer)) {
+      /* too big to hold, drop what has been seen */
+      target->length = 0;
+    }
+    {
+      ssize_t read_len = recv( target->sock, target->buffer + target->length,
+			       sizeof( target->buffer) - target->length, 0);
+
+      if ( read_len <= 0) {
+	return -1;
+      }
+      target->bytes_in += read_len;
+      target->length += read_len;
+    }
+  }
+}
+
+
+/** Read a little endian halfword. */
+static uint32_t
+getHalf( const uint8_t *buffer) {
+  return buffer[0] | (buffer[1] << 8);
+}
+
+
+/** Read a length continued past 15 in bytes added on. Returns 0 if it
+ * runs past end. */
+static int
+getLength( const uint8_t **ptr, const uint8_t *end, uint32_t *length) {
+  uint8_t extra;
+
+  do {
+    if ( *ptr >= end) {
+      return 0;
+    }
+    extra = *(*ptr)++;
+    *length += extra;
+  } while ( extra == 255);
+
+  return 1;
+}
+
+
+/** Unpack a block into out, which holds length bytes. Returns 0 if it is
+ * not well formed. */
+static int
+unpackBlock( const uint8_t *ptr, const uint8_t *end, uint8_t *out, uint32_t length) {
+  uint32_t done = 0;
+
+  while ( ptr < end) {
+    uint8_t token = *ptr++;
+    uint32_t literals = token >> 4;
+    uint32_t match_length = token & 0xf;
+    uint32_t distance;
+
+    if ( (literals == 15 && !getLength( &ptr, end, &literals)) ||
+	 literals > (uint32_t)(end - ptr) || literals > length - done) {
+      return 0;
+    }
+    memcpy( &out[done], ptr, literals);
+    ptr += literals;
+    done += literals;
+
+    /* the last sequence ends after its literals */
+    if ( ptr == end) {
+      break;
+    }
+
+    if ( end - ptr < 2) {
+      return 0;
+    }
+    distance = getHalf( ptr);
+    ptr += 2;
+    if ( match_length == 15 && !getLength( &ptr, end, &match_length)) {
+      return 0;
+    }
+    match_length += MIN_MATCH_CORE;
+    if ( distance == 0 || distance > done || match_length > length - done) {
+      return 0;
+    }
+    while ( match_length-- > 0) {
+      out[done] = out[done - distance];
+      done++;
+    }
+  }
+
+  return done == length;
+}
+
+
+/** Take more of the packed dump, writing out the blocks it completes.
+ * Returns 0 if a block is not well formed. */
+static int
+unpack( struct unpacker *unpacker, const uint8_t *data, uint32_t length) {
+  unpacker->packed_bytes += length;
+
+  while ( length > 0) {
+    uint32_t need = 4;
+    uint32_t size;
+
+    if ( unpacker->length >= 4) {
+      need += getHalf( &unpacker->pending[2]);
+    }
+    size = need - unpacker->length < length ? need - unpacker->length : length;
+    memcpy( &unpacker->pending[unpacker->length], data, size);
+    unpacker->length += size;
+    data += size;
+    length -= size;
+
+    if ( unpacker->length == 4) {
+      uint32_t raw_length = getHalf( unpacker->pending);
+      uint32_t packed_length = getHalf( &unpacker->pending[2]);
+
+      if ( raw_length == 0 || raw_length > BLOCK_SIZE_CORE || packed_length == 0 ||
+	   packed_length > raw_length) {
+	return 0;
+      }
+    }
+    else if ( unpacker->length > 4 && unpacker->length == 4 + getHalf( &unpacker->pending[2])) {
+      uint8_t out[BLOCK_SIZE_CORE];
+      uint32_t raw_length = getHalf( unpacker->pending);
+      uint32_t packed_length = getHalf( &unpacker->pending[2]);
+
+      if ( packed_length == raw_length) {
+	memcpy( out, &unpacker->pending[4], raw_length);
+      }
+      else if ( !unpackBlock( &unpacker->pending[4], &unpacker->pending[4 + packed_length],
+			      out, raw_length)) {
+	return 0;
+      }
+      fwrite( out, 1, raw_length, unpacker->core);
+      unpacker->core_bytes += raw_length;
+      unpacker->length = 0;
+    }
+  }
+
+  return 1;
+}
+
+
+/** Read the dump, returns 0 if it fails. */
+static int
+fetchCore( struct target *target, struct unpacker *unpacker) {
+  static uint8_t data[sizeof( target->buffer)];
+  uint32_t offset = 0;
+
+  while ( 1) {
+    char request[64];
+    int length;
+
+    snprintf( request, sizeof( request), "qXfer:core:read::%x,%x", offset, READ_SIZE);
+    if ( !sendPacket( target, request) || (length = receivePacket( target, data)) < 0) {
+      fprintf( stderr, "The stub has gone\n");
+      return 0;
+    }
+    if ( length == 0 || (data[0] != 'm' && data[0] != 'l')) {
+      fprintf( stderr, "The stub cannot dump: %.*s\n", length, data);
+      return 0;
+    }
+    if ( !unpack( unpacker, &data[1], length - 1)) {
+      fprintf( stderr, "The dump is not well formed at %u\n", offset);
+      return 0;
+    }
+    offset += length - 1;
+
+    if ( data[0] == 'l') {
+      break;
+    }
+  }
+
+  if ( unpacker->length != 0) {
+    fprintf( stderr, "The dump ends part way through a block\n");
+    return 0;
+  }
+
+  return 1;
+}
+
+
+static void
+usage( const char *name) {
+  fprintf( stderr, "usage: %s [-c command | -t host:port] core\n", name);
+  exit( 1);
+}
+
+
+int
+main( int argc, char **argv) {
+  static struct target target;
+  static struct unpacker unpacker;
+  static uint8_t reply[sizeof( target.buffer)];
+  const char *command = NULL;
+  const char *address = NULL;
+  uint64_t start_ns;
+  double seconds;
+  int ok;
+  int opt;
+
+  while ( (opt = getopt( argc, argv, "c:t:")) != -1) {
+    switch ( opt) {
+    case 'c':
+      command = optarg;
+      break;
+    case 't':
+      address = optarg;
+      break;
+    default:
+      usage( argv[0]);
+    }
+  }
+  if ( argc - optind != 1 || (command == NULL) == (address == NULL)) {
+    usage( argv[0]);
+  }
+
+  unpacker.core = fopen( argv[optind], "wb");
+  if ( unpacker.core == NULL) {
+    perror( argv[optind]);
+    return 1;
+  }
+
+  signal( SIGPIPE, SIG_IGN);
+  target.sock = command != NULL ? spawn_host( command) : connect_host( address);
+  if ( target.sock < 0) {
+    return 1;
+  }
+
+  start_ns = nowNs_host();
+  ok = fetchCore( &target, &unpacker);
+  seconds = (nowNs_host() - start_ns) / 1e9;
+
+  /* leave the stub waiting for GDB */
+  if ( sendPacket( &target, "D")) {
+    receivePacket( &target, reply);
+  }
+  close( target.sock);
+  if ( command != NULL) {
+    wait( NULL);
+  }
+
+  if ( fclose( unpacker.core) != 0 || !ok) {
+    return 1;
+  }
+  printf( "%llu byte core from %llu packed bytes (%llu on the wire) in %.3fs\n",
+	  (unsigned long long)unpacker.core_bytes, (unsigned long long)unpacker.packed_bytes,
+	  (unsigned long long)target.bytes_in, seconds);
+
+  return 0;
+}
@@ -0,0 +1,138 @@
+/** \file
+ * \brief Connections to a stub shared by the host tools.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "rsp_host.h"
+
+
+/* the time for latency measurements */
+uint64_t
+nowNs_host( void) {
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/* run a stub as a child process */
+int
+spawn_host( const char *command) {
+  int pair[2];
+  pid_t pid;
+
+  if ( socketpair( AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+    perror( "socketpair");
+    return -1;
+  }
+
+  pid = fork();
+  if ( pid < 0) {
+    perror( "fork");
+    return -1;
+  }
+  if ( pid == 0) {
+    dup2( pair[1], STDIN_FILENO);
+    dup2( pair[1], STDOUT_FILENO);
+    close( pair[0]);
+    close( pair[1]);
+    execl( "/bin/sh", "sh", "-c", command, (char *)NULL);
+    _exit( 127);
+  }
+  close( pair[1]);
+
+  return pair[0];
+}
+
+
+/* connect to a stub over TCP */
+int
+connect_host( const char *address) {
+  char host[256];
+  const char *colon = strrchr( address, ':');
+  struct addrinfo hints;
+  struct addrinfo *result;
+  int sock;
+  int one = 1;
+
+  if ( colon == NULL || (size_t)(colon - address) >= sizeof( host)) {
+    fprintf( stderr, "Bad address %s\n", address);
+    return -1;
+  }
+  memcpy( host, address, colon - address);
+  host[colon - address] = 0;
+
+  memset( &hints, 0, sizeof( hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if ( getaddrinfo( host, colon + 1, &hints, &result) != 0) {
+    fprintf( stderr, "Cannot find %s\n", host);
+    return -1;
+  }
+  sock = socket( AF_INET, SOCK_STREAM, 0);
+  if ( connect( sock, result->ai_addr, result->ai_addrlen) < 0) {
+    perror( address);
+    freeaddrinfo( result);
+    close( sock);
+    return -1;
+  }
+  freeaddrinfo( result);
+  setsockopt( sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one));
+
+  return sock;
+}
+
+
+/* wait for GDB on a local port */
+int
+listen_host( int port) {
+  struct sockaddr_in sain;
+  int sock = socket( AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+
+  setsockopt( sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof( one));
+  memset( &sain, 0, sizeof( sain));
+  sain.sin_family = AF_INET;
+  sain.sin_port = htons( port);
+  sain.sin_addr.s_addr = htonl( INADDR_LOOPBACK);
+  if ( bind( sock, (struct sockaddr *)&sain, sizeof( sain)) < 0 ||
+       listen( sock, 1) < 0) {
+    perror( "listen");
+    close( sock);
+    return -1;
+  }
+
+  return sock;
+}
+
+
+/* write a whole buffer */
+int
+sendAll_host( int sock, const uint8_t *data, uint32_t length) {
+  while ( length > 0) {
+    ssize_t sent = send( sock, data, length, 0);
+
+    if ( sent < 0) {
+      if ( errno == EINTR) {
+	continue;
+      }
+      return 0;
+    }
+    data += sent;
+    length -= sent;
+  }
+
+  return 1;
+}
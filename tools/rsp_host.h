@@ -0,0 +1,35 @@
+#ifndef _RSP_HOST_H_
+#define _RSP_HOST_H_ 1
+/** \file
+ * \brief Connections to a stub shared by the host tools.
+ */
+#include <stdint.h>
+
+
+/** Return the time in nanoseconds. */
+uint64_t
+nowNs_host( void);
+
+
+/** Run a command with its stdin and stdout on a socketpair, as GDB's
+ * 'target remote |' does. Returns our end, -1 on failure. */
+int
+spawn_host( const char *command);
+
+
+/** Connect to host:port. Returns the socket, -1 on failure. */
+int
+connect_host( const char *address);
+
+
+/** Listen for a connection on a loopback TCP port. Returns the listening
+ * socket, -1 on failure. */
+int
+listen_host( int port);
+
+
+/** Send all of the bytes on a socket. Returns 0 if it has closed. */
+int
+sendAll_host( int sock, const uint8_t *data, uint32_t length);
+
+#endif /* End of _RSP_HOST_H_ */
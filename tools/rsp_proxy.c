@@ -0,0 +1,1390 @@
+/** \file
+ * \brief A proxy between GDB and a stub that shows where the round trips go.
+ *
+ * GDB connects to a local port and its session is carried to the stub
+ * unchanged. Every packet is classified by command. The packets GDB sends
+ * for one user command (a burst that ends once GDB has been idle for a
+ * while) are reported together as an action: its round trips, bytes and
+ * wall time, and a guess at what was typed (step, next, bt, print...). At
+ * the end of the session the commands are tabled along with the round trips
+ * that protocol changes would have saved.
+ *
+ * With -C the proxy answers GDB itself where it can, for a slow link to the
+ * DS. Memory and registers read while the application is stopped are
+ * cached until it runs (writes update the cache), a read that misses is
+ * widened to at least FILL_SIZE bytes of whole lines so the small reads that
+ * follow it are answered too, and the stack is read ahead on every stop.
+ * The I/O registers are never cached.
+ *
+ * usage: rsp_proxy [-p port] [-g idle_ms] [-v] [-C] (-c command | -t host:port)
+ *  -c runs the stub for each GDB session with its stdin/stdout on a
+ *     socketpair (e.g. linux_stub/linux_stub)
+ *  -t connects to a stub (or udp_bridge) over TCP
+ *  -v prints every packet
+ *  -C answers from the cache
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "rsp_host.h"
+#include "rsp_cache.h"
+
+/** The default port GDB connects to */
+#define DEFAULT_PORT 2332
+
+/** The default time GDB is idle for before an action is over */
+#define DEFAULT_IDLE_MS 200
+
+/** The most packet data kept, longer packets are only counted */
+#define MAX_PACKET 4096
+
+/** The most characters of a command used to group it */
+#define MAX_KEY 24
+
+/** The most command groups reported */
+#define MAX_GROUPS 64
+
+/** The memory reads remembered between stops */
+#define MAX_READS 1024
+
+/** Reads up to this size next to the previous one could have been merged */
+#define SMALL_READ 64
+
+/** Reads this far above the stack pointer count as stack reads */
+#define STACK_WINDOW 0x4000
+
+/** The register number of the stack pointer */
+#define SP_REGISTER 13
+
+/** GDB's interrupt character */
+#define INTERRUPT_CHAR 0x03
+
+/** The most characters of a packet printed by -v */
+#define MAX_SHOWN 60
+
+/** The least read from the stub when a read misses the cache */
+#define FILL_SIZE 256
+
+/** The memory read ahead from the stack pointer on a stop */
+#define PREFETCH_SIZE 512
+
+/** The largest read from the stub, unless its packet size is smaller */
+#define MAX_READ 1024
+
+/** The DS I/O registers, never cached */
+#define IO_START 0x04000000
+#define IO_END 0x05000000
+
+
+/** \brief Picks packets out of one direction of the byte stream.
+ */
+struct parser {
+  /** Flag set between the '$' and the '#' */
+  int in_packet;
+
+  /** The checksum characters still to come */
+  int checksum_chars;
+
+  /** Flag set when the next byte is a run length */
+  int run_length;
+
+  /** The packet data, without the framing */
+  uint8_t data[MAX_PACKET + 1];
+
+  /** The number of bytes kept */
+  uint32_t length;
+
+  /** The number of bytes on the wire, with the framing */
+  uint32_t raw_length;
+};
+
+
+/** \brief The round trips of a command.
+ */
+struct group {
+  /** The command name */
+  char key[MAX_KEY + 1];
+
+  /** The number of round trips */
+  uint32_t count;
+
+  /** The bytes sent and received */
+  uint64_t bytes;
+
+  /** The time spent waiting for replies */
+  uint64_t time_ns;
+};
+
+
+/** \brief What GDB did for one user command.
+ */
+struct action {
+  /** When the first packet was seen */
+  uint64_t start_ns;
+
+  /** When the last reply was seen */
+  uint64_t end_ns;
+
+  /** The time the application ran for */
+  uint64_t run_ns;
+
+  /** The round trips */
+  uint32_t round_trips;
+
+  /** The bytes from GDB */
+  uint64_t bytes_in;
+
+  /** The bytes to GDB */
+  uint64_t bytes_out;
+
+  /** Single steps (or step ranges) */
+  uint32_t steps;
+
+  /** Continues */
+  uint32_t continues;
+
+  /** Interrupts */
+  uint32_t interrupts;
+
+  /** Memory or register writes */
+  uint32_t writes;
+
+  /** Breakpoints inserted or removed */
+  uint32_t breakpoints;
+
+  /** Register reads */
+  uint32_t reg_reads;
+
+  /** Register reads of registers the last stop reply carried */
+  uint32_t known_reg_reads;
+
+  /** Memory reads */
+  uint32_t mem_reads;
+
+  /** Memory reads of memory already read since the last stop */
+  uint32_t repeat_reads;
+
+  /** Small memory reads starting where the previous one ended */
+  uint32_t adjacent_reads;
+
+  /** Memory reads near the stack pointer */
+  uint32_t stack_reads;
+
+  /** Flag set if GDB connected */
+  int connect;
+
+  /** Flag set if GDB detached or killed the application */
+  int detach;
+
+  /** Requests answered from the cache */
+  uint32_t cached;
+};
+
+
+/** \brief A range of memory GDB has read.
+ */
+struct read_range {
+  /** The first address */
+  uint32_t start;
+
+  /** The address after the last */
+  uint32_t end;
+};
+
+
+/** \brief A GDB session through the proxy.
+ */
+struct session {
+  /** The connection to GDB */
+  int gdb_sock;
+
+  /** The connection to the stub */
+  int target_sock;
+
+  /** The packets from GDB */
+  struct parser from_gdb;
+
+  /** The packets from the stub */
+  struct parser from_target;
+
+  /** Flag set while a request waits for its reply */
+  int waiting;
+
+  /** Flag set if the request lets the application run */
+  int resume;
+
+  /** The command of the request */
+  char request_key[MAX_KEY + 1];
+
+  /** The request, for -v */
+  char request_shown[MAX_SHOWN + 1];
+
+  /** When the request was sent */
+  uint64_t request_ns;
+
+  /** The size of the request */
+  uint32_t request_bytes;
+
+  /** When the last packet was seen */
+  uint64_t last_ns;
+
+  /** Flag set while an action is in progress */
+  int in_action;
+
+  /** The action in progress */
+  struct action action;
+
+  /** The memory read since the application last ran */
+  struct read_range reads[MAX_READS];
+
+  /** The number of reads remembered */
+  uint32_t read_count;
+
+  /** The address after the last read */
+  uint32_t last_read_end;
+
+  /** Flag set if there has been a read since the application last ran */
+  int have_last_read;
+
+  /** The stack pointer from the last stop reply */
+  uint32_t sp;
+
+  /** Flag set if the last stop reply carried the stack pointer */
+  int have_sp;
+
+  /** Flag set if the last stop reply carried the registers */
+  int have_registers;
+
+  /** The number of actions */
+  uint32_t action_count;
+
+  /** The totals of all actions */
+  struct action totals;
+
+  /** The steps after the first in actions with more than one */
+  uint32_t extra_steps;
+
+  /** Flag set if the proxy answers from its cache */
+  int caching;
+
+  /** The cache */
+  struct rsp_cache *cache;
+
+  /** Flag set while GDB's packets are acknowledged */
+  int gdb_ack_mode;
+
+  /** Flag set while the stub's packets are acknowledged */
+  int stub_ack_mode;
+
+  /** Flag set if the stub sends memory as binary ('x') */
+  int stub_binary;
+
+  /** The largest read made of the stub */
+  uint32_t max_read;
+
+  /** The request passed to the stub */
+  char request[MAX_PACKET + 1];
+
+  /** Flag set when the stack is to be read ahead */
+  int prefetch_pending;
+
+  /** The replies to the proxy's own requests */
+  struct parser internal;
+
+  /** The replies made by the proxy */
+  struct parser local;
+
+  /** The requests made of the stub */
+  uint32_t stub_trips;
+
+  /** Of which were the proxy's own reads */
+  uint32_t fills;
+};
+
+
+/** \brief A round trip saving reported at the end of a session.
+ */
+struct saving {
+  /** The round trips saved */
+  uint32_t count;
+
+  /** What would save them */
+  const char *text;
+};
+
+
+/** The command groups */
+static struct group groups[MAX_GROUPS];
+
+/** The number of command groups */
+static int group_count;
+
+/** The time GDB is idle for before an action is over */
+static uint64_t idle_ns = (uint64_t)DEFAULT_IDLE_MS * 1000000;
+
+/** Flag set to print every packet */
+static int verbose;
+
+/** Set by SIGINT */
+static volatile int stop_proxy;
+
+
+/**
+ * Feed a byte to a parser. Returns 1 when it completes a packet, the data
+ * (with any runs expanded) is then in parser->data.
+ */
+static int
+parseByte( struct parser *parser, uint8_t byte) {
+  if ( parser->checksum_chars > 0) {
+    parser->raw_length += 1;
+    if ( --parser->checksum_chars == 0) {
+      parser->data[parser->length] = 0;
+      return 1;
+    }
+  }
+  else if ( parser->run_length) {
+    /* the previous character repeats count - 29 more times */
+    int count = byte - 29;
+
+    parser->raw_length += 1;
+    parser->run_length = 0;
+    while ( count-- > 0 && parser->length > 0 && parser->length < MAX_PACKET) {
+      parser->data[parser->length] = parser->data[parser->length - 1];
+      parser->length += 1;
+    }
+  }
+  else if ( parser->in_packet) {
+    parser->raw_length += 1;
+    if ( byte == '#') {
+      parser->in_packet = 0;
+      parser->checksum_chars = 2;
+    }
+    else if ( byte == '*') {
+      parser->run_length = 1;
+    }
+    else if ( parser->length < MAX_PACKET) {
+      parser->data[parser->length++] = byte;
+    }
+  }
+  else if ( byte == '$' || byte == '%') {
+    parser->in_packet = 1;
+    parser->length = 0;
+    parser->raw_length = 1;
+  }
+
+  return 0;
+}
+
+
+/** Make the group name of a command. */
+static void
+commandKey( const uint8_t *data, uint32_t length, char *key) {
+  uint32_t i = 0;
+
+  if ( length >= 6 && memcmp( data, "vCont;", 6) == 0) {
+    /* the first action says what the resume does */
+    memcpy( key, data, 7);
+    i = 7;
+  }
+  else if ( length > 0 && (data[0] == 'q' || data[0] == 'Q' || data[0] == 'v')) {
+    /* the name of a query runs up to its arguments */
+    while ( i < length && i < MAX_KEY && strchr( ":,;?", data[i]) == NULL) {
+      key[i] = data[i];
+      i += 1;
+    }
+  }
+  else if ( length > 0) {
+    key[i++] = data[0];
+  }
+  key[i] = 0;
+}
+
+
+/** Add a round trip to a group. */
+static void
+addRoundTrip( const char *key, uint64_t time_ns, uint64_t bytes) {
+  struct group *group = NULL;
+  int i;
+
+  for ( i = 0; i < group_count; i++) {
+    if ( strcmp( groups[i].key, key) == 0) {
+      group = &groups[i];
+      break;
+    }
+  }
+  if ( group == NULL) {
+    if ( group_count == MAX_GROUPS) {
+      return;
+    }
+    group = &groups[group_count++];
+    strcpy( group->key, key);
+  }
+
+  group->count += 1;
+  group->bytes += bytes;
+  group->time_ns += time_ns;
+}
+
+
+/** Copy a packet for printing. */
+static void
+showPacket( const struct parser *parser, char *shown) {
+  uint32_t i;
+
+  for ( i = 0; i < parser->length && i < MAX_SHOWN; i++) {
+    uint8_t ch = parser->data[i];
+
+    shown[i] = (ch >= ' ' && ch < 0x7f) ? ch : '.';
+  }
+  shown[i] = 0;
+}
+
+
+/** Return the value of a hex digit, -1 if it is not one. */
+static int
+hexDigit( char ch) {
+  if ( ch >= '0' && ch <= '9') {
+    return ch - '0';
+  }
+  if ( ch >= 'a' && ch <= 'f') {
+    return ch - 'a' + 10;
+  }
+  if ( ch >= 'A' && ch <= 'F') {
+    return ch - 'A' + 10;
+  }
+
+  return -1;
+}
+
+
+/** Read a hex number, returns the character after it. */
+static const char *
+parseHex( const char *text, uint32_t *value) {
+  *value = 0;
+  while ( hexDigit( *text) >= 0) {
+    *value = (*value << 4) | hexDigit( *text);
+    text += 1;
+  }
+
+  return text;
+}
+
+
+/** Forget what the application had in memory, it has run. */
+static void
+forgetReads( struct session *session) {
+  session->read_count = 0;
+  session->have_last_read = 0;
+}
+
+
+/** Account for a memory read. */
+static void
+memoryRead( struct session *session, uint32_t addr, uint32_t length) {
+  struct action *action = &session->action;
+  uint32_t i;
+
+  action->mem_reads += 1;
+
+  for ( i = 0; i < session->read_count; i++) {
+    if ( addr >= session->reads[i].start && addr + length <= session->reads[i].end) {
+      action->repeat_reads += 1;
+      break;
+    }
+  }
+  if ( i == session->read_count && session->read_count < MAX_READS) {
+    session->reads[session->read_count].start = addr;
+    session->reads[session->read_count].end = addr + length;
+    session->read_count += 1;
+  }
+
+  if ( session->have_last_read && addr == session->last_read_end && length <= SMALL_READ) {
+    action->adjacent_reads += 1;
+  }
+  session->last_read_end = addr + length;
+  session->have_last_read = 1;
+
+  if ( session->have_sp && addr - session->sp < STACK_WINDOW) {
+    action->stack_reads += 1;
+  }
+}
+
+
+/** Account for the actions of a vCont packet. */
+static void
+vContRequest( struct session *session, const char *data) {
+  const char *ptr = data + 5;
+
+  while ( *ptr == ';') {
+    ptr += 1;
+    if ( *ptr == 's' || *ptr == 'S' || *ptr == 'r') {
+      session->action.steps += 1;
+    }
+    else if ( *ptr == 'c' || *ptr == 'C') {
+      session->action.continues += 1;
+    }
+    ptr = strchr( ptr, ';');
+    if ( ptr == NULL) {
+      break;
+    }
+  }
+}
+
+
+/** Account for a packet from GDB. */
+static void
+handleRequest( struct session *session, const struct parser *parser, uint64_t now) {
+  struct action *action = &session->action;
+  const char *data = (const char *)parser->data;
+  uint32_t addr;
+  uint32_t length;
+
+  if ( !session->in_action) {
+    memset( action, 0, sizeof( *action));
+    action->start_ns = now;
+    session->in_action = 1;
+  }
+  action->round_trips += 1;
+  action->bytes_in += parser->raw_length;
+
+  commandKey( parser->data, parser->length, session->request_key);
+  session->waiting = 1;
+  session->resume = 0;
+  session->request_ns = now;
+  session->request_bytes = parser->raw_length;
+  if ( verbose) {
+    showPacket( parser, session->request_shown);
+  }
+
+  switch ( data[0]) {
+  case 'm':
+  case 'x':
+    if ( *parseHex( parseHex( data + 1, &addr) + 1, &length) == 0) {
+      memoryRead( session, addr, length);
+    }
+    break;
+
+  case 'g':
+  case 'p':
+    action->reg_reads += 1;
+    if ( session->have_registers) {
+      action->known_reg_reads += 1;
+    }
+    break;
+
+  case 'M':
+  case 'X':
+    /* the range read could be kept up to date, but GDB rarely writes */
+    forgetReads( session);
+    action->writes += 1;
+    break;
+
+  case 'G':
+  case 'P':
+    action->writes += 1;
+    break;
+
+  case 'Z':
+  case 'z':
+    action->breakpoints += 1;
+    break;
+
+  case 's':
+  case 'S':
+    action->steps += 1;
+    session->resume = 1;
+    break;
+
+  case 'c':
+  case 'C':
+    action->continues += 1;
+    session->resume = 1;
+    break;
+
+  case 'D':
+    action->detach = 1;
+    break;
+
+  case 'k':
+    /* there is no reply */
+    action->detach = 1;
+    session->waiting = 0;
+    break;
+
+  case 'v':
+    if ( strncmp( data, "vCont;", 6) == 0) {
+      vContRequest( session, data);
+      session->resume = 1;
+    }
+    break;
+
+  case 'q':
+    if ( strncmp( data, "qSupported", 10) == 0) {
+      action->connect = 1;
+    }
+    break;
+  }
+
+  if ( session->resume) {
+    forgetReads( session);
+    session->have_sp = 0;
+    session->have_registers = 0;
+  }
+}
+
+
+/** Pick the registers out of a stop reply. */
+static void
+stopReply( struct session *session, const char *data) {
+  const char *ptr = data + 3;
+
+  while ( *ptr != 0) {
+    uint32_t reg;
+    const char *value = parseHex( ptr, &reg);
+
+    if ( *value == ':') {
+      value += 1;
+      session->have_registers = 1;
+      if ( reg == SP_REGISTER) {
+	int i;
+
+	/* registers are sent in target (little endian) byte order */
+	session->sp = 0;
+	for ( i = 0; i < 8 && hexDigit( value[i]) >= 0; i++) {
+	  session->sp |= (uint32_t)hexDigit( value[i]) << (4 * (i ^ 1));
+	}
+	session->have_sp = 1;
+      }
+    }
+    ptr = strchr( value, ';');
+    if ( ptr == NULL) {
+      break;
+    }
+    ptr += 1;
+  }
+}
+
+
+/** Account for a packet from the stub. */
+static void
+handleReply( struct session *session, const struct parser *parser, uint64_t now) {
+  struct action *action = &session->action;
+  const char *data = (const char *)parser->data;
+
+  action->bytes_out += parser->raw_length;
+
+  if ( session->waiting) {
+    uint64_t time_ns = now - session->request_ns;
+
+    session->waiting = 0;
+    addRoundTrip( session->request_key, time_ns, session->request_bytes + parser->raw_length);
+    if ( session->resume) {
+      action->run_ns += time_ns;
+    }
+    if ( verbose) {
+      char shown[MAX_SHOWN + 1];
+
+      showPacket( parser, shown);
+      fprintf( stderr, "%-40s %-40s %10.1f us\n", session->request_shown, shown, time_ns / 1e3);
+    }
+  }
+
+  if ( data[0] == 'T' && parser->length >= 3) {
+    stopReply( session, data);
+  }
+}
+
+
+/** Send a packet, framed with its checksum. Returns 0 if the other side
+ * has gone. */
+static int
+sendPacket( int sock, const uint8_t *data, uint32_t length) {
+  static uint8_t frame[MAX_PACKET + 4];
+  uint8_t checksum = 0;
+  uint32_t i;
+
+  frame[0] = '$';
+  for ( i = 0; i < length; i++) {
+    frame[i + 1] = data[i];
+    checksum += data[i];
+  }
+  snprintf( (char *)&frame[length + 1], 4, "#%02x", checksum);
+
+  return sendAll_host( sock, frame, length + 4);
+}
+
+
+/**
+ * Make a request of the stopped stub for the proxy itself. Returns the
+ * reply, NULL if the stub has gone.
+ */
+static const struct parser *
+stubRequest( struct session *session, const char *request) {
+  struct parser *parser = &session->internal;
+
+  session->stub_trips += 1;
+  if ( !sendPacket( session->target_sock, (const uint8_t *)request, strlen( request))) {
+    return NULL;
+  }
+
+  /* the stub is stopped, nothing else comes from it */
+  while ( 1) {
+    uint8_t buffer[1024];
+    ssize_t read_len = recv( session->target_sock, buffer, sizeof( buffer), 0);
+    ssize_t i;
+
+    if ( read_len <= 0) {
+      return NULL;
+    }
+    for ( i = 0; i < read_len; i++) {
+      if ( parseByte( parser, buffer[i])) {
+	if ( session->stub_ack_mode && !sendAll_host( session->target_sock,
+						      (const uint8_t *)"+", 1)) {
+	  return NULL;
+	}
+	return parser;
+      }
+    }
+  }
+}
+
+
+/** Decode a memory read reply. Returns 0 unless it holds length bytes. */
+static int
+decodeMemory( const struct parser *reply, int binary, uint8_t *data, uint32_t length) {
+  const uint8_t *ptr = reply->data;
+  const uint8_t *end = ptr + reply->length;
+  uint32_t count = 0;
+
+  if ( binary) {
+    if ( ptr == end || *ptr++ != 'b') {
+      return 0;
+    }
+    while ( ptr < end && count < length) {
+      if ( *ptr == '}' && ptr + 1 < end) {
+	data[count++] = ptr[1] ^ 0x20;
+	ptr += 2;
+      }
+      else {
+	data[count++] = *ptr++;
+      }
+    }
+  }
+  else {
+    while ( ptr + 1 < end && count < length &&
+	    hexDigit( ptr[0]) >= 0 && hexDigit( ptr[1]) >= 0) {
+      data[count++] = (hexDigit( ptr[0]) << 4) | hexDigit( ptr[1]);
+      ptr += 2;
+    }
+  }
+
+  return count == length && ptr == end;
+}
+
+
+/** Check a range can be cached. The I/O registers change while the
+ * application is stopped and reading some of them has side effects. */
+static int
+cacheable( uint32_t addr, uint32_t length) {
+  return length > 0 && addr + length > addr &&
+    (addr >= IO_END || addr + length <= IO_START);
+}
+
+
+/** Read the lines covering a range from the stub into the cache. Returns 0
+ * if the stub refused. */
+static int
+fillCache( struct session *session, uint32_t addr, uint32_t length) {
+  static uint8_t data[MAX_READ];
+  uint32_t start = addr & ~(LINE_SIZE_CACHE - 1);
+  uint32_t end = (addr + length + LINE_SIZE_CACHE - 1) & ~(LINE_SIZE_CACHE - 1);
+  const struct parser *reply;
+  char request[32];
+
+  if ( end - start > session->max_read || !cacheable( start, end - start)) {
+    return 0;
+  }
+
+  snprintf( request, sizeof( request), "%c%x,%x", session->stub_binary ? 'x' : 'm',
+	    start, end - start);
+  session->fills += 1;
+  reply = stubRequest( session, request);
+  if ( reply == NULL || !decodeMemory( reply, session->stub_binary, data, end - start)) {
+    return 0;
+  }
+  fill_cache( session->cache, start, data, end - start);
+
+  return 1;
+}
+
+
+/** Answer GDB without asking the stub. */
+static int
+replyLocal( struct session *session, const uint8_t *data, uint32_t length) {
+  struct parser *reply = &session->local;
+
+  memcpy( reply->data, data, length);
+  reply->data[length] = 0;
+  reply->length = length;
+  reply->raw_length = length + 4;
+
+  session->action.cached += 1;
+  handleReply( session, reply, nowNs_host());
+
+  return sendPacket( session->gdb_sock, data, length);
+}
+
+
+/**
+ * Answer a memory read from the cache, filling it first if need be.
+ * Returns 0 if the read has to go to the stub, -1 if a side has gone.
+ */
+static int
+serveMemory( struct session *session, int binary, uint32_t addr, uint32_t length) {
+  static uint8_t data[MAX_READ];
+  static uint8_t reply[2 * MAX_READ + 1];
+  uint32_t fill_length = length < FILL_SIZE ? FILL_SIZE : length;
+  uint8_t *ptr = reply;
+  uint32_t i;
+
+  if ( length > session->max_read / 2 || !cacheable( addr, length)) {
+    return 0;
+  }
+  /* widened so the reads that follow are answered too, if that reaches
+   * memory the stub will not read the request is passed on as it is */
+  if ( !read_cache( session->cache, addr, length, data) &&
+       !(fillCache( session, addr, fill_length) &&
+	 read_cache( session->cache, addr, length, data))) {
+    return 0;
+  }
+
+  if ( binary) {
+    *ptr++ = 'b';
+    for ( i = 0; i < length; i++) {
+      if ( data[i] == '#' || data[i] == '$' || data[i] == '}' || data[i] == '*') {
+	*ptr++ = '}';
+	*ptr++ = data[i] ^ 0x20;
+      }
+      else {
+	*ptr++ = data[i];
+      }
+    }
+  }
+  else {
+    for ( i = 0; i < length; i++) {
+      ptr += sprintf( (char *)ptr, "%02x", data[i]);
+    }
+  }
+
+  return replyLocal( session, reply, ptr - reply) ? 1 : -1;
+}
+
+
+/** Answer a packet from GDB from the cache or pass it to the stub. Returns
+ * 0 if a side has gone. */
+static int
+serveRequest( struct session *session, const struct parser *parser, uint64_t now) {
+  const char *data = (const char *)parser->data;
+  struct rsp_cache *cache = session->cache;
+  uint32_t addr;
+  uint32_t length;
+
+  if ( session->gdb_ack_mode && !sendAll_host( session->gdb_sock, (const uint8_t *)"+", 1)) {
+    return 0;
+  }
+  handleRequest( session, parser, now);
+
+  switch ( data[0]) {
+  case 'm':
+  case 'x':
+    if ( *parseHex( parseHex( data + 1, &addr) + 1, &length) == 0) {
+      int served = serveMemory( session, data[0] == 'x', addr, length);
+
+      if ( served != 0) {
+	return served > 0;
+      }
+    }
+    break;
+
+  case 'g':
+    if ( cache->register_length > 0) {
+      return replyLocal( session, cache->registers, cache->register_length);
+    }
+    break;
+
+  case 'M':
+    /* the cache is updated when the stub says the write worked */
+  case 'p':
+  case 'q':
+  case 'Q':
+  case '?':
+    break;
+
+  case 'G':
+  case 'P':
+    cache->register_length = 0;
+    break;
+
+  default:
+    /* anything else (resuming above all) may change the target */
+    clear_cache( cache);
+    break;
+  }
+
+  memcpy( session->request, data, parser->length + 1);
+
+  return sendPacket( session->target_sock, parser->data, parser->length);
+}
+
+
+/** Keep the cache up to date with a memory write the stub has replied to. */
+static void
+writeReply( struct session *session, const char *reply) {
+  static uint8_t data[MAX_PACKET / 2];
+  const char *ptr;
+  uint32_t addr;
+  uint32_t length;
+  uint32_t i;
+
+  ptr = parseHex( parseHex( session->request + 1, &addr) + 1, &length);
+  if ( *ptr++ != ':' || length > sizeof( data) || strlen( ptr) != 2 * length) {
+    clear_cache( session->cache);
+    return;
+  }
+  if ( strcmp( reply, "OK") != 0) {
+    invalidate_cache( session->cache, addr, length);
+    return;
+  }
+
+  for ( i = 0; i < length; i++) {
+    data[i] = (hexDigit( ptr[2 * i]) << 4) | hexDigit( ptr[2 * i + 1]);
+  }
+  write_cache( session->cache, addr, data, length);
+}
+
+
+/** Pass a reply from the stub to GDB, keeping what it says. Returns 0 if a
+ * side has gone. */
+static int
+forwardReply( struct session *session, const struct parser *parser, uint64_t now) {
+  const char *reply = (const char *)parser->data;
+  const char *request = session->request;
+  struct rsp_cache *cache = session->cache;
+
+  if ( session->stub_ack_mode && !sendAll_host( session->target_sock, (const uint8_t *)"+", 1)) {
+    return 0;
+  }
+  session->stub_trips += 1;
+
+  if ( request[0] == 'g' && reply[0] != 'E' && parser->length > 0 &&
+       parser->length <= MAX_REGISTERS_CACHE) {
+    memcpy( cache->registers, reply, parser->length);
+    cache->register_length = parser->length;
+  }
+  else if ( request[0] == 'M') {
+    writeReply( session, reply);
+  }
+  else if ( strncmp( request, "qSupported", 10) == 0) {
+    const char *size = strstr( reply, "PacketSize=");
+
+    if ( size != NULL) {
+      uint32_t packet_size;
+
+      /* room for the hex of a read and the framing */
+      parseHex( size + 11, &packet_size);
+      if ( packet_size > 2 * LINE_SIZE_CACHE + 8 &&
+	   (packet_size - 8) / 2 < session->max_read) {
+	session->max_read = ((packet_size - 8) / 2) & ~(LINE_SIZE_CACHE - 1);
+      }
+    }
+    session->stub_binary = strstr( reply, "binary-upload+") != NULL;
+  }
+
+  handleReply( session, parser, now);
+  if ( !sendPacket( session->gdb_sock, parser->data, parser->length)) {
+    return 0;
+  }
+
+  if ( strcmp( request, "QStartNoAckMode") == 0 && strcmp( reply, "OK") == 0) {
+    session->gdb_ack_mode = 0;
+    session->stub_ack_mode = 0;
+  }
+  if ( reply[0] == 'T' && session->have_sp) {
+    session->prefetch_pending = 1;
+  }
+  session->request[0] = 0;
+
+  return 1;
+}
+
+
+/** Read the stack into the cache once the application has stopped. */
+static void
+prefetchStack( struct session *session) {
+  uint32_t addr = session->sp & ~(LINE_SIZE_CACHE - 1);
+
+  session->prefetch_pending = 0;
+  fillCache( session, addr, PREFETCH_SIZE);
+}
+
+
+/** Guess the user command behind an action. */
+static const char *
+guessAction( const struct action *action) {
+  if ( action->connect) {
+    return "connect";
+  }
+  if ( action->detach) {
+    return "detach";
+  }
+  if ( action->steps > 0 && action->continues > 0) {
+    /* a step over a call ends with a continue to the return address */
+    return "next";
+  }
+  if ( action->steps > 1) {
+    return "step";
+  }
+  if ( action->steps == 1) {
+    return "stepi";
+  }
+  if ( action->continues > 0) {
+    return "continue";
+  }
+  if ( action->writes > 0) {
+    return "set";
+  }
+  if ( action->breakpoints > 0) {
+    return "break";
+  }
+  if ( action->stack_reads >= 3) {
+    /* walking the frames reads the stack over and over */
+    return "bt";
+  }
+  if ( action->mem_reads > 0 || action->reg_reads > 0) {
+    return "print";
+  }
+
+  return "other";
+}
+
+
+/** Report an action and add it to the totals. */
+static void
+finishAction( struct session *session) {
+  struct action *action = &session->action;
+  struct action *totals = &session->totals;
+  double wall_ms = (action->end_ns - action->start_ns) / 1e6;
+
+  session->in_action = 0;
+  session->action_count += 1;
+
+  printf( "%4u %-9s %5u trips %8llu bytes %9.1f ms", session->action_count,
+	  guessAction( action), action->round_trips,
+	  (unsigned long long)(action->bytes_in + action->bytes_out), wall_ms);
+  if ( action->run_ns > 0) {
+    printf( " (ran %.1f ms)", action->run_ns / 1e6);
+  }
+  printf( ": m %u (%u repeat, %u adjacent, %u stack), g/p %u, steps %u, Z/z %u",
+	  action->mem_reads, action->repeat_reads, action->adjacent_reads, action->stack_reads,
+	  action->reg_reads, action->steps, action->breakpoints);
+  if ( session->caching) {
+    printf( ", %u cached", action->cached);
+  }
+  printf( "\n");
+  fflush( stdout);
+
+  if ( action->steps > 1) {
+    session->extra_steps += action->steps - 1;
+  }
+  totals->round_trips += action->round_trips;
+  totals->bytes_in += action->bytes_in;
+  totals->bytes_out += action->bytes_out;
+  totals->run_ns += action->run_ns;
+  totals->mem_reads += action->mem_reads;
+  totals->repeat_reads += action->repeat_reads;
+  totals->adjacent_reads += action->adjacent_reads;
+  totals->reg_reads += action->reg_reads;
+  totals->known_reg_reads += action->known_reg_reads;
+  totals->breakpoints += action->breakpoints;
+  totals->cached += action->cached;
+}
+
+
+static int
+compareGroups( const void *a, const void *b) {
+  const struct group *ga = a;
+  const struct group *gb = b;
+
+  return ga->time_ns < gb->time_ns ? 1 : ga->time_ns > gb->time_ns ? -1 : 0;
+}
+
+
+static int
+compareSavings( const void *a, const void *b) {
+  const struct saving *sa = a;
+  const struct saving *sb = b;
+
+  return (int)sb->count - (int)sa->count;
+}
+
+
+/** Print the round trips per command and what would save some. */
+static void
+reportSession( struct session *session) {
+  struct action *totals = &session->totals;
+  struct saving savings[] = {
+    { totals->repeat_reads,
+      "memory reads repeated before the application ran again (cache between stops)" },
+    { totals->adjacent_reads,
+      "small reads following on from the previous one (merge into larger reads)" },
+    { totals->known_reg_reads,
+      "register reads the stop reply had already answered" },
+    { session->extra_steps,
+      "single steps after the first in one command (range stepping, vCont;r)" },
+    { totals->breakpoints,
+      "breakpoint inserts and removes (set breakpoint always-inserted on)" }
+  };
+  int i;
+
+  qsort( groups, group_count, sizeof( groups[0]), compareGroups);
+
+  printf( "\n%u actions, %u round trips, %llu bytes from GDB, %llu to GDB\n",
+	  session->action_count, totals->round_trips,
+	  (unsigned long long)totals->bytes_in, (unsigned long long)totals->bytes_out);
+  printf( "%-24s %8s %12s %12s %10s\n", "command", "trips", "bytes", "total ms", "mean us");
+  for ( i = 0; i < group_count; i++) {
+    struct group *group = &groups[i];
+
+    printf( "%-24s %8u %12llu %12.1f %10.1f\n", group->key, group->count,
+	    (unsigned long long)group->bytes, group->time_ns / 1e6,
+	    group->time_ns / 1e3 / group->count);
+  }
+  if ( totals->run_ns > 0) {
+    printf( "(the time of resumes includes %.1f ms the application ran for)\n",
+	    totals->run_ns / 1e6);
+  }
+
+  if ( session->caching) {
+    printf( "%u of %u requests answered from the cache, %u requests to the stub (%u of them reads by the proxy)\n",
+	    totals->cached, totals->round_trips, session->stub_trips, session->fills);
+  }
+
+  qsort( savings, sizeof( savings) / sizeof( savings[0]), sizeof( savings[0]), compareSavings);
+  printf( "\nRound trips that could be saved:\n");
+  for ( i = 0; i < (int)(sizeof( savings) / sizeof( savings[0])); i++) {
+    printf( "%8u  %s\n", savings[i].count, savings[i].text);
+  }
+  fflush( stdout);
+
+  memset( groups, 0, sizeof( groups));
+  group_count = 0;
+}
+
+
+/**
+ * Carry bytes from one side to the other, feeding them to a parser.
+ * Returns 0 if either side has closed.
+ */
+static int
+relay( struct session *session, int from_gdb) {
+  uint8_t buffer[16384];
+  int from = from_gdb ? session->gdb_sock : session->target_sock;
+  int to = from_gdb ? session->target_sock : session->gdb_sock;
+  struct parser *parser = from_gdb ? &session->from_gdb : &session->from_target;
+  ssize_t read_len = recv( from, buffer, sizeof( buffer), 0);
+  uint64_t now = nowNs_host();
+  ssize_t i;
+
+  if ( read_len <= 0) {
+    return 0;
+  }
+  /* when caching the packets are passed on one by one */
+  if ( !session->caching && !sendAll_host( to, buffer, read_len)) {
+    return 0;
+  }
+
+  for ( i = 0; i < read_len; i++) {
+    if ( from_gdb && !parser->in_packet && parser->checksum_chars == 0 &&
+	 buffer[i] == INTERRUPT_CHAR) {
+      if ( session->in_action) {
+	session->action.interrupts += 1;
+      }
+      if ( session->caching && !sendAll_host( to, &buffer[i], 1)) {
+	return 0;
+      }
+    }
+    else if ( parseByte( parser, buffer[i])) {
+      if ( !session->caching) {
+	if ( from_gdb) {
+	  handleRequest( session, parser, now);
+	}
+	else {
+	  handleReply( session, parser, now);
+	}
+      }
+      else if ( from_gdb ? !serveRequest( session, parser, now) :
+		!forwardReply( session, parser, now)) {
+	return 0;
+      }
+    }
+  }
+
+  session->last_ns = now;
+  if ( session->in_action) {
+    session->action.end_ns = now;
+  }
+
+  return 1;
+}
+
+
+/** Carry a GDB session to and from the stub until either side closes. */
+static void
+runSession( struct session *session) {
+  while ( !stop_proxy) {
+    struct pollfd pfds[2];
+
+    pfds[0].fd = session->gdb_sock;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = session->target_sock;
+    pfds[1].events = POLLIN;
+
+    poll( pfds, 2, idle_ns / 1000000);
+
+    if ( (pfds[0].revents & (POLLIN | POLLHUP | POLLERR)) && !relay( session, 1)) {
+      break;
+    }
+    if ( (pfds[1].revents & (POLLIN | POLLHUP | POLLERR)) && !relay( session, 0)) {
+      break;
+    }
+    if ( session->prefetch_pending && !session->waiting) {
+      prefetchStack( session);
+    }
+
+    /* GDB has finished with the user's command */
+    if ( session->in_action && !session->waiting &&
+	 nowNs_host() - session->last_ns >= idle_ns) {
+      finishAction( session);
+    }
+  }
+
+  if ( session->in_action) {
+    finishAction( session);
+  }
+}
+
+
+static void
+stopHandler( int sig __attribute__((unused))) {
+  stop_proxy = 1;
+}
+
+
+static void
+usage( const char *name) {
+  fprintf( stderr, "usage: %s [-p port] [-g idle_ms] [-v] [-C] (-c command | -t host:port)\n",
+	   name);
+  exit( 1);
+}
+
+
+int
+main( int argc, char **argv) {
+  static struct session session;
+  static struct rsp_cache cache;
+  const char *command = NULL;
+  const char *address = NULL;
+  int port = DEFAULT_PORT;
+  int caching = 0;
+  struct sigaction stop_action;
+  int listen_sock;
+  int opt;
+  int one = 1;
+
+  while ( (opt = getopt( argc, argv, "p:g:vCc:t:")) != -1) {
+    switch ( opt) {
+    case 'p':
+      port = atoi( optarg);
+      break;
+    case 'g':
+      idle_ns = (uint64_t)atoi( optarg) * 1000000;
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    case 'C':
+      caching = 1;
+      break;
+    case 'c':
+      command = optarg;
+      break;
+    case 't':
+      address = optarg;
+      break;
+    default:
+      usage( argv[0]);
+    }
+  }
+  if ( argc != optind || (command == NULL) == (address == NULL)) {
+    usage( argv[0]);
+  }
+
+  listen_sock = listen_host( port);
+  if ( listen_sock < 0) {
+    return 1;
+  }
+
+  /* not restarted, so a waiting accept() sees it */
+  memset( &stop_action, 0, sizeof( stop_action));
+  stop_action.sa_handler = stopHandler;
+  sigaction( SIGINT, &stop_action, NULL);
+  signal( SIGPIPE, SIG_IGN);
+
+  while ( !stop_proxy) {
+    int gdb_sock;
+
+    printf( "Waiting for GDB on port %d\n", port);
+    fflush( stdout);
+    gdb_sock = accept( listen_sock, NULL, NULL);
+    if ( gdb_sock < 0) {
+      if ( errno == EINTR) {
+	continue;
+      }
+      perror( "accept");
+      break;
+    }
+
+    setsockopt( gdb_sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one));
+
+    memset( &session, 0, sizeof( session));
+    session.gdb_sock = gdb_sock;
+    session.caching = caching;
+    session.cache = &cache;
+    session.gdb_ack_mode = 1;
+    session.stub_ack_mode = 1;
+    session.max_read = MAX_READ;
+    clear_cache( &cache);
+    session.target_sock = command != NULL ? spawn_host( command) : connect_host( address);
+    if ( session.target_sock >= 0) {
+      runSession( &session);
+      reportSession( &session);
+      close( session.target_sock);
+      if ( command != NULL) {
+	wait( NULL);
+      }
+    }
+    close( gdb_sock);
+  }
+
+  return 0;
+}
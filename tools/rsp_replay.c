@@ -0,0 +1,550 @@
+/** \file
+ * \brief Replay a recorded GDB session against a stub and measure it.
+ *
+ * The trace (see debugstub/source/rsp_trace.h) is read and the latencies
+ * the stub recorded are reported. Given a target, the packets from GDB are
+ * sent to it in the recorded order, each reply waited for, and the time
+ * each command took from sending it to its reply arriving is reported
+ * instead. The recorded pauses are only kept before interrupts (so the
+ * application runs as long as it did), unless -p keeps them all.
+ *
+ * usage: rsp_replay [-p] [-c command | -t host:port] trace
+ *  -c runs the command with its stdin/stdout on a socketpair, as GDB's
+ *     'target remote |' does (e.g. linux_stub/linux_stub)
+ *  -t connects to a stub (or udp_bridge) over TCP
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "rsp_trace.h"
+#include "rsp_host.h"
+
+/** The most characters of a command used to group it */
+#define MAX_KEY 24
+
+/** The most command groups reported */
+#define MAX_GROUPS 64
+
+/** GDB's interrupt character */
+#define INTERRUPT_CHAR 0x03
+
+/** The key interrupts are reported under */
+#define INTERRUPT_KEY "^C"
+
+
+/** \brief A record read from the trace.
+ */
+struct record {
+  /** The record type */
+  int type;
+
+  /** The time of the record in nanoseconds from the start of the trace */
+  uint64_t time_ns;
+
+  /** The length of the packet */
+  uint32_t length;
+
+  /** The packet data (IN_TRACE only) */
+  uint8_t *data;
+};
+
+
+/** \brief The latencies of a group of commands.
+ */
+struct group {
+  /** The command name */
+  char key[MAX_KEY + 1];
+
+  /** The latencies in nanoseconds */
+  uint64_t *latencies;
+
+  /** The number of latencies */
+  uint32_t count;
+
+  /** The space for latencies */
+  uint32_t size;
+
+  /** The bytes sent and received for the group */
+  uint64_t bytes;
+};
+
+
+/** \brief The connection to the stub.
+ */
+struct target {
+  /** The socket */
+  int sock;
+
+  /** Flag set while packets are acknowledged */
+  int ack_mode;
+
+  /** Bytes received and not yet used */
+  uint8_t buffer[65536];
+
+  /** The number of bytes in the buffer */
+  uint32_t length;
+
+  /** The bytes sent */
+  uint64_t bytes_out;
+
+  /** The bytes received */
+  uint64_t bytes_in;
+};
+
+
+/** The command groups */
+static struct group groups[MAX_GROUPS];
+
+/** The number of command groups */
+static int group_count;
+
+
+/** Read a varint, returns 0 at the end of the trace. */
+static int
+readVarint( FILE *trace, uint32_t *value) {
+  int shift = 0;
+  int ch;
+
+  *value = 0;
+  do {
+    ch = fgetc( trace);
+    if ( ch == EOF || shift > 28) {
+      return 0;
+    }
+    *value |= (uint32_t)(ch & 0x7f) << shift;
+    shift += 7;
+  } while ( ch & 0x80);
+
+  return 1;
+}
+
+
+/** Read the whole trace. Returns the number of records, -1 if it is not a
+ * trace. */
+static int
+readTrace( const char *name, struct record **records_ptr) {
+  FILE *trace = fopen( name, "rb");
+  uint8_t header[HEADER_SIZE_TRACE];
+  struct record *records = NULL;
+  int count = 0;
+  int size = 0;
+  uint32_t tick_ns;
+  uint64_t time_ns = 0;
+  int type;
+
+  if ( trace == NULL) {
+    perror( name);
+    return -1;
+  }
+  if ( fread( header, 1, sizeof( header), trace) != sizeof( header) ||
+       memcmp( header, MAGIC_TRACE, 4) != 0 || header[4] != VERSION_TRACE) {
+    fprintf( stderr, "%s is not a trace\n", name);
+    fclose( trace);
+    return -1;
+  }
+  tick_ns = header[8] | (header[9] << 8) | (header[10] << 16) | ((uint32_t)header[11] << 24);
+
+  while ( (type = fgetc( trace)) != EOF) {
+    struct record *record;
+    uint32_t ticks;
+
+    if ( count == size) {
+      size = size ? size * 2 : 1024;
+      records = realloc( records, size * sizeof( *records));
+    }
+    record = &records[count];
+    record->type = type;
+    record->data = NULL;
+
+    if ( !readVarint( trace, &ticks) || !readVarint( trace, &record->length)) {
+      break;
+    }
+    time_ns += (uint64_t)ticks * tick_ns;
+    record->time_ns = time_ns;
+
+    if ( type == IN_TRACE) {
+      record->data = malloc( record->length + 1);
+      if ( fread( record->data, 1, record->length, trace) != record->length) {
+	break;
+      }
+      record->data[record->length] = 0;
+    }
+    count += 1;
+  }
+
+  fclose( trace);
+  *records_ptr = records;
+
+  return count;
+}
+
+
+/** Make the group name of a command. */
+static void
+commandKey( const struct record *record, char *key) {
+  uint32_t i = 0;
+
+  if ( record->length > 0 &&
+       (record->data[0] == 'q' || record->data[0] == 'Q' || record->data[0] == 'v')) {
+    /* the name of a query runs up to its arguments */
+    while ( i < record->length && i < MAX_KEY && strchr( ":,;?", record->data[i]) == NULL) {
+      key[i] = record->data[i];
+      i += 1;
+    }
+  }
+  else if ( record->length > 0) {
+    key[i++] = record->data[0];
+  }
+  key[i] = 0;
+}
+
+
+/** Add a latency to a group. */
+static void
+addLatency( const char *key, uint64_t latency, uint64_t bytes) {
+  struct group *group = NULL;
+  int i;
+
+  for ( i = 0; i < group_count; i++) {
+    if ( strcmp( groups[i].key, key) == 0) {
+      group = &groups[i];
+      break;
+    }
+  }
+  if ( group == NULL) {
+    if ( group_count == MAX_GROUPS) {
+      return;
+    }
+    group = &groups[group_count++];
+    strcpy( group->key, key);
+  }
+
+  if ( group->count == group->size) {
+    group->size = group->size ? group->size * 2 : 64;
+    group->latencies = realloc( group->latencies, group->size * sizeof( uint64_t));
+  }
+  group->latencies[group->count++] = latency;
+  group->bytes += bytes;
+}
+
+
+static int
+compareLatency( const void *a, const void *b) {
+  uint64_t la = *(const uint64_t *)a;
+  uint64_t lb = *(const uint64_t *)b;
+
+  return la < lb ? -1 : la > lb;
+}
+
+
+/** Return a percentile of sorted latencies in microseconds. */
+static double
+percentile( const struct group *group, int percent) {
+  uint32_t index = ((uint64_t)group->count * percent + 99) / 100;
+
+  if ( index > 0) {
+    index -= 1;
+  }
+
+  return group->latencies[index] / 1e3;
+}
+
+
+/** Print the latency table. */
+static void
+printGroups( void) {
+  int i;
+
+  printf( "%-24s %8s %10s %10s %10s %10s %12s\n",
+	  "command", "count", "p50 us", "p90 us", "p99 us", "max us", "bytes");
+  for ( i = 0; i < group_count; i++) {
+    struct group *group = &groups[i];
+
+    qsort( group->latencies, group->count, sizeof( uint64_t), compareLatency);
+    printf( "%-24s %8u %10.1f %10.1f %10.1f %10.1f %12llu\n",
+	    group->key, group->count, percentile( group, 50), percentile( group, 90),
+	    percentile( group, 99), group->latencies[group->count - 1] / 1e3,
+	    (unsigned long long)group->bytes);
+  }
+}
+
+
+/** Report the latencies the stub recorded, from a packet (or interrupt) to
+ * the reply that followed it. */
+static void
+reportRecorded( const struct record *records, int count) {
+  const struct record *request = NULL;
+  uint64_t bytes_in = 0;
+  uint64_t bytes_out = 0;
+  int i;
+
+  for ( i = 0; i < count; i++) {
+    const struct record *record = &records[i];
+
+    switch ( record->type) {
+    case IN_TRACE:
+    case BREAK_TRACE:
+      request = record;
+      bytes_in += record->length;
+      break;
+
+    case OUT_TRACE:
+      bytes_out += record->length;
+      if ( request != NULL) {
+	char key[MAX_KEY + 1];
+
+	if ( request->type == BREAK_TRACE) {
+	  strcpy( key, INTERRUPT_KEY);
+	}
+	else {
+	  commandKey( request, key);
+	}
+	addLatency( key, record->time_ns - request->time_ns,
+		    request->length + record->length);
+	request = NULL;
+      }
+      break;
+    }
+  }
+
+  printf( "Recorded: %d records over %.3fs, %llu packet bytes from GDB, %llu to GDB\n",
+	  count, count > 0 ? records[count - 1].time_ns / 1e9 : 0.0,
+	  (unsigned long long)bytes_in, (unsigned long long)bytes_out);
+  printGroups();
+}
+
+
+/** Send bytes to the stub. */
+static int
+sendTarget( struct target *target, const uint8_t *data, uint32_t length) {
+  target->bytes_out += length;
+
+  return sendAll_host( target->sock, data, length);
+}
+
+
+/** Send a packet to the stub. */
+static int
+sendPacket( struct target *target, const uint8_t *data, uint32_t length) {
+  uint8_t trailer[4];
+  uint8_t checksum = 0;
+  uint32_t i;
+
+  for ( i = 0; i < length; i++) {
+    checksum += data[i];
+  }
+  snprintf( (char *)trailer, sizeof( trailer), "#%02x", checksum);
+
+  return sendTarget( target, (const uint8_t *)"$", 1) &&
+    sendTarget( target, data, length) && sendTarget( target, trailer, 3);
+}
+
+
+/** Wait for the next packet from the stub, acknowledging it if needed.
+ * Returns the length between the '$' and '#', -1 if the stub has gone. */
+static int
+receivePacket( struct target *target, uint8_t **packet) {
+  static uint8_t copy[sizeof( target->buffer)];
+
+  while ( 1) {
+    uint8_t *start = memchr( target->buffer, '$', target->length);
+    uint8_t *end = start ? memchr( start, '#', target->length - (start - target->buffer)) : NULL;
+
+    if ( end != NULL && end + 3 <= target->buffer + target->length) {
+      int length = end - start - 1;
+      uint32_t used = end + 3 - target->buffer;
+
+      memcpy( copy, start + 1, length);
+      copy[length] = 0;
+      memmove( target->buffer, target->buffer + used, target->length - used);
+      target->length -= used;
+
+      if ( target->ack_mode && !sendTarget( target, (const uint8_t *)"+", 1)) {
+	return -1;
+      }
+      *packet = copy;
+      return length;
+    }
+
+    if ( target->length == sizeof( target->buffer)) {
+      /* too big to hold, drop what has been seen */
+      target->length = 0;
+    }
+    {
+      ssize_t read_len = recv( target->sock, target->buffer + target->length,
+			       sizeof( target->buffer) - target->length, 0);
+
+      if ( read_len <= 0) {
+	return -1;
+      }
+      target->bytes_in += read_len;
+      target->length += read_len;
+    }
+  }
+}
+
+
+/** Sleep for a number of nanoseconds. */
+static void
+sleepNs( uint64_t ns) {
+  struct timespec ts;
+
+  ts.tv_sec = ns / 1000000000;
+  ts.tv_nsec = ns % 1000000000;
+  while ( nanosleep( &ts, &ts) < 0 && errno == EINTR) {
+  }
+}
+
+
+/** Replay the packets from GDB, timing each reply. */
+static void
+replay( struct target *target, const struct record *records, int count, int keep_pauses) {
+  const struct record *request = NULL;
+  uint64_t request_ns = 0;
+  uint64_t start_ns = nowNs_host();
+  uint32_t packets = 0;
+  int i;
+
+  for ( i = 0; i < count; i++) {
+    const struct record *record = &records[i];
+    uint64_t pause = i > 0 ? record->time_ns - records[i - 1].time_ns : 0;
+
+    switch ( record->type) {
+    case IN_TRACE:
+      if ( keep_pauses) {
+	sleepNs( pause);
+      }
+      request = record;
+      request_ns = nowNs_host();
+      packets += 1;
+      if ( !sendPacket( target, record->data, record->length)) {
+	fprintf( stderr, "The stub has gone\n");
+	return;
+      }
+      break;
+
+    case BREAK_TRACE: {
+      uint8_t interrupt = INTERRUPT_CHAR;
+
+      /* the application runs for as long as it did */
+      sleepNs( pause);
+      request = record;
+      request_ns = nowNs_host();
+      if ( !sendTarget( target, &interrupt, 1)) {
+	fprintf( stderr, "The stub has gone\n");
+	return;
+      }
+      break;
+    }
+
+    case OUT_TRACE: {
+      uint8_t *packet;
+      int length = receivePacket( target, &packet);
+
+      if ( length < 0) {
+	fprintf( stderr, "The stub has gone\n");
+	return;
+      }
+      if ( request != NULL) {
+	char key[MAX_KEY + 1];
+
+	if ( request->type == BREAK_TRACE) {
+	  strcpy( key, INTERRUPT_KEY);
+	}
+	else {
+	  commandKey( request, key);
+	}
+	addLatency( key, nowNs_host() - request_ns, request->length + length);
+
+	if ( request->type == IN_TRACE && strcmp( (char *)request->data, "QStartNoAckMode") == 0 &&
+	     strcmp( (char *)packet, "OK") == 0) {
+	  target->ack_mode = 0;
+	}
+	request = NULL;
+      }
+      break;
+    }
+    }
+  }
+
+  {
+    double seconds = (nowNs_host() - start_ns) / 1e9;
+
+    printf( "Replayed: %u packets in %.3fs (%.0f packets/s), %llu bytes sent, %llu received\n",
+	    packets, seconds, packets / seconds,
+	    (unsigned long long)target->bytes_out, (unsigned long long)target->bytes_in);
+  }
+  printGroups();
+}
+
+
+static void
+usage( const char *name) {
+  fprintf( stderr, "usage: %s [-p] [-c command | -t host:port] trace\n", name);
+  exit( 1);
+}
+
+
+int
+main( int argc, char **argv) {
+  static struct target target;
+  struct record *records;
+  const char *command = NULL;
+  const char *address = NULL;
+  int keep_pauses = 0;
+  int count;
+  int opt;
+
+  while ( (opt = getopt( argc, argv, "pc:t:")) != -1) {
+    switch ( opt) {
+    case 'p':
+      keep_pauses = 1;
+      break;
+    case 'c':
+      command = optarg;
+      break;
+    case 't':
+      address = optarg;
+      break;
+    default:
+      usage( argv[0]);
+    }
+  }
+  if ( argc - optind != 1 || (command != NULL && address != NULL)) {
+    usage( argv[0]);
+  }
+
+  count = readTrace( argv[optind], &records);
+  if ( count < 0) {
+    return 1;
+  }
+
+  if ( command == NULL && address == NULL) {
+    reportRecorded( records, count);
+    return 0;
+  }
+
+  signal( SIGPIPE, SIG_IGN);
+  target.sock = command != NULL ? spawn_host( command) : connect_host( address);
+  if ( target.sock < 0) {
+    return 1;
+  }
+  target.ack_mode = 1;
+
+  replay( &target, records, count, keep_pauses);
+
+  close( target.sock);
+  if ( command != NULL) {
+    wait( NULL);
+  }
+
+  return 0;
+}
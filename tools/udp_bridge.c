@@ -0,0 +1,412 @@
+/** \file
+ * \brief Host bridge between GDB's TCP remote protocol and the DS UDP comms.
+ *
+ * Listens for GDB on a TCP port and carries the byte stream to the DS over a
+ * udp_link. Datagram loss and delay can be injected in both directions to
+ * compare the link with TCP over a poor connection.
+ *
+ * usage: udp_bridge [-p tcp_port] [-l loss_percent] [-d delay_ms] ds_address ds_port
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "udp_link.h"
+
+/** The default port GDB connects to */
+#define DEFAULT_TCP_PORT 2331
+
+/** The most datagrams that can be held back by the delay injection */
+#define MAX_DELAYED 256
+
+/** The interval the link is ticked at */
+#define TICK_MS 5
+
+/** The number of times a HELLO is sent before giving up on the DS */
+#define HELLO_TRIES 50
+
+
+/** \brief A datagram held back by the delay injection.
+ */
+struct delayed_datagram {
+  /** Flag set if the datagram is going to the DS, clear if it came from it */
+  int outgoing;
+
+  /** The time it is released */
+  uint32_t release;
+
+  /** The datagram length */
+  uint32_t length;
+
+  /** The datagram */
+  uint8_t data[LINK_HEADER_SIZE + LINK_MAX_PAYLOAD];
+};
+
+
+/** \brief The bridge state.
+ */
+struct bridge {
+  /** The UDP socket to the DS */
+  int udp_sock;
+
+  /** The DS address */
+  struct sockaddr_in ds_addr;
+
+  /** The connection to GDB */
+  int gdb_sock;
+
+  /** The link to the DS */
+  struct udp_link link;
+
+  /** The percentage of datagrams to drop */
+  int loss_percent;
+
+  /** The delay added to each datagram */
+  uint32_t delay_ms;
+
+  /** The datagrams held back */
+  struct delayed_datagram delayed[MAX_DELAYED];
+
+  /** The number of datagrams held back */
+  int delayed_count;
+
+  /** The number of datagrams dropped */
+  uint32_t dropped;
+
+  /** The type of the last datagram handed to the link */
+  int last_type;
+};
+
+
+/** Set by SIGINT to stop the bridge */
+static volatile sig_atomic_t stop_bridge;
+
+
+/** Return the time in milliseconds. */
+static uint32_t
+nowMs( void) {
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/** Decide if the loss injection drops a datagram. */
+static int
+dropDatagram( struct bridge *bridge) {
+  if ( bridge->loss_percent > 0 && rand() % 100 < bridge->loss_percent) {
+    bridge->dropped += 1;
+    return 1;
+  }
+  return 0;
+}
+
+
+/** Hold a datagram back for the injected delay. */
+static void
+delayDatagram( struct bridge *bridge, int outgoing, const uint8_t *data, uint32_t length) {
+  struct delayed_datagram *delayed;
+
+  if ( bridge->delayed_count == MAX_DELAYED) {
+    bridge->dropped += 1;
+    return;
+  }
+
+  delayed = &bridge->delayed[bridge->delayed_count++];
+  delayed->outgoing = outgoing;
+  delayed->release = nowMs() + bridge->delay_ms;
+  delayed->length = length;
+  memcpy( delayed->data, data, length);
+}
+
+
+/** Put a datagram on the wire. */
+static void
+transmit( struct bridge *bridge, const uint8_t *data, uint32_t length) {
+  sendto( bridge->udp_sock, data, length, 0,
+	  (struct sockaddr *)&bridge->ds_addr, sizeof( bridge->ds_addr));
+}
+
+
+/** The link send function, applying the loss and delay injection. */
+static void
+sendDatagram( void *context, const uint8_t *data, uint32_t length) {
+  struct bridge *bridge = context;
+
+  if ( dropDatagram( bridge)) {
+    return;
+  }
+  if ( bridge->delay_ms > 0) {
+    delayDatagram( bridge, 1, data, length);
+  }
+  else {
+    transmit( bridge, data, length);
+  }
+}
+
+
+/** Hand the link a datagram from the DS. */
+static void
+receiveDatagram( struct bridge *bridge, const uint8_t *data, uint32_t length) {
+  bridge->last_type = receive_link( &bridge->link, data, length, nowMs());
+}
+
+
+/** Release the held back datagrams that are due. */
+static void
+releaseDelayed( struct bridge *bridge) {
+  uint32_t now = nowMs();
+  int i = 0;
+
+  while ( i < bridge->delayed_count) {
+    struct delayed_datagram *delayed = &bridge->delayed[i];
+
+    if ( (int32_t)(now - delayed->release) >= 0) {
+      struct delayed_datagram released = *delayed;
+
+      /* keep the order of the rest */
+      bridge->delayed_count -= 1;
+      memmove( delayed, delayed + 1, (bridge->delayed_count - i) * sizeof( *delayed));
+
+      if ( released.outgoing) {
+	transmit( bridge, released.data, released.length);
+      }
+      else {
+	receiveDatagram( bridge, released.data, released.length);
+      }
+    }
+    else {
+      i += 1;
+    }
+  }
+}
+
+
+/** Read the datagrams waiting from the DS. */
+static void
+readDatagrams( struct bridge *bridge) {
+  uint8_t data[LINK_HEADER_SIZE + LINK_MAX_PAYLOAD];
+
+  while ( 1) {
+    ssize_t length = recv( bridge->udp_sock, data, sizeof( data), MSG_DONTWAIT);
+
+    if ( length <= 0) {
+      break;
+    }
+    if ( dropDatagram( bridge)) {
+      continue;
+    }
+    if ( bridge->delay_ms > 0) {
+      delayDatagram( bridge, 0, data, length);
+    }
+    else {
+      receiveDatagram( bridge, data, length);
+    }
+  }
+}
+
+
+/** Reset the DS end of the link, waiting for it to answer. */
+static int
+sayHello( struct bridge *bridge) {
+  int tries;
+
+  for ( tries = 0; tries < HELLO_TRIES; tries++) {
+    uint32_t start = nowMs();
+
+    hello_link( &bridge->link);
+    bridge->last_type = -1;
+
+    while ( nowMs() - start < 200) {
+      struct pollfd pfd = { bridge->udp_sock, POLLIN, 0 };
+
+      poll( &pfd, 1, TICK_MS);
+      readDatagrams( bridge);
+      releaseDelayed( bridge);
+      if ( bridge->last_type == ACK_LINK) {
+	return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+
+/** Service the link and pass on what the DS has sent.
+ * Returns 0 if GDB has gone. */
+static int
+pumpLink( struct bridge *bridge) {
+  uint8_t buffer[LINK_RING_SIZE];
+  uint32_t length;
+
+  releaseDelayed( bridge);
+  readDatagrams( bridge);
+  tick_link( &bridge->link, nowMs());
+
+  while ( (length = readData_link( &bridge->link, buffer, sizeof( buffer))) > 0) {
+    if ( send( bridge->gdb_sock, buffer, length, 0) < 0) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+
+/** Carry a GDB session to and from the DS until either side closes. */
+static void
+runSession( struct bridge *bridge) {
+  uint8_t buffer[LINK_RING_SIZE];
+
+  while ( !stop_bridge) {
+    struct pollfd pfds[2];
+
+    pfds[0].fd = bridge->gdb_sock;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = bridge->udp_sock;
+    pfds[1].events = POLLIN;
+
+    /* only take more from GDB while the window has room */
+    if ( bridge->link.filling == NULL &&
+	 (uint16_t)(bridge->link.tx_next - bridge->link.tx_oldest) >= LINK_WINDOW) {
+      pfds[0].events = 0;
+    }
+
+    poll( pfds, 2, TICK_MS);
+
+    if ( pfds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+      ssize_t read_len = recv( bridge->gdb_sock, buffer, sizeof( buffer), 0);
+      uint32_t taken = 0;
+
+      if ( read_len <= 0) {
+	break;
+      }
+      while ( taken < (uint32_t)read_len && !stop_bridge) {
+	taken += writeData_link( &bridge->link, &buffer[taken], read_len - taken, nowMs());
+	if ( taken < (uint32_t)read_len) {
+	  /* wait for acks */
+	  poll( &pfds[1], 1, TICK_MS);
+	  if ( !pumpLink( bridge)) {
+	    return;
+	  }
+	}
+      }
+      flush_link( &bridge->link, nowMs());
+    }
+
+    if ( !pumpLink( bridge)) {
+      return;
+    }
+  }
+}
+
+
+static void
+stopHandler( int sig __attribute__((unused))) {
+  stop_bridge = 1;
+}
+
+
+static void
+usage( const char *name) {
+  fprintf( stderr, "usage: %s [-p tcp_port] [-l loss_percent] [-d delay_ms] ds_address ds_port\n",
+	   name);
+  exit( 1);
+}
+
+
+int
+main( int argc, char **argv) {
+  static struct bridge bridge;
+  int tcp_port = DEFAULT_TCP_PORT;
+  int listen_sock;
+  struct sockaddr_in sain;
+  int opt;
+  int one = 1;
+
+  while ( (opt = getopt( argc, argv, "p:l:d:")) != -1) {
+    switch ( opt) {
+    case 'p':
+      tcp_port = atoi( optarg);
+      break;
+    case 'l':
+      bridge.loss_percent = atoi( optarg);
+      break;
+    case 'd':
+      bridge.delay_ms = atoi( optarg);
+      break;
+    default:
+      usage( argv[0]);
+    }
+  }
+  if ( argc - optind != 2) {
+    usage( argv[0]);
+  }
+
+  memset( &bridge.ds_addr, 0, sizeof( bridge.ds_addr));
+  bridge.ds_addr.sin_family = AF_INET;
+  bridge.ds_addr.sin_port = htons( atoi( argv[optind + 1]));
+  if ( inet_aton( argv[optind], &bridge.ds_addr.sin_addr) == 0) {
+    fprintf( stderr, "Bad DS address %s\n", argv[optind]);
+    return 1;
+  }
+
+  bridge.udp_sock = socket( AF_INET, SOCK_DGRAM, 0);
+  init_link( &bridge.link, sendDatagram, &bridge);
+
+  listen_sock = socket( AF_INET, SOCK_STREAM, 0);
+  setsockopt( listen_sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof( one));
+  memset( &sain, 0, sizeof( sain));
+  sain.sin_family = AF_INET;
+  sain.sin_port = htons( tcp_port);
+  sain.sin_addr.s_addr = htonl( INADDR_LOOPBACK);
+  if ( bind( listen_sock, (struct sockaddr *)&sain, sizeof( sain)) < 0 ||
+       listen( listen_sock, 1) < 0) {
+    perror( "listen");
+    return 1;
+  }
+
+  signal( SIGINT, stopHandler);
+  signal( SIGPIPE, SIG_IGN);
+
+  while ( !stop_bridge) {
+    printf( "Waiting for GDB on port %d\n", tcp_port);
+    bridge.gdb_sock = accept( listen_sock, NULL, NULL);
+    if ( bridge.gdb_sock < 0) {
+      if ( errno == EINTR) {
+	continue;
+      }
+      perror( "accept");
+      break;
+    }
+    setsockopt( bridge.gdb_sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one));
+
+    if ( !sayHello( &bridge)) {
+      fprintf( stderr, "No answer from the DS\n");
+    }
+    else {
+      printf( "Connected to the DS\n");
+      runSession( &bridge);
+    }
+    close( bridge.gdb_sock);
+
+    printf( "Session ended: %u timeout resends, %u fast resends, %u duplicates, %u injected drops\n",
+	    bridge.link.stats.timeout_resends, bridge.link.stats.fast_resends,
+	    bridge.link.stats.duplicates, bridge.dropped);
+  }
+
+  return 0;
+}
@@ -0,0 +1,361 @@
+/** \file
+ * \brief The debug stub UDP network comms.
+ *
+ * The stream to GDB is carried by a udp_link. Datagrams are read from the
+ * socket by the Timer 3 interrupt that dswifi already needs, which also
+ * keeps the link time, and by the poll function. The link is only touched
+ * with interrupts masked, waits for acks let the interrupt through. The
+ * application runs until a bridge says hello.
+ */
+#include <nds.h>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <dswifi9.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <debug_stub.h>
+#include "debug_udp.h"
+#include "udp_link.h"
+
+#ifdef DO_LOGGING
+#define LOG( fmt, ...) logFn_debug( fmt, ##__VA_ARGS__)
+#else
+#define LOG( fmt, ...)
+#endif
+
+/** The period of the Timer 3 interrupt dswifi is driven from, if the
+ * application does not give one */
+#define WIFI_TIMER_MS 50
+
+/** How long a detach waits for the last reply to be acked */
+#define DISCONNECT_WAIT_MS 1000
+
+/** GDB's interrupt character */
+#define INTERRUPT_CHAR 0x03
+
+#ifdef TICK_TIMING
+/** The timer pair cpuStartTiming uses to measure the interrupt */
+#define TICK_TIMING_TIMER 0
+#endif
+
+
+/** The socket datagrams are sent and received on */
+static int udp_sock = -1;
+
+/** The address of the bridge */
+static struct sockaddr_in peer_addr;
+
+/** Flag set once the bridge has said hello */
+static int have_peer;
+
+/** The link time in milliseconds, advanced by the timer interrupt */
+static volatile uint32_t now_ms;
+
+/** The period Timer 3 runs at */
+static uint32_t timer_ms = WIFI_TIMER_MS;
+
+/** The application's Timer 3 work, NULL if none */
+static void (*app_timer_fn)( void);
+
+/** The instance of the link */
+static struct udp_link udp_link;
+
+/** The timer interrupt cost, see struct udp_debug_comms_stats */
+static uint32_t tick_cycles;
+
+/** The most the timer interrupt has cost */
+static uint32_t tick_cycles_max;
+
+
+/* send a datagram to the bridge */
+static void
+sendDatagram( void *context __attribute__((unused)),
+	      const uint8_t *datagram, uint32_t length) {
+  sendto( udp_sock, datagram, length, 0,
+	  (struct sockaddr *)&peer_addr, sizeof( peer_addr));
+}
+
+
+/*
+ * Process the datagrams waiting in the socket and resend anything overdue,
+ * asking the stub to stop the application if GDB's interrupt character
+ * arrives.
+ * Must not be interrupted by the timer interrupt.
+ */
+static void
+serviceLink( void) {
+  uint8_t datagram[LINK_HEADER_SIZE + LINK_MAX_PAYLOAD];
+  int interrupt = 0;
+
+  while ( 1) {
+    struct sockaddr_in from;
+    int from_size = sizeof( from);
+    int length = recvfrom( udp_sock, datagram, sizeof( datagram), 0,
+			   (struct sockaddr *)&from, &from_size);
+
+    if ( length <= 0) {
+      break;
+    }
+
+    if ( datagram[0] == HELLO_LINK) {
+      /* a (new) bridge, it becomes the peer and GDB is attaching */
+      peer_addr = from;
+      have_peer = 1;
+      attachRequest_debug();
+    }
+    else if ( !have_peer || from.sin_addr.s_addr != peer_addr.sin_addr.s_addr ||
+	      from.sin_port != peer_addr.sin_port) {
+      continue;
+    }
+
+    if ( receive_link( &udp_link, datagram, length, now_ms) == DATA_LINK &&
+	 memchr( &datagram[LINK_HEADER_SIZE], INTERRUPT_CHAR,
+		 length - LINK_HEADER_SIZE) != NULL) {
+      interrupt = 1;
+    }
+  }
+
+  if ( have_peer) {
+    tick_link( &udp_link, now_ms);
+  }
+
+  if ( interrupt) {
+    /* ignored while the stub is running */
+    interruptRequest_debug();
+  }
+}
+
+
+/*
+ * The Timer 3 interrupt, keeps dswifi going and does the application's
+ * work as its handler would, then services the link.
+ */
+static void
+timerIRQ( void) {
+  Wifi_Timer( timer_ms);
+  if ( app_timer_fn != NULL) {
+    app_timer_fn();
+  }
+
+#ifdef TICK_TIMING
+  cpuStartTiming( TICK_TIMING_TIMER);
+#endif
+
+  now_ms += timer_ms;
+  serviceLink();
+
+#ifdef TICK_TIMING
+  tick_cycles = cpuEndTiming();
+  if ( tick_cycles > tick_cycles_max) {
+    tick_cycles_max = tick_cycles;
+  }
+#endif
+}
+
+
+/*
+ * The initialisation function
+ */
+static int
+init_fn( void *data) {
+  struct udp_debug_comms_init_data *init_data =
+    (struct udp_debug_comms_init_data *)data;
+  struct sockaddr_in sain;
+  int temp_flag = 1;
+
+  if ( init_data == NULL) {
+    LOG("Have not been given initialisation data.\n");
+    return 0;
+  }
+
+  init_link( &udp_link, sendDatagram, NULL);
+
+  sain.sin_addr.s_addr = 0;
+  sain.sin_family = AF_INET;
+  sain.sin_port = htons( init_data->port);
+  udp_sock = socket( AF_INET, SOCK_DGRAM, 0);
+  bind( udp_sock, (struct sockaddr *)&sain, sizeof(sain));
+  ioctl( udp_sock, FIONBIO, &temp_flag);
+
+  /* the bridge is heard by the timer interrupt */
+  LOG( "Listening for the bridge\n");
+
+  /* the handler takes the place of the application's */
+  timer_ms = init_data->timer_ms != 0 ? init_data->timer_ms : WIFI_TIMER_MS;
+  app_timer_fn = init_data->timer_fn;
+  irqSet( IRQ_TIMER3, timerIRQ);
+
+  return 1;
+}
+
+
+/*
+ * Wait for the next timer interrupt with interrupts let through, it moves
+ * the link time on and services the link. Called and returns with them
+ * masked. The stub runs with the comms interrupts enabled, so the wait
+ * ends.
+ */
+static void
+waitTick( uint16_t master_irq) {
+  REG_IME = master_irq;
+  swiIntrWait( 1, IRQ_TIMER3);
+  REG_IME = 0;
+}
+
+
+static void
+poll_fn( void) {
+  uint16_t master_irq = REG_IME;
+
+  REG_IME = 0;
+  serviceLink();
+  REG_IME = master_irq;
+}
+
+
+static int
+readData_fn( uint8_t *buffer, uint32_t max) {
+  uint16_t master_irq = REG_IME;
+  int read_len;
+
+  REG_IME = 0;
+  read_len = readData_link( &udp_link, buffer, max);
+  REG_IME = master_irq;
+
+  return read_len;
+}
+
+
+static int
+readByte_fn( uint8_t *read_byte) {
+  return readData_fn( read_byte, 1);
+}
+
+
+/* the blocks are gathered into as few datagrams as possible */
+static void
+writeVector_fn( const struct iovec_debug *vector, int count) {
+  int i;
+
+  for ( i = 0; i < count; i++) {
+    const uint8_t *data = vector[i].base;
+    uint32_t remaining = vector[i].length;
+
+    while ( remaining > 0) {
+      uint16_t master_irq = REG_IME;
+      uint32_t taken;
+
+      REG_IME = 0;
+      taken = writeData_link( &udp_link, data, remaining, now_ms);
+      if ( taken == 0) {
+	/* the window is full, take in the acks that have arrived */
+	Wifi_Update();
+	serviceLink();
+	taken = writeData_link( &udp_link, data, remaining, now_ms);
+	if ( taken == 0) {
+	  /* the resends need the time to move on */
+	  waitTick( master_irq);
+	}
+      }
+      REG_IME = master_irq;
+
+      data += taken;
+      remaining -= taken;
+    }
+  }
+
+  {
+    uint16_t master_irq = REG_IME;
+
+    REG_IME = 0;
+    flush_link( &udp_link, now_ms);
+    REG_IME = master_irq;
+  }
+}
+
+
+static void
+writeData_fn( uint8_t *buffer, uint32_t count) {
+  struct iovec_debug vector;
+
+  vector.base = buffer;
+  vector.length = count;
+  writeVector_fn( &vector, 1);
+}
+
+
+static void
+writeByte_fn( uint8_t byte) {
+  writeData_fn( &byte, 1);
+}
+
+
+/* forget the bridge once the last reply has been acked (or given up on) */
+static void
+disconnect_fn( void) {
+  uint32_t start = now_ms;
+  uint16_t master_irq = REG_IME;
+
+  REG_IME = 0;
+  while ( !idle_link( &udp_link) && now_ms - start < DISCONNECT_WAIT_MS) {
+    Wifi_Update();
+    serviceLink();
+    if ( !idle_link( &udp_link)) {
+      waitTick( master_irq);
+    }
+  }
+  have_peer = 0;
+  reset_link( &udp_link);
+  REG_IME = master_irq;
+
+  LOG( "Bridge disconnected\n");
+}
+
+
+static uint32_t
+irqs_fn( void) {
+  /* the Timer interrupt is needed */
+  return IRQ_TIMER3;
+}
+
+
+/* read the link statistics */
+void
+getStats_udp( struct udp_debug_comms_stats *stats) {
+  uint16_t master_irq = REG_IME;
+
+  REG_IME = 0;
+  stats->timeout_resends = udp_link.stats.timeout_resends;
+  stats->fast_resends = udp_link.stats.fast_resends;
+  stats->duplicates = udp_link.stats.duplicates;
+  stats->ring_drops = udp_link.stats.ring_drops;
+  stats->tick_cycles = tick_cycles;
+  stats->tick_cycles_max = tick_cycles_max;
+  REG_IME = master_irq;
+}
+
+
+/** The instance of the comms function interface */
+struct comms_fn_iface_debug udpCommsIf_debug = {
+  .init_fn = init_fn,
+
+  .readByte_fn = readByte_fn,
+
+  .writeByte_fn = writeByte_fn,
+
+  .writeData_fn = writeData_fn,
+
+  .poll_fn = poll_fn,
+
+  .get_IRQs = irqs_fn,
+
+  .readData_fn = readData_fn,
+
+  .writeVector_fn = writeVector_fn,
+
+  .disconnect_fn = disconnect_fn
+};
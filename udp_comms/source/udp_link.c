@@ -0,0 +1,383 @@
+/** \file
+ * \brief A reliable byte stream carried in UDP datagrams.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "udp_link.h"
+
+
+/** Read a little endian 16 bit value */
+static uint16_t
+get16( const uint8_t *ptr) {
+  return ptr[0] | (ptr[1] << 8);
+}
+
+
+/** Write a little endian 16 bit value */
+static void
+put16( uint8_t *ptr, uint16_t value) {
+  ptr[0] = value & 0xff;
+  ptr[1] = value >> 8;
+}
+
+
+/** Return the selective ack bits describing the datagrams held out of order. */
+static uint16_t
+sackBits( const struct udp_link *link) {
+  uint16_t bits = 0;
+  int i;
+
+  for ( i = 0; i < LINK_WINDOW - 1; i++) {
+    uint16_t seq = link->rx_next + 1 + i;
+    const struct slot_link *slot = &link->rx[seq % LINK_WINDOW];
+
+    if ( slot->in_use && slot->seq == seq) {
+      bits |= 1 << i;
+    }
+  }
+
+  return bits;
+}
+
+
+/** Fill in a datagram header carrying the current acknowledgements. */
+static void
+putHeader( const struct udp_link *link, uint8_t *datagram, int type, uint16_t seq) {
+  datagram[0] = type;
+  datagram[1] = 0;
+  put16( &datagram[2], seq);
+  put16( &datagram[4], link->rx_next);
+  put16( &datagram[6], sackBits( link));
+}
+
+
+/** Send a datagram carrying no data. */
+static void
+sendControl( struct udp_link *link, int type) {
+  uint8_t datagram[LINK_HEADER_SIZE];
+
+  putHeader( link, datagram, type, link->tx_next);
+  link->send_fn( link->context, datagram, LINK_HEADER_SIZE);
+}
+
+
+/** (Re)send a data datagram, refreshing the acknowledgements it carries. */
+static void
+sendSlot( struct udp_link *link, struct slot_link *slot, uint32_t now) {
+  putHeader( link, slot->datagram, DATA_LINK, slot->seq);
+  link->send_fn( link->context, slot->datagram, LINK_HEADER_SIZE + slot->length);
+  slot->sent = 1;
+  slot->sent_time = now;
+}
+
+
+/** Put a payload in the stream buffer. Returns 0 if there is no room. */
+static int
+deliver( struct udp_link *link, const uint8_t *data, uint32_t length) {
+  uint32_t offset = link->head & (LINK_RING_SIZE - 1);
+  uint32_t first = LINK_RING_SIZE - offset;
+
+  if ( LINK_RING_SIZE - (link->head - link->tail) < length) {
+    link->stats.ring_drops += 1;
+    return 0;
+  }
+
+  if ( first > length) {
+    first = length;
+  }
+  memcpy( &link->ring[offset], data, first);
+  memcpy( &link->ring[0], &data[first], length - first);
+  link->head += length;
+
+  return 1;
+}
+
+
+/** Deliver the datagrams held out of order that are now next in line. */
+static void
+deliverWaiting( struct udp_link *link) {
+  while ( 1) {
+    struct slot_link *slot = &link->rx[link->rx_next % LINK_WINDOW];
+
+    if ( !slot->in_use || slot->seq != link->rx_next ||
+	 !deliver( link, &slot->datagram[LINK_HEADER_SIZE], slot->length)) {
+      break;
+    }
+    slot->in_use = 0;
+    link->rx_next += 1;
+  }
+}
+
+
+/** Process the acknowledgements carried by a datagram from the peer. */
+static void
+processAcks( struct udp_link *link, uint16_t ack, uint16_t sack, uint32_t now) {
+  uint16_t in_flight = link->tx_next - link->tx_oldest;
+  uint16_t highest_sacked = 0;
+  int have_sacked = 0;
+  uint16_t seq;
+  int i;
+
+  /* ignore acks for data that has not been sent */
+  if ( (uint16_t)(ack - link->tx_oldest) > in_flight) {
+    return;
+  }
+
+  /* release everything before the cumulative ack */
+  while ( link->tx_oldest != ack) {
+    struct slot_link *slot = &link->tx[link->tx_oldest % LINK_WINDOW];
+
+    if ( slot == link->filling) {
+      break;
+    }
+    slot->in_use = 0;
+    link->tx_oldest += 1;
+  }
+
+  /* mark the selectively acked ones */
+  for ( i = 0; i < 16; i++) {
+    if ( sack & (1 << i)) {
+      seq = ack + 1 + i;
+
+      if ( (uint16_t)(seq - link->tx_oldest) < (uint16_t)(link->tx_next - link->tx_oldest)) {
+	link->tx[seq % LINK_WINDOW].sacked = 1;
+	highest_sacked = seq;
+	have_sacked = 1;
+      }
+    }
+  }
+
+  /* anything missing before a selectively acked datagram has been lost */
+  if ( have_sacked) {
+    for ( seq = link->tx_oldest; seq != highest_sacked; seq++) {
+      struct slot_link *slot = &link->tx[seq % LINK_WINDOW];
+
+      if ( slot->sent && !slot->sacked && !slot->fast_resent) {
+	slot->fast_resent = 1;
+	link->stats.fast_resends += 1;
+	sendSlot( link, slot, now);
+      }
+    }
+  }
+}
+
+
+/** Process a data datagram from the peer. */
+static void
+processData( struct udp_link *link, uint16_t seq, const uint8_t *data, uint32_t length) {
+  uint16_t ahead = seq - link->rx_next;
+
+  if ( ahead == 0) {
+    if ( deliver( link, data, length)) {
+      link->rx_next += 1;
+
+      /* and whatever was waiting behind it */
+      deliverWaiting( link);
+    }
+  }
+  else if ( ahead < LINK_WINDOW) {
+    struct slot_link *slot = &link->rx[seq % LINK_WINDOW];
+
+    /* a held datagram with another sequence number has been delivered since */
+    if ( !slot->in_use || slot->seq != seq) {
+      memcpy( &slot->datagram[LINK_HEADER_SIZE], data, length);
+      slot->length = length;
+      slot->seq = seq;
+      slot->in_use = 1;
+    }
+  }
+  else {
+    link->stats.duplicates += 1;
+  }
+}
+
+
+/* initialise a link */
+void
+init_link( struct udp_link *link,
+	   void (*send_fn)( void *context, const uint8_t *datagram, uint32_t length),
+	   void *context) {
+  memset( link, 0, sizeof( *link));
+  link->send_fn = send_fn;
+  link->context = context;
+}
+
+
+/* start the stream again */
+void
+reset_link( struct udp_link *link) {
+  int i;
+
+  for ( i = 0; i < LINK_WINDOW; i++) {
+    link->tx[i].in_use = 0;
+    link->rx[i].in_use = 0;
+  }
+  link->tx_next = 0;
+  link->tx_oldest = 0;
+  link->filling = NULL;
+  link->rx_next = 0;
+  link->head = 0;
+  link->tail = 0;
+}
+
+
+/* reset both ends of the link */
+void
+hello_link( struct udp_link *link) {
+  reset_link( link);
+  sendControl( link, HELLO_LINK);
+}
+
+
+/* process a datagram from the peer */
+int
+receive_link( struct udp_link *link, const uint8_t *datagram, uint32_t length, uint32_t now) {
+  int type;
+
+  if ( length < LINK_HEADER_SIZE || length > LINK_HEADER_SIZE + LINK_MAX_PAYLOAD) {
+    return -1;
+  }
+
+  type = datagram[0];
+  switch ( type) {
+  case HELLO_LINK:
+    reset_link( link);
+    sendControl( link, ACK_LINK);
+    break;
+
+  case DATA_LINK:
+    processAcks( link, get16( &datagram[4]), get16( &datagram[6]), now);
+    processData( link, get16( &datagram[2]),
+		 &datagram[LINK_HEADER_SIZE], length - LINK_HEADER_SIZE);
+    /* acknowledge at once, the peer is waiting for a reply */
+    sendControl( link, ACK_LINK);
+    break;
+
+  case ACK_LINK:
+    processAcks( link, get16( &datagram[4]), get16( &datagram[6]), now);
+    break;
+
+  default:
+    type = -1;
+    break;
+  }
+
+  return type;
+}
+
+
+/* take data from the received stream */
+uint32_t
+readData_link( struct udp_link *link, uint8_t *buffer, uint32_t max) {
+  uint32_t available = link->head - link->tail;
+  uint32_t offset = link->tail & (LINK_RING_SIZE - 1);
+  uint32_t first = LINK_RING_SIZE - offset;
+
+  if ( max > available) {
+    max = available;
+  }
+  if ( first > max) {
+    first = max;
+  }
+  memcpy( buffer, &link->ring[offset], first);
+  memcpy( &buffer[first], &link->ring[0], max - first);
+  link->tail += max;
+
+  /* held datagrams the peer will not resend may now fit, the peer has to
+   * hear about them as nothing else would tell it */
+  if ( max > 0) {
+    uint16_t rx_next = link->rx_next;
+
+    deliverWaiting( link);
+    if ( link->rx_next != rx_next) {
+      sendControl( link, ACK_LINK);
+    }
+  }
+
+  return max;
+}
+
+
+/* add data to the stream */
+uint32_t
+writeData_link( struct udp_link *link, const uint8_t *data, uint32_t count, uint32_t now) {
+  uint32_t taken = 0;
+
+  while ( taken < count) {
+    struct slot_link *slot = link->filling;
+    uint32_t space;
+
+    if ( slot == NULL) {
+      if ( (uint16_t)(link->tx_next - link->tx_oldest) >= LINK_WINDOW) {
+	/* wait for some acks */
+	break;
+      }
+
+      slot = &link->tx[link->tx_next % LINK_WINDOW];
+      slot->seq = link->tx_next;
+      slot->length = 0;
+      slot->in_use = 1;
+      slot->sent = 0;
+      slot->sacked = 0;
+      slot->fast_resent = 0;
+      link->tx_next += 1;
+      link->filling = slot;
+    }
+
+    space = LINK_MAX_PAYLOAD - slot->length;
+    if ( space > count - taken) {
+      space = count - taken;
+    }
+    memcpy( &slot->datagram[LINK_HEADER_SIZE + slot->length], &data[taken], space);
+    slot->length += space;
+    taken += space;
+
+    if ( slot->length == LINK_MAX_PAYLOAD) {
+      link->filling = NULL;
+      sendSlot( link, slot, now);
+    }
+  }
+
+  return taken;
+}
+
+
+/* send the partly filled datagram */
+void
+flush_link( struct udp_link *link, uint32_t now) {
+  if ( link->filling != NULL) {
+    struct slot_link *slot = link->filling;
+
+    link->filling = NULL;
+    sendSlot( link, slot, now);
+  }
+}
+
+
+/* resend what has not been acked in time */
+void
+tick_link( struct udp_link *link, uint32_t now) {
+  uint16_t seq;
+
+  for ( seq = link->tx_oldest; seq != link->tx_next; seq++) {
+    struct slot_link *slot = &link->tx[seq % LINK_WINDOW];
+
+    /* a selectively acked one is only resent in case the ack that
+     * should have released it was lost */
+    if ( slot->sent &&
+	 now - slot->sent_time >= (slot->sacked ? 4 : 1) * LINK_RETRANSMIT_MS) {
+      slot->fast_resent = 0;
+      link->stats.timeout_resends += 1;
+      sendSlot( link, slot, now);
+    }
+  }
+}
+
+
+/* check everything has been acked */
+int
+idle_link( const struct udp_link *link) {
+  return link->tx_oldest == link->tx_next;
+}
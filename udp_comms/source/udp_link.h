@@ -0,0 +1,191 @@
+#ifndef _UDP_LINK_H_
+#define _UDP_LINK_H_ 1
+/** \file
+ * \brief A reliable byte stream carried in UDP datagrams.
+ *
+ * Each datagram starts with an eight byte header, all values little endian:
+ *  - byte 0: the datagram type (DATA_LINK, ACK_LINK or HELLO_LINK)
+ *  - byte 1: zero
+ *  - bytes 2-3: the sequence number of a DATA datagram
+ *  - bytes 4-5: the sequence number the sender expects next (cumulative ack)
+ *  - bytes 6-7: the selective ack bits, bit n set if (ack + 1 + n) has arrived
+ *
+ * Every DATA datagram is acknowledged straight away. Datagrams are resent when
+ * a later one is selectively acked or after LINK_RETRANSMIT_MS.
+ * A HELLO starts the stream again from sequence 0 in both directions.
+ *
+ * The link is used by both the DS transport and the host bridge, it does no
+ * I/O of its own. Datagrams are handed in and sent out through send_fn.
+ */
+
+/** The most stream data carried in one datagram */
+#define LINK_MAX_PAYLOAD 1024
+
+/** The size of the datagram header */
+#define LINK_HEADER_SIZE 8
+
+/** The number of datagrams that can be in flight (and held out of order) */
+#define LINK_WINDOW 8
+
+/** The size of the received stream buffer, must be a power of two */
+#define LINK_RING_SIZE 4096
+
+/** The time after which an unacknowledged datagram is sent again */
+#define LINK_RETRANSMIT_MS 100
+
+
+/** The datagram types.
+ */
+enum link_datagram_type {
+  /** Carries stream data */
+  DATA_LINK = 0,
+
+  /** Only carries acknowledgements */
+  ACK_LINK = 1,
+
+  /** Restarts the stream */
+  HELLO_LINK = 2
+};
+
+
+/** \brief A datagram held for sending or for delivery.
+ */
+struct slot_link {
+  /** The datagram, header and payload */
+  uint8_t datagram[LINK_HEADER_SIZE + LINK_MAX_PAYLOAD];
+
+  /** The payload length */
+  uint32_t length;
+
+  /** The time the datagram was last sent */
+  uint32_t sent_time;
+
+  /** The sequence number */
+  uint16_t seq;
+
+  /** Flag set while the slot holds a datagram */
+  uint8_t in_use;
+
+  /** Flag set once the datagram has been sent */
+  uint8_t sent;
+
+  /** Flag set once the peer has selectively acked the datagram */
+  uint8_t sacked;
+
+  /** Flag set when the datagram has been resent due to a selective ack */
+  uint8_t fast_resent;
+};
+
+
+/** \brief The link statistics.
+ */
+struct stats_link {
+  /** The datagrams resent after a timeout */
+  uint32_t timeout_resends;
+
+  /** The datagrams resent because a later one was acked */
+  uint32_t fast_resends;
+
+  /** The datagrams received that had already been delivered */
+  uint32_t duplicates;
+
+  /** The datagrams dropped because the stream buffer was full */
+  uint32_t ring_drops;
+};
+
+
+/** \brief The state of one end of a link.
+ */
+struct udp_link {
+  /** Sends a datagram to the peer */
+  void (*send_fn)( void *context, const uint8_t *datagram, uint32_t length);
+
+  /** Passed to send_fn */
+  void *context;
+
+  /** The datagrams sent and not yet acked, plus the one being filled */
+  struct slot_link tx[LINK_WINDOW];
+
+  /** The sequence number of the next datagram to be filled */
+  uint16_t tx_next;
+
+  /** The oldest unacked sequence number */
+  uint16_t tx_oldest;
+
+  /** The datagram being filled, NULL if none */
+  struct slot_link *filling;
+
+  /** The datagrams received ahead of the next expected one */
+  struct slot_link rx[LINK_WINDOW];
+
+  /** The next sequence number to be delivered */
+  uint16_t rx_next;
+
+  /** The received stream */
+  uint8_t ring[LINK_RING_SIZE];
+
+  /** The count of bytes put in the ring */
+  uint32_t head;
+
+  /** The count of bytes taken from the ring */
+  uint32_t tail;
+
+  /** The statistics */
+  struct stats_link stats;
+};
+
+
+/** Initialise a link, datagrams will be sent through send_fn. */
+void
+init_link( struct udp_link *link,
+	   void (*send_fn)( void *context, const uint8_t *datagram, uint32_t length),
+	   void *context);
+
+
+/** Start the stream again from the beginning, discarding anything unsent or
+ * undelivered. */
+void
+reset_link( struct udp_link *link);
+
+
+/** Reset the link and send a HELLO asking the peer to do the same. */
+void
+hello_link( struct udp_link *link);
+
+
+/** Process a datagram from the peer.
+ * Returns the datagram type, -1 if it is not a valid datagram.
+ */
+int
+receive_link( struct udp_link *link, const uint8_t *datagram, uint32_t length, uint32_t now);
+
+
+/** Take up to max bytes of the received stream.
+ * Returns the number of bytes read.
+ */
+uint32_t
+readData_link( struct udp_link *link, uint8_t *buffer, uint32_t max);
+
+
+/** Add data to the stream, sending each datagram as it fills.
+ * Returns the number of bytes taken, less than count when the window is full.
+ */
+uint32_t
+writeData_link( struct udp_link *link, const uint8_t *data, uint32_t count, uint32_t now);
+
+
+/** Send the partly filled datagram, if there is one. */
+void
+flush_link( struct udp_link *link, uint32_t now);
+
+
+/** Resend the datagrams that have not been acked in time. */
+void
+tick_link( struct udp_link *link, uint32_t now);
+
+
+/** Return non-zero if all the data written has been acked. */
+int
+idle_link( const struct udp_link *link);
+
+#endif /* End of _UDP_LINK_H_ */